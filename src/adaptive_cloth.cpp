@@ -0,0 +1,462 @@
+#include "include/adaptive_cloth.h"
+#include "include/spring_law.h"
+#include <omp.h>
+#include <algorithm>
+
+#define ADAPTIVE_BASE_SPACING 0.2
+// same areal density as the regular cloth: 0.1 kg per 0.1 x 0.1 cell
+#define ADAPTIVE_DENSITY 10.0
+// rebuilds NodeCountHistory() remembers
+#define ADAPTIVE_HISTORY 1024
+
+AdaptiveCloth::AdaptiveCloth(int tilesX, int tilesY, int tileCells, int maxLevel, double ks,
+                             double kd) {
+    tilesX_ = tilesX;
+    tilesY_ = tilesY;
+    tileCells_ = tileCells;
+    maxLevel_ = maxLevel;
+    fineW_ = tilesX_ * tileCells_ << maxLevel_;
+    fineH_ = tilesY_ * tileCells_ << maxLevel_;
+    fineSpacing_ = ADAPTIVE_BASE_SPACING / (1 << maxLevel_);
+    density_ = ADAPTIVE_DENSITY;
+    KS_ = ks;
+    KD_ = kd;
+    refineThreshold_ = 0.15;
+    coarsenThreshold_ = 0.03;
+    stuck = true;
+    glReady_ = false;
+    topologyDirty_ = true;
+}
+
+AdaptiveCloth::~AdaptiveCloth() {
+}
+
+void AdaptiveCloth::Setup() {
+    ClothSetup();
+    GLSetup();
+}
+
+// flat, hanging in the z = 0 plane from y = 5 like SpringSystem::SpringSetup(true)
+void AdaptiveCloth::ClothSetup() {
+    nodes_.clear();
+    lookup_.clear();
+    tileLevel_.assign(tilesX_ * tilesY_, 0);
+    nodeCounts_.clear();
+    Rebuild(tileLevel_);
+}
+
+int AdaptiveCloth::TileAt(int i, int j) {
+    int tileFine = tileCells_ << maxLevel_;
+    int tx = std::min(i / tileFine, tilesX_ - 1);
+    int ty = std::min(j / tileFine, tilesY_ - 1);
+    return ty * tilesX_ + tx;
+}
+
+// State at lattice point (i, j) of the mesh that is about to be replaced: copied if the
+// point was a node, otherwise bilinear from the cell of the old lattice of its tile.
+// Before the first build there is no mesh and the flat starting layout is returned.
+highp_dvec3 AdaptiveCloth::OldPos(int i, int j, int tile, bool vel) {
+    if (nodes_.empty())
+        return vel ? highp_dvec3(0, 0, 0) : highp_dvec3(i * fineSpacing_, 5 - j * fineSpacing_, 0);
+    auto it = lookup_.find(Key(i, j));
+    if (it != lookup_.end())
+        return vel ? nodes_[it->second].vel : nodes_[it->second].pos;
+
+    int s = Step(tileLevel_[tile]);
+    int i0 = i / s * s;
+    int j0 = j / s * s;
+    // a point on the cell's left or top edge stays off the next cell, which can be in
+    // another tile and not on the lattice
+    int i1 = i == i0 ? i0 : i0 + s;
+    int j1 = j == j0 ? j0 : j0 + s;
+    double fx = (i - i0) / (double) s;
+    double fy = (j - j0) / (double) s;
+    const Node& a = nodes_[NodeId(i0, j0)];
+    const Node& b = nodes_[NodeId(i1, j0)];
+    const Node& c = nodes_[NodeId(i0, j1)];
+    const Node& d = nodes_[NodeId(i1, j1)];
+    if (vel)
+        return (1 - fy) * ((1 - fx) * a.vel + fx * b.vel) + fy * ((1 - fx) * c.vel + fx * d.vel);
+    return (1 - fy) * ((1 - fx) * a.pos + fx * b.pos) + fy * ((1 - fx) * c.pos + fx * d.pos);
+}
+
+// Builds the node set, springs, masses and hanging node constraints for newLevels,
+// carrying the state over from the current mesh (whose tiles are at tileLevel_).
+void AdaptiveCloth::Rebuild(const vector<int>& newLevels) {
+    const int tileFine = tileCells_ << maxLevel_;
+    vector<Node> nodes;
+    vector<int> fineI, fineJ;
+    std::unordered_map<long long, int> lookup;
+    vector<std::pair<std::pair<int, int>, double> > springs;
+    vector<double> mass;
+
+    for (int t = 0; t < tilesX_ * tilesY_; ++t) {
+        int level = newLevels[t];
+        int s = Step(level);
+        int n = tileCells_ << level;
+        int i0 = (t % tilesX_) * tileFine;
+        int j0 = (t / tilesX_) * tileFine;
+        vector<int> ids((n + 1) * (n + 1));
+        for (int b = 0; b <= n; ++b) {
+            for (int a = 0; a <= n; ++a) {
+                int i = i0 + a * s;
+                int j = j0 + b * s;
+                auto it = lookup.find(Key(i, j));
+                if (it == lookup.end()) {
+                    Node node(vec3(0, 0, 0), vec3(0, 0, 0));
+                    node.pos = OldPos(i, j, t, false);
+                    node.vel = OldPos(i, j, t, true);
+                    it = lookup.insert(std::make_pair(Key(i, j), (int) nodes.size())).first;
+                    nodes.push_back(node);
+                    fineI.push_back(i);
+                    fineJ.push_back(j);
+                    mass.push_back(0);
+                }
+                ids[b * (n + 1) + a] = it->second;
+            }
+        }
+        double h = s * fineSpacing_;
+        // a finer tile next door has the fine springs along the shared edge, with the
+        // hanging nodes between them, so the coarse ones would make it twice as stiff
+        const int tx = t % tilesX_;
+        const int ty = t / tilesX_;
+        const bool finerAbove = ty > 0 && newLevels[t - tilesX_] > level;
+        const bool finerBelow = ty < tilesY_ - 1 && newLevels[t + tilesX_] > level;
+        const bool finerLeft = tx > 0 && newLevels[t - 1] > level;
+        const bool finerRight = tx < tilesX_ - 1 && newLevels[t + 1] > level;
+        for (int b = 0; b <= n; ++b) {
+            for (int a = 0; a <= n; ++a) {
+                int id = ids[b * (n + 1) + a];
+                if (a < n && !(b == 0 && finerAbove) && !(b == n && finerBelow)) {
+                    int id2 = ids[b * (n + 1) + a + 1];
+                    springs.push_back(std::make_pair(std::make_pair(std::min(id, id2), std::max(id, id2)), h));
+                }
+                if (b < n && !(a == 0 && finerLeft) && !(a == n && finerRight)) {
+                    int id2 = ids[(b + 1) * (n + 1) + a];
+                    springs.push_back(std::make_pair(std::make_pair(std::min(id, id2), std::max(id, id2)), h));
+                }
+                if (a < n && b < n) {
+                    mass[id] += 0.25 * density_ * h * h;
+                    mass[ids[b * (n + 1) + a + 1]] += 0.25 * density_ * h * h;
+                    mass[ids[(b + 1) * (n + 1) + a]] += 0.25 * density_ * h * h;
+                    mass[ids[(b + 1) * (n + 1) + a + 1]] += 0.25 * density_ * h * h;
+                }
+            }
+        }
+    }
+    // edges shared by two tiles of the same level were added twice
+    std::sort(springs.begin(), springs.end());
+    springs.erase(std::unique(springs.begin(), springs.end()), springs.end());
+
+    nodes_.swap(nodes);
+    lookup_.swap(lookup);
+    fineI_.swap(fineI);
+    fineJ_.swap(fineJ);
+    mass_.swap(mass);
+    tileLevel_ = newLevels;
+    const int numNodes = nodes_.size();
+
+    adjStart_.assign(numNodes + 1, 0);
+    for (auto& sp : springs) {
+        adjStart_[sp.first.first + 1]++;
+        adjStart_[sp.first.second + 1]++;
+    }
+    for (int n = 0; n < numNodes; ++n)
+        adjStart_[n + 1] += adjStart_[n];
+    adj_.resize(adjStart_[numNodes]);
+    adjRest_.resize(adjStart_[numNodes]);
+    vector<int> fill(adjStart_.begin(), adjStart_.end() - 1);
+    for (auto& sp : springs) {
+        int a = sp.first.first;
+        int b = sp.first.second;
+        adj_[fill[a]] = b;
+        adjRest_[fill[a]++] = sp.second;
+        adj_[fill[b]] = a;
+        adjRest_[fill[b]++] = sp.second;
+    }
+
+    // a node is hanging if one of the tiles it touches does not have it on its lattice
+    hanging_.clear();
+    hangA_.clear();
+    hangB_.clear();
+    pinned_.assign(numNodes, 0);
+    for (int n = 0; n < numNodes; ++n) {
+        int i = fineI_[n];
+        int j = fineJ_[n];
+        pinned_[n] = stuck && j == 0;
+        int coarsest = maxLevel_;
+        for (int di = -1; di <= 0; ++di) {
+            for (int dj = -1; dj <= 0; ++dj) {
+                int ii = i + di;
+                int jj = j + dj;
+                if (ii < 0 || jj < 0 || ii >= fineW_ || jj >= fineH_)
+                    continue;
+                coarsest = std::min(coarsest, tileLevel_[TileAt(ii, jj)]);
+            }
+        }
+        int s = Step(coarsest);
+        if (i % s == 0 && j % s == 0)
+            continue;
+        int a, b;
+        if (i % s != 0) {
+            a = NodeId(i - i % s, j);
+            b = NodeId(i - i % s + s, j);
+        } else {
+            a = NodeId(i, j - j % s);
+            b = NodeId(i, j - j % s + s);
+        }
+        hanging_.push_back(n);
+        hangA_.push_back(a);
+        hangB_.push_back(b);
+        mass_[a] += 0.5 * mass_[n];
+        mass_[b] += 0.5 * mass_[n];
+        mass_[n] = 0;
+    }
+    forces_.resize(numNodes);
+
+    // triangles of every lattice cell for drawing
+    indices_.clear();
+    for (int t = 0; t < tilesX_ * tilesY_; ++t) {
+        int s = Step(tileLevel_[t]);
+        int n = tileCells_ << tileLevel_[t];
+        int i0 = (t % tilesX_) * tileFine;
+        int j0 = (t / tilesX_) * tileFine;
+        for (int b = 0; b < n; ++b) {
+            for (int a = 0; a < n; ++a) {
+                unsigned int ul = NodeId(i0 + a * s, j0 + b * s);
+                unsigned int ll = NodeId(i0 + a * s, j0 + (b + 1) * s);
+                unsigned int ur = NodeId(i0 + (a + 1) * s, j0 + b * s);
+                unsigned int lr = NodeId(i0 + (a + 1) * s, j0 + (b + 1) * s);
+                unsigned int tris[6] = { ul, ll, ur, ur, ll, lr };
+                indices_.insert(indices_.end(), tris, tris + 6);
+            }
+        }
+    }
+    topologyDirty_ = true;
+    nodeCounts_.push_back(numNodes);
+    if (nodeCounts_.size() > ADAPTIVE_HISTORY)
+        nodeCounts_.erase(nodeCounts_.begin());
+}
+
+void AdaptiveCloth::Update(double dt) {
+    const int numNodes = nodes_.size();
+
+    #pragma omp parallel for schedule(static)
+    for (int n = 0; n < numNodes; ++n) {
+        const Node& n1 = nodes_[n];
+        highp_dvec3 force = GRAVITY * mass_[n];
+        for (int k = adjStart_[n]; k < adjStart_[n + 1]; ++k) {
+            const Node& n2 = nodes_[adj_[k]];
+            double l = length(n1.pos - n2.pos);
+            highp_dvec3 e = (n1.pos - n2.pos) / l;
+            double v1 = dot(e, n1.vel);
+            double v2 = dot(e, n2.vel);
+            force += SpringForce(KS_, KD_, l, adjRest_[k], v1, v2) * e;
+        }
+        forces_[n] = force;
+    }
+    // hanging nodes hand their force to the edge they sit on. Few enough to do serially,
+    // and parents can be shared between hanging nodes.
+    for (size_t h = 0; h < hanging_.size(); ++h) {
+        forces_[hangA_[h]] += 0.5 * forces_[hanging_[h]];
+        forces_[hangB_[h]] += 0.5 * forces_[hanging_[h]];
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int n = 0; n < numNodes; ++n) {
+        if (pinned_[n] || mass_[n] == 0)
+            continue;
+        Node& node = nodes_[n];
+        node.vel += forces_[n] / mass_[n] * dt;
+        node.pos += node.vel * dt;
+    }
+    for (size_t h = 0; h < hanging_.size(); ++h) {
+        Node& node = nodes_[hanging_[h]];
+        node.pos = 0.5 * (nodes_[hangA_[h]].pos + nodes_[hangB_[h]].pos);
+        node.vel = 0.5 * (nodes_[hangA_[h]].vel + nodes_[hangB_[h]].vel);
+    }
+}
+
+// same response the cloth gets from a kinematic sphere
+void AdaptiveCloth::HandleCollisions(vector<Sphere>& spheres) {
+    const int numNodes = nodes_.size();
+    for (Sphere& sphere : spheres) {
+        highp_dvec3 center = sphere.position;
+        #pragma omp parallel for schedule(static)
+        for (int n = 0; n < numNodes; ++n) {
+            Node& node = nodes_[n];
+            double d = length(node.pos - center);
+            if (d < sphere.radius + COLLISION_RANGE) {
+                highp_dvec3 normal = (node.pos - center) / d;
+                node.vel -= COLLISION_BOUNCE * dot(node.vel, normal) * normal;
+                node.pos = center + (COLLISION_OFFSET + sphere.radius) * normal;
+            }
+        }
+    }
+}
+
+// Largest of the strain of the tile's springs and the turning angle between
+// consecutive lattice segments, measured at the tile's current resolution.
+double AdaptiveCloth::TileMetric(int tile) {
+    const int tileFine = tileCells_ << maxLevel_;
+    int s = Step(tileLevel_[tile]);
+    int n = tileCells_ << tileLevel_[tile];
+    int i0 = (tile % tilesX_) * tileFine;
+    int j0 = (tile / tilesX_) * tileFine;
+    double h = s * fineSpacing_;
+    double metric = 0;
+    for (int b = 0; b <= n; ++b) {
+        for (int a = 0; a <= n; ++a) {
+            const highp_dvec3& p = nodes_[NodeId(i0 + a * s, j0 + b * s)].pos;
+            if (a < n) {
+                const highp_dvec3& q = nodes_[NodeId(i0 + (a + 1) * s, j0 + b * s)].pos;
+                metric = fmax(metric, fabs(length(q - p) / h - 1));
+            }
+            if (b < n) {
+                const highp_dvec3& q = nodes_[NodeId(i0 + a * s, j0 + (b + 1) * s)].pos;
+                metric = fmax(metric, fabs(length(q - p) / h - 1));
+            }
+            if (a > 0 && a < n) {
+                const highp_dvec3& l = nodes_[NodeId(i0 + (a - 1) * s, j0 + b * s)].pos;
+                const highp_dvec3& r = nodes_[NodeId(i0 + (a + 1) * s, j0 + b * s)].pos;
+                metric = fmax(metric, length(l + r - 2.0 * p) / h);
+            }
+            if (b > 0 && b < n) {
+                const highp_dvec3& u = nodes_[NodeId(i0 + a * s, j0 + (b - 1) * s)].pos;
+                const highp_dvec3& d = nodes_[NodeId(i0 + a * s, j0 + (b + 1) * s)].pos;
+                metric = fmax(metric, length(u + d - 2.0 * p) / h);
+            }
+        }
+    }
+    return metric;
+}
+
+// raise tiles until no two neighbours are more than one level apart
+void AdaptiveCloth::Balance() {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int t = 0; t < tilesX_ * tilesY_; ++t) {
+            int tx = t % tilesX_;
+            int ty = t / tilesX_;
+            const int dx[4] = { -1, 1, 0, 0 };
+            const int dy[4] = { 0, 0, -1, 1 };
+            for (int k = 0; k < 4; ++k) {
+                int nx = tx + dx[k];
+                int ny = ty + dy[k];
+                if (nx < 0 || ny < 0 || nx >= tilesX_ || ny >= tilesY_)
+                    continue;
+                if (tileLevel_[ny * tilesX_ + nx] > tileLevel_[t] + 1) {
+                    tileLevel_[t] = tileLevel_[ny * tilesX_ + nx] - 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+// Refines and coarsens tiles one level at a time and rebuilds the mesh if anything
+// changed. The node count after every rebuild is appended to NodeCountHistory().
+void AdaptiveCloth::Adapt() {
+    const int numTiles = tilesX_ * tilesY_;
+    vector<double> metric(numTiles);
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < numTiles; ++t)
+        metric[t] = TileMetric(t);
+
+    vector<int> oldLevels = tileLevel_;
+    for (int t = 0; t < numTiles; ++t) {
+        if (metric[t] > refineThreshold_ && tileLevel_[t] < maxLevel_)
+            tileLevel_[t]++;
+        else if (metric[t] < coarsenThreshold_ && tileLevel_[t] > 0)
+            tileLevel_[t]--;
+    }
+    Balance();
+    if (tileLevel_ == oldLevels)
+        return;
+    vector<int> newLevels = tileLevel_;
+    tileLevel_ = oldLevels;
+    Rebuild(newLevels);
+}
+
+void AdaptiveCloth::GLSetup() {
+    shader_.LoadFromFile(GL_VERTEX_SHADER, "shaders/cloth_shader.vert");
+    shader_.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/cloth_shader.frag");
+    shader_.CreateAndLinkProgram();
+    shader_.Enable();
+    shader_.AddAttribute("inPos");
+    shader_.AddAttribute("inNormal");
+    shader_.AddAttribute("texCoords");
+    shader_.AddUniform("VP");
+    shader_.AddUniform("normalMatrix");
+    shader_.AddUniform("tex");
+    texture_ = LoadTexture("textures/blue_cloth.jpg");
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    glGenBuffers(CLOTH_TOTAL_VBOS, vbos_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_VERTS]);
+    glEnableVertexAttribArray(shader_["inPos"]);
+    glVertexAttribPointer(shader_["inPos"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_NORMS]);
+    glEnableVertexAttribArray(shader_["inNormal"]);
+    glVertexAttribPointer(shader_["inNormal"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_TEX_COORDS]);
+    glEnableVertexAttribArray(shader_["texCoords"]);
+    glVertexAttribPointer(shader_["texCoords"], 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glReady_ = true;
+}
+
+// the node set only changes in Rebuild, so texture coordinates and indices are only
+// sent again after that
+void AdaptiveCloth::UploadTopology() {
+    int numNodes = nodes_.size();
+    texCoords_.resize(numNodes);
+    for (int n = 0; n < numNodes; ++n)
+        texCoords_[n] = vec2(fineI_[n] / (float) fineW_, 1.0f - fineJ_[n] / (float) fineH_);
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_TEX_COORDS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * numNodes, &texCoords_[0], GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos_[CLOTH_INDICES]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices_.size(), &indices_[0],
+                 GL_STATIC_DRAW);
+    topologyDirty_ = false;
+}
+
+void AdaptiveCloth::Render(const mat4& V, const mat4& P) {
+    if (topologyDirty_)
+        UploadTopology();
+
+    int numNodes = nodes_.size();
+    posArray_.resize(numNodes);
+    normals_.assign(numNodes, vec3(0, 0, 0));
+    for (int n = 0; n < numNodes; ++n)
+        posArray_[n] = nodes_[n].pos;
+    for (size_t i = 0; i < indices_.size(); i += 3) {
+        vec3 a = posArray_[indices_[i + 0]];
+        vec3 b = posArray_[indices_[i + 1]];
+        vec3 c = posArray_[indices_[i + 2]];
+        vec3 n = cross(b - a, c - a);
+        normals_[indices_[i + 0]] += n;
+        normals_[indices_[i + 1]] += n;
+        normals_[indices_[i + 2]] += n;
+    }
+    for (int n = 0; n < numNodes; ++n)
+        normals_[n] = normalize(normals_[n]);
+
+    glBindVertexArray(vao_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_VERTS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes, &posArray_[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[CLOTH_NORMS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes, &normals_[0], GL_STREAM_DRAW);
+
+    mat4 VP = P * V;
+    shader_.Enable();
+    glUniformMatrix4fv(shader_["VP"], 1, GL_FALSE, value_ptr(VP));
+    mat4 nM = transpose(inverse(V));
+    glUniformMatrix4fv(shader_["normalMatrix"], 1, GL_FALSE, value_ptr(nM));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glUniform1i(shader_["tex"], 0);
+    glDrawElements(GL_TRIANGLES, indices_.size(), GL_UNSIGNED_INT, 0);
+}
@@ -0,0 +1,233 @@
+#include "include/auto_tune.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+// step the candidates are timed with, small enough that the cloth barely moves
+#define TUNE_DT 0.0001
+// each candidate is stepped until this many seconds have gone by or for TUNE_MAX_STEPS
+#define TUNE_SECONDS 0.02
+#define TUNE_MAX_STEPS 64
+
+static const char* layoutNames[4] = { "row major", "Morton", "blocked Morton", "padded" };
+
+// the tile sizes BenchmarkTiled compares
+static const int tileSizes[4][2] = { { 16, 64 }, { 32, 64 }, { 32, 128 }, { 64, 256 } };
+
+static string CacheFile() {
+    const char* file = getenv("CLOTH_TUNE_CACHE");
+    if (file)
+        return file;
+    const char* dir = getenv("XDG_CACHE_HOME");
+    if (dir)
+        return string(dir) + "/cloth_tune";
+    const char* home = getenv("HOME");
+    if (!home)
+        return "";
+    string cache = string(home) + "/.cache";
+    mkdir(cache.c_str(), 0755);
+    return cache + "/cloth_tune";
+}
+
+// the model name from /proc/cpuinfo and the number of threads OpenMP gives us, with
+// underscores for spaces so the key is one word of the cache file
+static string HostKey() {
+    string model = "unknown";
+    std::ifstream in("/proc/cpuinfo");
+    string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t colon = line.find(':');
+            if (colon != string::npos && line.find_first_not_of(" ", colon + 1) != string::npos)
+                model = line.substr(line.find_first_not_of(" ", colon + 1));
+            break;
+        }
+    }
+    string key = model + " x" + std::to_string(omp_get_max_threads());
+    for (char& c : key)
+        if (c == ' ' || c == '\t')
+            c = '_';
+    return key;
+}
+
+// A line of the cache file is the host key and the grid size followed by the choice:
+// "<host> <dimX> <dimY> <layout> <tiled> <tile rows> <tile cols> <threads> <level>"
+static bool ReadCache(const string& file, const string& host, int dimX, int dimY,
+                      StepConfig& config) {
+    std::ifstream in(file);
+    string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        string lineHost, level;
+        int x, y, layout, tiled;
+        StepConfig c;
+        if (!(fields >> lineHost >> x >> y >> layout >> tiled >> c.tileRows >> c.tileCols >>
+              c.threads >> level))
+            continue;
+        if (lineHost != host || x != dimX || y != dimY || layout < ROW_MAJOR || layout > PADDED)
+            continue;
+        c.layout = (NodeLayout) layout;
+        c.tiled = tiled != 0;
+        int l = 0;
+        while (l < CPU_LEVELS && level != CpuLevelName((CpuLevel) l))
+            ++l;
+        if (l == CPU_LEVELS)
+            continue;
+        c.level = (CpuLevel) l;
+        config = c;
+        return true;
+    }
+    return false;
+}
+
+// replaces the line of the host and grid size, if there is one
+static void WriteCache(const string& file, const string& host, int dimX, int dimY,
+                       const StepConfig& config) {
+    const string key = host + " " + std::to_string(dimX) + " " + std::to_string(dimY) + " ";
+    vector<string> lines;
+    {
+        std::ifstream in(file);
+        string line;
+        while (std::getline(in, line))
+            if (line.compare(0, key.size(), key) != 0)
+                lines.push_back(line);
+    }
+    std::ostringstream choice;
+    choice << key << config.layout << " " << config.tiled << " " << config.tileRows << " "
+           << config.tileCols << " " << config.threads << " " << CpuLevelName(config.level);
+    lines.push_back(choice.str());
+    std::ofstream out(file);
+    for (const string& line : lines)
+        out << line << "\n";
+    if (!out)
+        cout << "Can't write the tuning cache " << file << endl;
+}
+
+// seconds per step of ss as it is set up
+static double TimeStep(SpringSystem& ss) {
+    // the first step sizes the scratch arrays and starts the threads
+    ss.Update(TUNE_DT);
+    for (int steps = 1; ; steps *= 2) {
+        double start = omp_get_wtime();
+        for (int i = 0; i < steps; ++i)
+            ss.Update(TUNE_DT);
+        double time = omp_get_wtime() - start;
+        if (time >= TUNE_SECONDS || steps >= TUNE_MAX_STEPS)
+            return time / steps;
+    }
+}
+
+// best and bestTime become the fastest of the candidates if it beats them
+static void Fastest(SpringSystem& ss, const vector<StepConfig>& candidates, StepConfig& best,
+                    double& bestTime) {
+    for (const StepConfig& candidate : candidates) {
+        ApplyStepConfig(ss, candidate);
+        double time = TimeStep(ss);
+        if (time < bestTime) {
+            bestTime = time;
+            best = candidate;
+        }
+    }
+}
+
+void ApplyStepConfig(SpringSystem& ss, const StepConfig& config) {
+    ss.Tiled(false);
+    if (ss.Layout() != config.layout)
+        ss.SetLayout(config.layout);
+    ss.SetTileSize(config.tileRows, config.tileCols);
+    ss.Tiled(config.tiled);
+    ss.Threads(config.threads);
+    ss.Isa(config.level);
+}
+
+string StepConfigName(const StepConfig& config) {
+    std::ostringstream name;
+    if (config.tiled)
+        name << "tiled " << config.tileRows << "x" << config.tileCols;
+    else
+        name << layoutNames[config.layout];
+    name << ", " << config.threads << (config.threads == 1 ? " thread, " : " threads, ")
+         << CpuLevelName(config.level);
+    return name.str();
+}
+
+void TuneStep(SpringSystem& ss) {
+    const int dimX = ss.DimX();
+    const int dimY = ss.DimY();
+    const string file = CacheFile();
+    const string host = HostKey();
+    const char* again = getenv("CLOTH_TUNE");
+    StepConfig best;
+    if (!file.empty() && !(again && string(again) == "again") &&
+        ReadCache(file, host, dimX, dimY, best) && best.level <= DetectCpuLevel() &&
+        best.threads <= omp_get_max_threads()) {
+        if (getenv("CLOTH_ISA"))
+            best.level = ss.Isa();
+        ApplyStepConfig(ss, best);
+        cout << "Step for " << dimX << "x" << dimY << " from " << file << ": "
+             << StepConfigName(best) << endl;
+        return;
+    }
+
+    vector<Node> saved;
+    for (int r = 0; r < dimY; ++r)
+        for (int c = 0; c < dimX; ++c)
+            saved.push_back(ss.GetNode(r, c));
+
+    // the step, on every thread
+    vector<StepConfig> candidates;
+    StepConfig config;
+    config.tiled = false;
+    config.tileRows = ss.TileRows();
+    config.tileCols = ss.TileCols();
+    config.threads = omp_get_max_threads();
+    config.level = ss.Isa();
+    config.layout = ROW_MAJOR;
+    candidates.push_back(config);
+    config.layout = PADDED;
+    candidates.push_back(config);
+    config.layout = ROW_MAJOR;
+    config.tiled = true;
+    for (int t = 0; t < 4; ++t) {
+        config.tileRows = tileSizes[t][0];
+        config.tileCols = tileSizes[t][1];
+        candidates.push_back(config);
+    }
+    double bestTime = 1e300;
+    Fastest(ss, candidates, best, bestTime);
+
+    // its thread count, small grids don't have the work for all of them. The PADDED step
+    // runs on the pool's threads if there is one.
+    candidates.clear();
+    config = best;
+    const bool onPool = ss.Pool() && best.layout == PADDED && !best.tiled;
+    for (int threads = 1; threads < best.threads && !onPool; threads *= 2) {
+        config.threads = threads;
+        candidates.push_back(config);
+    }
+    Fastest(ss, candidates, best, bestTime);
+
+    // every step comes in all the levels
+    candidates.clear();
+    config = best;
+    if (!getenv("CLOTH_ISA")) {
+        for (int level = CPU_SSE2; level <= DetectCpuLevel(); ++level) {
+            config.level = (CpuLevel) level;
+            if (config.level != best.level)
+                candidates.push_back(config);
+        }
+    }
+    Fastest(ss, candidates, best, bestTime);
+
+    ApplyStepConfig(ss, best);
+    for (int r = 0; r < dimY; ++r)
+        for (int c = 0; c < dimX; ++c)
+            ss.GetNode(r, c) = saved[r * dimX + c];
+    printf("Step for %dx%d: %s, %.3f ms/step\n", dimX, dimY, StepConfigName(best).c_str(),
+           1e3 * bestTime);
+    if (!file.empty())
+        WriteCache(file, host, dimX, dimY, best);
+}
@@ -0,0 +1,386 @@
+#include "include/benchmark.h"
+#include "include/fixed_spring_system.h"
+#include "include/mixed_spring_system.h"
+#include "include/task_pool.h"
+#include "include/numa.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Steps both versions of an N x N cloth from the same start with drag on and compares
+// the time per step. The two run the same arithmetic, so the final positions should
+// agree up to the order the threads of the dynamic version add up the forces.
+template <int N>
+static void BenchmarkFixed(int steps) {
+    SpringSystem dynamic(N, N, 500, 100);
+    FixedSpringSystem<N, N>* fixed = new FixedSpringSystem<N, N>(500, 100);
+    dynamic.SpringSetup(true);
+    fixed->SpringSetup(true);
+    for (int r = 0; r < N; ++r) {
+        dynamic.GetNode(r, N - 1).vel = highp_dvec3(0, 0, 1);
+        fixed->GetNode(r, N - 1).vel = highp_dvec3(0, 0, 1);
+    }
+
+    double start = omp_get_wtime();
+    for (int i = 0; i < steps; ++i)
+        dynamic.Update(0.0001);
+    double dynamicTime = omp_get_wtime() - start;
+    start = omp_get_wtime();
+    for (int i = 0; i < steps; ++i)
+        fixed->Update(0.0001);
+    double fixedTime = omp_get_wtime() - start;
+
+    double diff = 0;
+    for (int r = 0; r < N; ++r)
+        for (int c = 0; c < N; ++c)
+            diff = fmax(diff, length(dynamic.GetNode(r, c).pos - fixed->GetNode(r, c).pos));
+    printf("%3dx%-3d dynamic %8.3f us/step   fixed %8.3f us/step   speedup %5.2fx   max diff %g\n",
+           N, N, 1e6 * dynamicTime / steps, 1e6 * fixedTime / steps, dynamicTime / fixedTime, diff);
+    delete fixed;
+}
+
+void BenchmarkFixedGrids(int steps) {
+    printf("SpringSystem vs FixedSpringSystem, %d steps, %d threads\n", steps, omp_get_max_threads());
+    BenchmarkFixed<8>(steps);
+    BenchmarkFixed<16>(steps);
+    BenchmarkFixed<32>(steps);
+}
+
+// starts every cloth with the same sideways push so the drag and springs have work to do
+static void StartCloth(SpringSystem& ss) {
+    ss.SpringSetup(true);
+    for (int r = 0; r < ss.DimY(); ++r)
+        ss.GetNode(r, ss.DimX() - 1).vel = highp_dvec3(0, 0, 1);
+}
+
+static double TimeSteps(SpringSystem& ss, int steps) {
+    double start = omp_get_wtime();
+    for (int i = 0; i < steps; ++i)
+        ss.Update(0.0001);
+    return (omp_get_wtime() - start) / steps;
+}
+
+static double MaxDifference(SpringSystem& a, SpringSystem& b) {
+    double diff = 0;
+    for (int r = 0; r < a.DimY(); ++r)
+        for (int c = 0; c < a.DimX(); ++c)
+            diff = fmax(diff, length(a.GetNode(r, c).pos - b.GetNode(r, c).pos));
+    return diff;
+}
+
+void BenchmarkTiled(int dim, int steps) {
+    printf("%dx%d cloth, %d steps, %d threads\n", dim, dim, steps, omp_get_max_threads());
+    SpringSystem phases(dim, dim, 500, 100);
+    StartCloth(phases);
+    double phasesTime = TimeSteps(phases, steps);
+    printf("phase by phase       %9.3f ms/step\n", 1e3 * phasesTime);
+
+    const int tiles[4][2] = { { 16, 64 }, { 32, 64 }, { 32, 128 }, { 64, 256 } };
+    for (int t = 0; t < 4; ++t) {
+        SpringSystem tiled(dim, dim, 500, 100);
+        StartCloth(tiled);
+        tiled.Tiled(true);
+        tiled.SetTileSize(tiles[t][0], tiles[t][1]);
+        double tiledTime = TimeSteps(tiled, steps);
+        printf("tiled %3d x %-3d      %9.3f ms/step   speedup %5.2fx   max diff %g\n",
+               tiles[t][0], tiles[t][1], 1e3 * tiledTime, phasesTime / tiledTime,
+               MaxDifference(phases, tiled));
+    }
+}
+
+// A hardware cache event counted for this process (all of its threads). Reads -1 when
+// the kernel or the machine does not give us the counter, e.g. inside most VMs.
+class CacheCounter {
+    public:
+        CacheCounter(unsigned int cache, unsigned int result) : fd_(-1) {
+#ifdef __linux__
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+        ~CacheCounter() {
+#ifdef __linux__
+            if (fd_ >= 0)
+                close(fd_);
+#endif
+        }
+        void Start() {
+#ifdef __linux__
+            if (fd_ >= 0) {
+                ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+        long long Stop() {
+            long long count = -1;
+#ifdef __linux__
+            if (fd_ >= 0) {
+                ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd_, &count, sizeof(count)) != sizeof(count))
+                    count = -1;
+            }
+#endif
+            return count;
+        }
+
+    private:
+        int fd_;
+};
+
+static void PrintMisses(const char* name, long long misses, int steps) {
+    if (misses < 0)
+        printf("   %s n/a", name);
+    else
+        printf("   %s %8.0f", name, (double) misses / steps);
+}
+
+void BenchmarkLayouts(int dim, int steps) {
+    printf("%dx%d cloth, %d steps, %d threads, misses per step\n", dim, dim, steps,
+           omp_get_max_threads());
+#ifdef __linux__
+    const unsigned int l1 = PERF_COUNT_HW_CACHE_L1D;
+    const unsigned int ll = PERF_COUNT_HW_CACHE_LL;
+    const unsigned int tlb = PERF_COUNT_HW_CACHE_DTLB;
+    const unsigned int miss = PERF_COUNT_HW_CACHE_RESULT_MISS;
+#else
+    const unsigned int l1 = 0, ll = 0, tlb = 0, miss = 0;
+#endif
+    const char* names[4] = { "row major", "Morton", "blocked Morton", "padded" };
+    SpringSystem rowMajor(dim, dim, 500, 100);
+    StartCloth(rowMajor);
+    double rowMajorTime = 0;
+    for (int layout = ROW_MAJOR; layout <= PADDED; ++layout) {
+        SpringSystem* ss = &rowMajor;
+        if (layout != ROW_MAJOR) {
+            ss = new SpringSystem(dim, dim, 500, 100);
+            StartCloth(*ss);
+            ss->SetLayout((NodeLayout) layout);
+        }
+        CacheCounter l1Misses(l1, miss);
+        CacheCounter llMisses(ll, miss);
+        CacheCounter tlbMisses(tlb, miss);
+        l1Misses.Start();
+        llMisses.Start();
+        tlbMisses.Start();
+        double time = TimeSteps(*ss, steps);
+        long long l1Count = l1Misses.Stop();
+        long long llCount = llMisses.Stop();
+        long long tlbCount = tlbMisses.Stop();
+        if (layout == ROW_MAJOR)
+            rowMajorTime = time;
+        printf("%-15s %9.3f ms/step   speedup %5.2fx", names[layout], 1e3 * time,
+               rowMajorTime / time);
+        PrintMisses("L1D", l1Count, steps);
+        PrintMisses("LLC", llCount, steps);
+        PrintMisses("dTLB", tlbCount, steps);
+        printf("   max diff %g\n", MaxDifference(rowMajor, *ss));
+        if (ss != &rowMajor)
+            delete ss;
+    }
+}
+
+static double MaxDifference(SpringSystem& a, MixedSpringSystem& b) {
+    double diff = 0;
+    for (int r = 0; r < a.DimY(); ++r)
+        for (int c = 0; c < a.DimX(); ++c)
+            diff = fmax(diff, length(a.GetNode(r, c).pos - b.Position(r, c)));
+    return diff;
+}
+
+// Steps the cloth in double and twice in mixed precision, with and without the
+// compensated position sums, and prints how far the mixed runs are from the double one
+// along the way.
+static void Drift(SpringSystem& baseline, int steps, double dt) {
+    MixedSpringSystem compensated;
+    compensated.Load(baseline);
+    MixedSpringSystem plain;
+    plain.Load(baseline);
+    plain.Compensated(false);
+
+    double baselineTime = 0, compensatedTime = 0, plainTime = 0;
+    const int reports = 10;
+    for (int k = 1; k <= reports; ++k) {
+        int n = (long long) steps * k / reports - (long long) steps * (k - 1) / reports;
+        double start = omp_get_wtime();
+        for (int i = 0; i < n; ++i)
+            baseline.Update(dt);
+        baselineTime += omp_get_wtime() - start;
+        start = omp_get_wtime();
+        for (int i = 0; i < n; ++i)
+            compensated.Step(dt);
+        compensatedTime += omp_get_wtime() - start;
+        start = omp_get_wtime();
+        for (int i = 0; i < n; ++i)
+            plain.Step(dt);
+        plainTime += omp_get_wtime() - start;
+        printf("step %9lld   height %12.2f   max diff compensated %10.3g   plain %10.3g\n",
+               (long long) steps * k / reports, baseline.GetNode(0, 0).pos.y,
+               MaxDifference(baseline, compensated), MaxDifference(baseline, plain));
+    }
+    printf("double %8.3f us/step   compensated %8.3f us/step   plain %8.3f us/step\n",
+           1e6 * baselineTime / steps, 1e6 * compensatedTime / steps, 1e6 * plainTime / steps);
+}
+
+// Two runs that do not depend on chaotic folding, so the difference is the drift: a
+// cloth falling freely without drag ends up far from where it started and tests the
+// long sums and the rebasing, and a pinned cloth pushed sideways tests the forces while
+// it swings back to rest.
+void BenchmarkDrift(int dim, int steps) {
+    const double dt = 0.0001;
+    printf("%dx%d cloth, %d steps of %g, %d threads\n", dim, dim, steps, dt,
+           omp_get_max_threads());
+
+    printf("free fall\n");
+    SpringSystem falling(dim, dim, 500, 100);
+    falling.SpringSetup(true);
+    falling.Drag(false);
+    falling.stuck = false;
+    Drift(falling, steps, dt);
+
+    printf("pinned, pushed sideways\n");
+    SpringSystem hanging(dim, dim, 500, 100);
+    StartCloth(hanging);
+    Drift(hanging, steps, dt);
+}
+
+// Both run the same kernels on the same bands of nodes, only the order the threads get
+// to them differs, so the cloths have to stay exactly the same. A kinematic sphere in
+// the way makes the collisions part of the step.
+void BenchmarkTasks(int dim, int steps) {
+    printf("%dx%d cloth, %d steps, %d threads\n", dim, dim, steps, omp_get_max_threads());
+    TaskPool pool(omp_get_max_threads());
+    vector<Sphere> spheres(1, Sphere(glm::vec3(0.05 * dim, 5 - 0.05 * dim, 0.3), 0.02 * dim));
+    SpringSystem openmp(dim, dim, 500, 100);
+    SpringSystem tasks(dim, dim, 500, 100);
+    SpringSystem* cloths[2] = { &openmp, &tasks };
+    double times[2];
+    for (int k = 0; k < 2; ++k) {
+        cloths[k]->SetLayout(PADDED);
+        StartCloth(*cloths[k]);
+        if (k == 1)
+            cloths[k]->Pool(&pool);
+        double start = omp_get_wtime();
+        for (int i = 0; i < steps; ++i)
+            cloths[k]->Update(0.0001, spheres);
+        times[k] = (omp_get_wtime() - start) / steps;
+    }
+    printf("OpenMP     %9.3f ms/step\n", 1e3 * times[0]);
+    printf("task graph %9.3f ms/step   speedup %5.2fx   max diff %g\n", 1e3 * times[1],
+           times[0] / times[1], MaxDifference(openmp, tasks));
+}
+
+// Every thread streams its band of a dim x dim node array a few times the way the
+// integration does (reading 48 and writing 24 bytes a node) and the bytes of the threads
+// on each NUMA node are added up over the time from the first of them starting to the
+// last one finishing.
+static void PrintBandwidth(Node* nodes, int dim, int passes, int numNumaNodes) {
+    vector<double> bytes(numNumaNodes, 0);
+    vector<double> first(numNumaNodes, 1e300);
+    vector<double> last(numNumaNodes, 0);
+    #pragma omp parallel
+    {
+        int rowBegin, rowEnd;
+        SpringSystem::RowBand(dim, omp_get_thread_num(), omp_get_num_threads(), rowBegin, rowEnd);
+        const int begin = rowBegin * dim;
+        const int end = rowEnd * dim;
+        #pragma omp barrier
+        double start = omp_get_wtime();
+        for (int p = 0; p < passes; ++p)
+            for (int i = begin; i < end; ++i)
+                nodes[i].pos += nodes[i].vel * 1e-4;
+        double stop = omp_get_wtime();
+        int node = std::min(numNumaNodes - 1, CpuNumaNode(CurrentCpu()));
+        #pragma omp critical
+        {
+            bytes[node] += 72.0 * (end - begin) * passes;
+            first[node] = fmin(first[node], start);
+            last[node] = fmax(last[node], stop);
+        }
+    }
+    for (int node = 0; node < numNumaNodes; ++node) {
+        if (bytes[node] > 0)
+            printf("   node %d %7.2f GB/s", node, bytes[node] / (last[node] - first[node]) * 1e-9);
+        else
+            printf("   node %d       -    ", node);
+    }
+    printf("\n");
+}
+
+void BenchmarkNuma(int dim, int steps) {
+    const int numNumaNodes = NumaNodes().size();
+    const int maxThreads = omp_get_max_threads();
+    printf("%dx%d cloth, %d steps, %d NUMA nodes, up to %d threads\n", dim, dim, steps,
+           numNumaNodes, maxThreads);
+    const vector<int> cpus = AffinityCpus(maxThreads);
+
+    // a single thread touches everything of this one first
+    omp_set_num_threads(1);
+    PinOpenMPThreads(cpus);
+    SpringSystem oneNode(dim, dim, 500, 100);
+    oneNode.SetLayout(PADDED);
+    StartCloth(oneNode);
+    Node* oneNodeArray = SpringSystem::AllocateNodes(dim * dim, dim);
+    omp_set_num_threads(maxThreads);
+    SpringSystem banded(dim, dim, 500, 100);
+    banded.SetLayout(PADDED);
+    StartCloth(banded);
+
+    double serialTime = 0;
+    for (int threads = 1; ; threads = std::min(2 * threads, maxThreads)) {
+        omp_set_num_threads(threads);
+        PinOpenMPThreads(cpus);
+        banded.NumaBands(true);
+        Node* bandedArray = SpringSystem::AllocateNodes(dim * dim, dim);
+
+        double time = TimeSteps(oneNode, steps);
+        if (threads == 1)
+            serialTime = time;
+        printf("%3d threads one node %9.3f ms/step   speedup %5.2fx", threads, 1e3 * time,
+               serialTime / time);
+        PrintBandwidth(oneNodeArray, dim, steps, numNumaNodes);
+        time = TimeSteps(banded, steps);
+        printf("%3d threads banded   %9.3f ms/step   speedup %5.2fx", threads, 1e3 * time,
+               serialTime / time);
+        PrintBandwidth(bandedArray, dim, steps, numNumaNodes);
+
+        SpringSystem::FreeNodes(bandedArray);
+        if (threads == maxThreads)
+            break;
+    }
+    SpringSystem::FreeNodes(oneNodeArray);
+}
+
+void BenchmarkIsa(int dim, int steps) {
+    const CpuLevel detected = DetectCpuLevel();
+    printf("%dx%d cloth, %d steps, %d threads\n", dim, dim, steps, omp_get_max_threads());
+    SpringSystem baseline(dim, dim, 500, 100);
+    baseline.SetLayout(PADDED);
+    baseline.Isa(CPU_SSE2);
+    StartCloth(baseline);
+    double baselineTime = TimeSteps(baseline, steps);
+    printf("%-7s %9.3f ms/step\n", CpuLevelName(CPU_SSE2), 1e3 * baselineTime);
+    for (int level = CPU_SSE2 + 1; level <= detected; ++level) {
+        SpringSystem ss(dim, dim, 500, 100);
+        ss.SetLayout(PADDED);
+        ss.Isa((CpuLevel) level);
+        StartCloth(ss);
+        double time = TimeSteps(ss, steps);
+        printf("%-7s %9.3f ms/step   speedup %5.2fx   max diff %g\n", CpuLevelName((CpuLevel) level),
+               1e3 * time, baselineTime / time, MaxDifference(baseline, ss));
+    }
+}
@@ -0,0 +1,204 @@
+#include "include/cloth_lod.h"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+
+// rows of a level with cols columns, so its cells are square on a cloth of the render
+// grid's aspect ratio
+static int LevelRows(int cols, int renderDimX, int renderDimY) {
+    double aspect = (renderDimY - 1) / (double) (renderDimX - 1);
+    return std::max(2, (int) lround((cols - 1) * aspect) + 1);
+}
+
+// All levels share the physical size and total mass of the finest one. A spring of a
+// coarser level stands for a chain of finer ones, so ks and kd go down with its rest
+// length and ks * rest, the force per unit strain, is the same on every level.
+ClothLOD::ClothLOD(int renderDimX, int renderDimY, const vector<int>& levelDims, double ks,
+                   double kd) {
+    const double rest = 0.1;
+    const double mass = 0.1;
+    double width = rest * (levelDims[0] - 1);
+    double totalMass = mass * levelDims[0] * LevelRows(levelDims[0], renderDimX, renderDimY);
+    for (size_t i = 0; i < levelDims.size(); ++i) {
+        int cols = levelDims[i];
+        int rows = LevelRows(cols, renderDimX, renderDimY);
+        double levelRest = width / (cols - 1);
+        double scale = rest / levelRest;
+        levels_.push_back(new SpringSystem(cols, rows, ks * scale, kd * scale, levelRest,
+                                           totalMass / (cols * rows)));
+        switchDistances_.push_back(15.0 * i);
+    }
+    render_ = new SpringSystem(renderDimX, renderDimY, ks, kd,
+                               width / (renderDimX - 1), totalMass / (renderDimX * renderDimY));
+    active_ = 0;
+    hysteresis_ = 0.1;
+    nodeBudget_ = 0;
+    wrinkleAmplitude_ = 0;
+    wrinkleFrequency_ = 20;
+    fadeFrames_ = 10;
+    fadeLeft_ = 0;
+}
+
+ClothLOD::~ClothLOD() {
+    for (SpringSystem* s : levels_)
+        delete s;
+    delete render_;
+}
+
+void ClothLOD::SpringSetup(bool vertical) {
+    for (SpringSystem* s : levels_)
+        s->SpringSetup(vertical);
+    render_->SpringSetup(vertical);
+    fadeLeft_ = 0;
+}
+
+void ClothLOD::Setup() {
+    SpringSetup(true);
+    render_->GLSetup();
+}
+
+void ClothLOD::Update(double dt) {
+    levels_[active_]->Update(dt);
+}
+
+void ClothLOD::HandleCollisions(vector<Sphere>& spheres) {
+    levels_[active_]->HandleCollisions(spheres);
+}
+
+// bilinear lookup of a node's position (or velocity) at grid coordinates (u, v) in [0, 1]
+static highp_dvec3 Bilinear(SpringSystem& s, double u, double v, bool vel) {
+    double x = u * (s.DimX() - 1);
+    double y = v * (s.DimY() - 1);
+    int c = std::min((int) x, s.DimX() - 2);
+    int r = std::min((int) y, s.DimY() - 2);
+    double fx = x - c;
+    double fy = y - r;
+    highp_dvec3 a = vel ? s.GetNode(r, c).vel : s.GetNode(r, c).pos;
+    highp_dvec3 b = vel ? s.GetNode(r, c + 1).vel : s.GetNode(r, c + 1).pos;
+    highp_dvec3 d = vel ? s.GetNode(r + 1, c).vel : s.GetNode(r + 1, c).pos;
+    highp_dvec3 e = vel ? s.GetNode(r + 1, c + 1).vel : s.GetNode(r + 1, c + 1).pos;
+    return (1 - fy) * ((1 - fx) * a + fx * b) + fy * ((1 - fx) * d + fx * e);
+}
+
+// moves the state of one level onto another so the simulation carries on where it was
+void ClothLOD::Transfer(SpringSystem& from, SpringSystem& to) {
+    #pragma omp parallel for
+    for (int r = 0; r < to.DimY(); ++r) {
+        for (int c = 0; c < to.DimX(); ++c) {
+            double u = c / (double) (to.DimX() - 1);
+            double v = r / (double) (to.DimY() - 1);
+            Node& n = to.GetNode(r, c);
+            n.pos = Bilinear(from, u, v, false);
+            n.vel = Bilinear(from, u, v, true);
+        }
+    }
+}
+
+static inline highp_dvec3 CatmullRom(const highp_dvec3& p0, const highp_dvec3& p1,
+                                     const highp_dvec3& p2, const highp_dvec3& p3, double t) {
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return 0.5 * (2.0 * p1 + (p2 - p0) * t + (2.0 * p0 - 5.0 * p1 + 4.0 * p2 - p3) * t2 +
+                  (3.0 * p1 - p0 - 3.0 * p2 + p3) * t3);
+}
+
+// Catmull-Rom upsampling of the simulated level onto the render grid, plus wrinkles:
+// a ripple along the cloth normal scaled by how much the coarse cell is compressed.
+void ClothLOD::Upsample(SpringSystem& from, vector<highp_dvec3>& out) {
+    const int dx = from.DimX();
+    const int dy = from.DimY();
+    const int rx = render_->DimX();
+    const int ry = render_->DimY();
+    const double rest = from.GetRestLength();
+    out.resize(rx * ry);
+
+    #pragma omp parallel for
+    for (int r = 0; r < ry; ++r) {
+        double y = r / (double) (ry - 1) * (dy - 1);
+        int cr = std::min((int) y, dy - 2);
+        double fy = y - cr;
+        for (int c = 0; c < rx; ++c) {
+            double x = c / (double) (rx - 1) * (dx - 1);
+            int cc = std::min((int) x, dx - 2);
+            double fx = x - cc;
+
+            highp_dvec3 rows[4];
+            for (int k = 0; k < 4; ++k) {
+                int rr = clamp(cr - 1 + k, 0, dy - 1);
+                highp_dvec3 p[4];
+                for (int j = 0; j < 4; ++j)
+                    p[j] = from.GetNode(rr, clamp(cc - 1 + j, 0, dx - 1)).pos;
+                rows[k] = CatmullRom(p[0], p[1], p[2], p[3], fx);
+            }
+            highp_dvec3 pos = CatmullRom(rows[0], rows[1], rows[2], rows[3], fy);
+
+            if (wrinkleAmplitude_ > 0) {
+                const highp_dvec3& ul = from.GetNode(cr, cc).pos;
+                const highp_dvec3& ur = from.GetNode(cr, cc + 1).pos;
+                const highp_dvec3& ll = from.GetNode(cr + 1, cc).pos;
+                highp_dvec3 n = cross(ll - ul, ur - ul);
+                double len = length(n);
+                double squeeze = fmax(0.0, 1 - length(ur - ul) / rest) +
+                                 fmax(0.0, 1 - length(ll - ul) / rest);
+                if (len > 0) {
+                    double u = c / (double) (rx - 1);
+                    double v = r / (double) (ry - 1);
+                    double ripple = sin(2 * M_PI * wrinkleFrequency_ * (u + 0.5 * v));
+                    pos += wrinkleAmplitude_ * squeeze * ripple * n / len;
+                }
+            }
+            out[r * rx + c] = pos;
+        }
+    }
+}
+
+void ClothLOD::SelectLevel(int level) {
+    level = clamp(level, 0, (int) levels_.size() - 1);
+    if (level == active_)
+        return;
+    Transfer(*levels_[active_], *levels_[level]);
+    active_ = level;
+    if (fine_.empty())
+        return;
+
+    // fade out whatever difference there is between the two levels' render meshes
+    vector<highp_dvec3> next;
+    Upsample(*levels_[level], next);
+    fadeOffset_.resize(next.size());
+    for (size_t i = 0; i < next.size(); ++i)
+        fadeOffset_[i] = fine_[i] - next[i];
+    fadeLeft_ = fadeFrames_;
+}
+
+// Picks the finest level whose switch distance the camera is past, with hysteresis so
+// it does not flicker around a threshold, then goes coarser while over the node budget.
+void ClothLOD::UpdateLevel(const vec3& cameraPos) {
+    SpringSystem& s = *levels_[active_];
+    highp_dvec3 center = 0.5 * (s.GetNode(0, 0).pos + s.GetNode(s.DimY() - 1, s.DimX() - 1).pos);
+    double dist = length(highp_dvec3(cameraPos) - center);
+
+    int level = active_;
+    while (level + 1 < (int) levels_.size() &&
+           dist > switchDistances_[level + 1] * (1 + hysteresis_))
+        ++level;
+    while (level > 0 && dist < switchDistances_[level] * (1 - hysteresis_))
+        --level;
+    while (nodeBudget_ > 0 && level + 1 < (int) levels_.size() &&
+           levels_[level]->DimX() * levels_[level]->DimY() > nodeBudget_)
+        ++level;
+    SelectLevel(level);
+}
+
+void ClothLOD::Render(const mat4& V, const mat4& P) {
+    Upsample(*levels_[active_], fine_);
+    int n = fine_.size();
+    double t = fadeLeft_ > 0 ? fadeLeft_ / (double) (fadeFrames_ + 1) : 0;
+    for (int i = 0; i < n; ++i) {
+        if (t > 0)
+            fine_[i] += t * fadeOffset_[i];
+        render_->GetNode(i / render_->DimX(), i % render_->DimX()).pos = fine_[i];
+    }
+    if (fadeLeft_ > 0)
+        --fadeLeft_;
+    render_->Render(V, P);
+}
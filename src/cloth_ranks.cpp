@@ -0,0 +1,242 @@
+#include "include/cloth_ranks.h"
+#include <omp.h>
+#include <algorithm>
+#include <cstdio>
+#include <csignal>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the halo sets and the result start on a cache line of their own
+#define SEGMENT_ALIGN 64
+
+static size_t Align(size_t bytes) {
+    return (bytes + SEGMENT_ALIGN - 1) / SEGMENT_ALIGN * SEGMENT_ALIGN;
+}
+
+size_t ClothRank::SegmentSize(int numRanks, int dimX, int dimY) {
+    return Align(sizeof(Header)) + Align(2 * numRanks * 2 * dimX * sizeof(Node)) +
+           (size_t) dimX * dimY * sizeof(highp_dvec3);
+}
+
+highp_dvec3* ClothRank::Result(Header* header) {
+    char* base = reinterpret_cast<char*>(header);
+    return reinterpret_cast<highp_dvec3*>(
+        base + Align(sizeof(Header)) + Align(2 * header->numRanks * 2 * header->dimX * sizeof(Node)));
+}
+
+// Hanging from its top row with the last column pushed sideways, like the benchmarks.
+// firstRow is the row of the whole cloth that ss starts at.
+void ClothRank::StartState(SpringSystem& ss, int firstRow) {
+    const double rest = ss.GetRestLength();
+    for (int r = 0; r < ss.DimY(); ++r) {
+        for (int c = 0; c < ss.DimX(); ++c) {
+            Node& n = ss.GetNode(r, c);
+            n.pos = vec3(c * rest, 5 - (firstRow + r) * rest, 0);
+            n.vel = vec3(0, 0, 0);
+        }
+        ss.GetNode(r, ss.DimX() - 1).vel = highp_dvec3(0, 0, 1);
+    }
+}
+
+ClothRank::ClothRank(const string& segment, int rank) :
+    header_(nullptr),
+    size_(0),
+    rank_(rank),
+    ss_(nullptr)
+{
+    int fd = shm_open(segment.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        cout << "Rank " << rank << " can't open " << segment << endl;
+        return;
+    }
+    struct stat st;
+    void* memory = MAP_FAILED;
+    if (fstat(fd, &st) == 0) {
+        size_ = st.st_size;
+        memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (memory == MAP_FAILED) {
+        cout << "Rank " << rank << " can't map " << segment << endl;
+        return;
+    }
+    header_ = static_cast<Header*>(memory);
+
+    const int dimY = header_->dimY;
+    SpringSystem::RowBand(dimY, rank_, header_->numRanks, firstRow_, endRow_);
+    haloAbove_ = firstRow_ > 0;
+    haloBelow_ = endRow_ < dimY;
+    ss_ = new SpringSystem(header_->dimX, endRow_ - firstRow_ + haloAbove_ + haloBelow_,
+                           header_->ks, header_->kd);
+    ss_->SetLayout(PADDED);
+    StartState(*ss_, firstRow_ - haloAbove_);
+}
+
+ClothRank::~ClothRank() {
+    delete ss_;
+    if (header_)
+        munmap(header_, size_);
+}
+
+Node* ClothRank::Halo(int step, int r) {
+    char* base = reinterpret_cast<char*>(header_) + Align(sizeof(Header));
+    Node* sets = reinterpret_cast<Node*>(base);
+    const int dimX = header_->dimX;
+    return sets + ((step % 2) * header_->numRanks + r) * 2 * dimX;
+}
+
+// Counting barrier in the shared segment. The ranks can outnumber the cores, so
+// the waiting ones give up their time slice instead of spinning.
+void ClothRank::Barrier() {
+    int generation = header_->generation.load(std::memory_order_acquire);
+    if (header_->arrived.fetch_add(1, std::memory_order_acq_rel) == header_->numRanks - 1) {
+        header_->arrived.store(0, std::memory_order_relaxed);
+        header_->generation.fetch_add(1, std::memory_order_release);
+    } else {
+        while (header_->generation.load(std::memory_order_acquire) == generation)
+            std::this_thread::yield();
+    }
+}
+
+void ClothRank::ExchangeHalos(int step) {
+    const int dimX = header_->dimX;
+    const int first = haloAbove_;
+    const int last = haloAbove_ + endRow_ - firstRow_ - 1;
+    Node* mine = Halo(step, rank_);
+    for (int c = 0; c < dimX; ++c) {
+        mine[c] = ss_->GetNode(first, c);
+        mine[dimX + c] = ss_->GetNode(last, c);
+    }
+    Barrier();
+    if (haloAbove_) {
+        const Node* above = Halo(step, rank_ - 1);
+        for (int c = 0; c < dimX; ++c)
+            ss_->GetNode(0, c) = above[dimX + c];
+    }
+    if (haloBelow_) {
+        const Node* below = Halo(step, rank_ + 1);
+        for (int c = 0; c < dimX; ++c)
+            ss_->GetNode(last + 1, c) = below[c];
+    }
+}
+
+void ClothRank::Run() {
+    double start = omp_get_wtime();
+    for (int step = 0; step < header_->steps; ++step) {
+        ss_->Update(header_->dt);
+        ExchangeHalos(step);
+    }
+    header_->seconds[rank_] = omp_get_wtime() - start;
+
+    highp_dvec3* result = Result(header_);
+    const int dimX = header_->dimX;
+    for (int r = firstRow_; r < endRow_; ++r)
+        for (int c = 0; c < dimX; ++c)
+            result[r * dimX + c] = ss_->GetNode(r - firstRow_ + haloAbove_, c).pos;
+}
+
+int RunRank(const string& segment, int rank) {
+    ClothRank cloth(segment, rank);
+    if (!cloth.Opened())
+        return 1;
+    cloth.Run();
+    return 0;
+}
+
+int LaunchRanks(const char* program, int numRanks, int dim, int steps) {
+    // every band needs a row of its own and the halos
+    if (numRanks < 1 || numRanks > MAX_RANKS || numRanks > dim / 2) {
+        cout << "Can't split a " << dim << "x" << dim << " cloth across " << numRanks
+             << " processes" << endl;
+        return 1;
+    }
+    const string segment = "/cloth_ranks_" + std::to_string(getpid());
+    const size_t size = ClothRank::SegmentSize(numRanks, dim, dim);
+    int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        cout << "Can't make the shared memory segment " << segment << endl;
+        if (fd >= 0) {
+            close(fd);
+            shm_unlink(segment.c_str());
+        }
+        return 1;
+    }
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        shm_unlink(segment.c_str());
+        return 1;
+    }
+    ClothRank::Header* header = new (memory) ClothRank::Header;
+    header->numRanks = numRanks;
+    header->dimX = dim;
+    header->dimY = dim;
+    header->steps = steps;
+    header->ks = 500;
+    header->kd = 100;
+    header->dt = 0.0001;
+    header->arrived = 0;
+    header->generation = 0;
+    std::fill(header->seconds, header->seconds + MAX_RANKS, 0.0);
+
+    // the ranks share the cores
+    const int threads = std::max(1, omp_get_num_procs() / numRanks);
+    const string threadsEnv = std::to_string(threads);
+    printf("%dx%d cloth, %d steps, %d processes of %d threads\n", dim, dim, steps, numRanks,
+           threads);
+    bool failed = false;
+    vector<pid_t> ranks;
+    for (int r = 0; r < numRanks; ++r) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            setenv("OMP_NUM_THREADS", threadsEnv.c_str(), 1);
+            execl("/proc/self/exe", program, "rank", segment.c_str(), std::to_string(r).c_str(),
+                  (char*) nullptr);
+            _exit(127);
+        }
+        if (pid < 0)
+            failed = true;
+        else
+            ranks.push_back(pid);
+    }
+    // a rank that didn't start leaves the others waiting at the barrier
+    if (failed)
+        for (pid_t pid : ranks)
+            kill(pid, SIGTERM);
+    for (pid_t pid : ranks) {
+        int status;
+        waitpid(pid, &status, 0);
+        failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    int code = 1;
+    if (failed) {
+        cout << "A rank failed" << endl;
+    } else {
+        double ranksTime = *std::max_element(header->seconds, header->seconds + numRanks);
+        SpringSystem single(dim, dim, header->ks, header->kd);
+        single.SetLayout(PADDED);
+        ClothRank::StartState(single, 0);
+        double start = omp_get_wtime();
+        for (int i = 0; i < steps; ++i)
+            single.Update(header->dt);
+        double singleTime = omp_get_wtime() - start;
+
+        const highp_dvec3* result = ClothRank::Result(header);
+        double diff = 0;
+        for (int r = 0; r < dim; ++r)
+            for (int c = 0; c < dim; ++c)
+                diff = fmax(diff, length(single.GetNode(r, c).pos - result[r * dim + c]));
+        printf("%d processes   %9.1f steps/s\n", numRanks, steps / ranksTime);
+        printf("one process   %9.1f steps/s   max diff %g\n", steps / singleTime, diff);
+        code = diff == 0 ? 0 : 1;
+    }
+    munmap(memory, size);
+    shm_unlink(segment.c_str());
+    return code;
+}
@@ -0,0 +1,50 @@
+#include "include/cpu_features.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+static const char* levelNames[CPU_LEVELS] = { "sse2", "avx2", "avx512" };
+// -1 until the first KernelLevel
+static int kernelLevel = -1;
+
+CpuLevel DetectCpuLevel() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    // these also check that the OS saves the wider registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return CPU_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return CPU_AVX2;
+#endif
+    return CPU_SSE2;
+}
+
+const char* CpuLevelName(CpuLevel level) {
+    return levelNames[level];
+}
+
+CpuLevel KernelLevel() {
+    if (kernelLevel < 0) {
+        CpuLevel detected = DetectCpuLevel();
+        CpuLevel level = detected;
+        const char* env = getenv("CLOTH_ISA");
+        if (env) {
+            int asked = 0;
+            while (asked < CPU_LEVELS && strcmp(env, levelNames[asked]) != 0)
+                ++asked;
+            if (asked == CPU_LEVELS)
+                cout << "CLOTH_ISA should be sse2, avx2 or avx512, not " << env << endl;
+            else if (asked > detected)
+                cout << "This CPU doesn't run " << env << endl;
+            else
+                level = (CpuLevel) asked;
+        }
+        kernelLevel = level;
+        cout << "Kernels: " << levelNames[level] << " (CPU runs " << levelNames[detected] << ")"
+             << endl;
+    }
+    return (CpuLevel) kernelLevel;
+}
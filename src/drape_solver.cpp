@@ -0,0 +1,273 @@
+#include "include/drape_solver.h"
+#include "include/spring_law.h"
+#include <omp.h>
+
+static const int DR[4] = { -1, 1, 0, 0 };
+static const int DC[4] = { 0, 0, -1, 1 };
+
+DrapeSolver::DrapeSolver() {
+    maxIterations_ = 200;
+    maxCGIterations_ = 500;
+    tolerance_ = 1e-6;
+    penalty_ = 100;
+}
+
+static double Dot(const vector<double>& a, const vector<double>& b) {
+    double sum = 0;
+    int n = a.size();
+    #pragma omp parallel for reduction(+:sum)
+    for (int i = 0; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static double MaxAbs(const vector<double>& a) {
+    double m = 0;
+    int n = a.size();
+    #pragma omp parallel for reduction(max:m)
+    for (int i = 0; i < n; ++i)
+        m = fmax(m, fabs(a[i]));
+    return m;
+}
+
+// x holds 3 doubles per node in row major order. Each node gathers the terms of its own
+// springs, so all of the loops below run over rows in parallel without races.
+double DrapeSolver::Energy(const vector<double>& x, vector<double>& grad) {
+    const highp_dvec3* p = (const highp_dvec3*) &x[0];
+    highp_dvec3* g = (highp_dvec3*) &grad[0];
+    const double kc = penalty_ * ks_;
+
+    double energy = 0;
+    #pragma omp parallel for reduction(+:energy)
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            int i = r * dimX_ + c;
+            highp_dvec3 gi = -GRAVITY * mass_;
+            energy -= mass_ * dot(GRAVITY, p[i]);
+            for (int k = 0; k < 4; ++k) {
+                int r2 = r + DR[k];
+                int c2 = c + DC[k];
+                if (r2 < 0 || r2 >= dimY_ || c2 < 0 || c2 >= dimX_)
+                    continue;
+                highp_dvec3 d = p[i] - p[r2 * dimX_ + c2];
+                double l = length(d);
+                // every spring is seen from both ends, so each end adds half its energy
+                energy += 0.25 * ks_ * (l - rest_) * (l - rest_);
+                gi += ks_ * (l - rest_) / l * d;
+            }
+            for (Sphere& sphere : *spheres_) {
+                highp_dvec3 d = p[i] - highp_dvec3(sphere.position);
+                double dist = length(d);
+                double depth = sphere.radius + COLLISION_OFFSET - dist;
+                if (depth > 0) {
+                    energy += 0.5 * kc * depth * depth;
+                    gi -= kc * depth / dist * d;
+                }
+            }
+            if (ss_->stuck && r == 0)
+                gi = highp_dvec3(0, 0, 0);
+            g[i] = gi;
+        }
+    }
+    return energy;
+}
+
+// Hessian times v. Each spring block is k * (e e^T + max(0, 1 - rest / l) (I - e e^T)),
+// which drops the negative part of compressed springs so the matrix stays positive
+// semi-definite and CG always finds a descent direction. The sphere penalty keeps only
+// its normal term for the same reason.
+void DrapeSolver::Hessian(const vector<double>& x, const vector<double>& v,
+                          vector<double>& out) {
+    const highp_dvec3* p = (const highp_dvec3*) &x[0];
+    const highp_dvec3* vp = (const highp_dvec3*) &v[0];
+    highp_dvec3* o = (highp_dvec3*) &out[0];
+    const double kc = penalty_ * ks_;
+
+    #pragma omp parallel for
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            int i = r * dimX_ + c;
+            if (ss_->stuck && r == 0) {
+                o[i] = vp[i];
+                continue;
+            }
+            highp_dvec3 oi(0, 0, 0);
+            for (int k = 0; k < 4; ++k) {
+                int r2 = r + DR[k];
+                int c2 = c + DC[k];
+                if (r2 < 0 || r2 >= dimY_ || c2 < 0 || c2 >= dimX_)
+                    continue;
+                int j = r2 * dimX_ + c2;
+                highp_dvec3 d = p[i] - p[j];
+                double l = length(d);
+                highp_dvec3 e = d / l;
+                double t = fmax(0.0, 1 - rest_ / l);
+                // pinned neighbours do not move, so only our own displacement counts
+                highp_dvec3 dv = (ss_->stuck && r2 == 0) ? vp[i] : vp[i] - vp[j];
+                double en = dot(e, dv);
+                oi += ks_ * (en * e + t * (dv - en * e));
+            }
+            for (Sphere& sphere : *spheres_) {
+                highp_dvec3 d = p[i] - highp_dvec3(sphere.position);
+                double dist = length(d);
+                if (dist < sphere.radius + COLLISION_OFFSET) {
+                    highp_dvec3 n = d / dist;
+                    oi += kc * dot(n, vp[i]) * n;
+                }
+            }
+            o[i] = oi;
+        }
+    }
+}
+
+// scalar Jacobi preconditioner from the diagonal of the Hessian above
+void DrapeSolver::Diagonal(const vector<double>& x, vector<double>& diag) {
+    const highp_dvec3* p = (const highp_dvec3*) &x[0];
+    highp_dvec3* dg = (highp_dvec3*) &diag[0];
+    const double kc = penalty_ * ks_;
+
+    #pragma omp parallel for
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            int i = r * dimX_ + c;
+            highp_dvec3 di(0, 0, 0);
+            for (int k = 0; k < 4; ++k) {
+                int r2 = r + DR[k];
+                int c2 = c + DC[k];
+                if (r2 < 0 || r2 >= dimY_ || c2 < 0 || c2 >= dimX_)
+                    continue;
+                highp_dvec3 d = p[i] - p[r2 * dimX_ + c2];
+                double l = length(d);
+                highp_dvec3 e = d / l;
+                double t = fmax(0.0, 1 - rest_ / l);
+                di += ks_ * (e * e + t * (highp_dvec3(1, 1, 1) - e * e));
+            }
+            for (Sphere& sphere : *spheres_) {
+                highp_dvec3 d = p[i] - highp_dvec3(sphere.position);
+                double dist = length(d);
+                if (dist < sphere.radius + COLLISION_OFFSET)
+                    di += kc * (d / dist) * (d / dist);
+            }
+            if (ss_->stuck && r == 0)
+                di = highp_dvec3(1, 1, 1);
+            // keep flat, slack regions from dividing by zero
+            dg[i] = max(di, highp_dvec3(1e-3 * ks_));
+        }
+    }
+}
+
+// Approximately solves H dir = -g with Jacobi preconditioned CG, stopping early once
+// the residual is small relative to the gradient (inexact Newton).
+int DrapeSolver::SolveNewton(const vector<double>& x, const vector<double>& g,
+                             vector<double>& dir) {
+    const int n = x.size();
+    vector<double> res(n), z(n), d(n), hd(n), diag(n);
+    Diagonal(x, diag);
+
+    double gNorm = sqrt(Dot(g, g));
+    double target = fmin(0.5, sqrt(gNorm)) * gNorm;
+    for (int i = 0; i < n; ++i) {
+        dir[i] = 0;
+        res[i] = -g[i];
+        z[i] = res[i] / diag[i];
+    }
+    d = z;
+    double rz = Dot(res, z);
+    int it = 0;
+    for (; it < maxCGIterations_; ++it) {
+        if (sqrt(Dot(res, res)) <= target)
+            break;
+        Hessian(x, d, hd);
+        double dhd = Dot(d, hd);
+        if (dhd <= 0)
+            break;
+        double a = rz / dhd;
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i) {
+            dir[i] += a * d[i];
+            res[i] -= a * hd[i];
+            z[i] = res[i] / diag[i];
+        }
+        double rzNew = Dot(res, z);
+        double b = rzNew / rz;
+        rz = rzNew;
+        #pragma omp parallel for
+        for (int i = 0; i < n; ++i)
+            d[i] = z[i] + b * d[i];
+    }
+    // CG could not make progress at all, fall back to preconditioned gradient descent
+    if (it == 0) {
+        for (int i = 0; i < n; ++i)
+            dir[i] = -g[i] / diag[i];
+    }
+    return it;
+}
+
+DrapeResult DrapeSolver::Solve(SpringSystem& ss, vector<Sphere>& spheres) {
+    ss_ = &ss;
+    spheres_ = &spheres;
+    dimX_ = ss.DimX();
+    dimY_ = ss.DimY();
+    ks_ = ss.GetKS();
+    rest_ = ss.GetRestLength();
+    mass_ = ss.GetMass();
+    const int n = 3 * dimX_ * dimY_;
+
+    vector<double> x(n), g(n), xNew(n), gNew(n), dir(n);
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            highp_dvec3 pos = ss.GetNode(r, c).pos;
+            x[3 * (r * dimX_ + c) + 0] = pos.x;
+            x[3 * (r * dimX_ + c) + 1] = pos.y;
+            x[3 * (r * dimX_ + c) + 2] = pos.z;
+        }
+    }
+
+    DrapeResult result;
+    result.converged = false;
+    result.cgIterations = 0;
+    double energy = Energy(x, g);
+    int it = 0;
+    for (; it < maxIterations_; ++it) {
+        if (MaxAbs(g) < tolerance_) {
+            result.converged = true;
+            break;
+        }
+        result.cgIterations += SolveNewton(x, g, dir);
+        double slope = Dot(g, dir);
+
+        // backtracking line search with the Armijo condition
+        double step = 1;
+        double newEnergy = energy;
+        bool accepted = false;
+        for (int ls = 0; ls < 40; ++ls) {
+            for (int i = 0; i < n; ++i)
+                xNew[i] = x[i] + step * dir[i];
+            newEnergy = Energy(xNew, gNew);
+            if (newEnergy <= energy + 1e-4 * step * slope) {
+                accepted = true;
+                break;
+            }
+            step *= 0.5;
+        }
+        if (!accepted)
+            break;
+        x.swap(xNew);
+        g.swap(gNew);
+        energy = newEnergy;
+    }
+
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            Node& node = ss.GetNode(r, c);
+            int i = 3 * (r * dimX_ + c);
+            node.pos = highp_dvec3(x[i], x[i + 1], x[i + 2]);
+            node.vel = highp_dvec3(0, 0, 0);
+        }
+    }
+
+    result.iterations = it;
+    result.energy = energy;
+    result.gradNorm = MaxAbs(g);
+    return result;
+}
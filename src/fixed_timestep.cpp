@@ -0,0 +1,27 @@
+#include "include/fixed_timestep.h"
+#include <cmath>
+
+FixedTimestep::FixedTimestep(double step, int maxSteps) :
+    step_(step),
+    maxSteps_(maxSteps),
+    accumulator_(0),
+    dropped_(0)
+{
+}
+
+int FixedTimestep::Advance(double dt) {
+    if (dt > 0)
+        accumulator_ += dt;
+    int steps = 0;
+    while (accumulator_ >= step_ && steps < maxSteps_) {
+        accumulator_ -= step_;
+        ++steps;
+    }
+    if (accumulator_ >= step_) {
+        // keep the fraction so the next frame still lines up with the clock
+        double rest = std::fmod(accumulator_, step_);
+        dropped_ += accumulator_ - rest;
+        accumulator_ = rest;
+    }
+    return steps;
+}
@@ -0,0 +1,341 @@
+// Steps a cloth without a window, for machines without a display or OpenGL. Links only
+// the simulation library (libcloth), see the Makefile.
+//
+//   headless [--size cols rows] [--ks KS] [--kd KD] [--steps n] [--dt seconds]
+//            [--layout row|morton|blocked|padded] [--tiled] [--threads n] [--tune]
+//            [--wind w] [--no-drag] [--free] [--sphere x y z radius]
+//            [--out file.obj|file.csv] [--every n]
+//
+// --out writes the positions after the last step, as a mesh if the file ends in .obj and
+// as "row,col,x,y,z" lines otherwise. With --every the positions of every n-th step go to
+// files with the step number before the extension as well.
+//
+//   headless sweep [--size CxR,...] [--ks KS,...] [--kd KD,...] [--dt seconds,...]
+//                  [--steps n] [--jobs n] [--sample n] [--settle speed]
+//                  [--layout row|morton|blocked|padded] [--wind w] [--no-drag] [--free]
+//                  [--out file.csv]
+//
+// sweep steps a cloth for every combination of the listed sizes, stiffnesses, dampings
+// and time steps, --jobs (every core by default) at a time on one thread each, and
+// writes whether each stayed stable, its largest strain, when it settled and its steps
+// per second to the CSV file (sweep.csv by default), see sweep.h.
+
+#include "include/spring_system.h"
+#include "include/auto_tune.h"
+#include "include/sweep.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstring>
+
+static void Usage() {
+    printf("headless [--size cols rows] [--ks KS] [--kd KD] [--steps n] [--dt seconds]\n"
+           "         [--layout row|morton|blocked|padded] [--tiled] [--threads n] [--tune]\n"
+           "         [--wind w] [--no-drag] [--free] [--sphere x y z radius]\n"
+           "         [--out file.obj|file.csv] [--every n]\n"
+           "headless sweep [--size CxR,...] [--ks KS,...] [--kd KD,...] [--dt seconds,...]\n"
+           "               [--steps n] [--jobs n] [--sample n] [--settle speed]\n"
+           "               [--layout row|morton|blocked|padded] [--wind w] [--no-drag] [--free]\n"
+           "               [--out file.csv]\n");
+}
+
+// "row", "morton", "blocked" or "padded", -1 for anything else
+static int ParseLayout(const char* name) {
+    const char* names[4] = { "row", "morton", "blocked", "padded" };
+    for (int layout = 0; layout < 4; ++layout)
+        if (strcmp(name, names[layout]) == 0)
+            return layout;
+    cout << "--layout is row, morton, blocked or padded" << endl;
+    return -1;
+}
+
+// "100,500,1000"
+static vector<double> ParseList(const string& list) {
+    vector<double> values;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == string::npos)
+            comma = list.size();
+        if (comma > start)
+            values.push_back(atof(list.substr(start, comma - start).c_str()));
+        start = comma + 1;
+    }
+    return values;
+}
+
+// "64x64,128x96", columns first
+static vector<std::pair<int, int> > ParseSizes(const string& list) {
+    vector<std::pair<int, int> > sizes;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        if (comma == string::npos)
+            comma = list.size();
+        string size = list.substr(start, comma - start);
+        size_t x = size.find('x');
+        if (!size.empty())
+            sizes.push_back(std::make_pair(atoi(size.c_str()),
+                                           x == string::npos ? 0 : atoi(size.c_str() + x + 1)));
+        start = comma + 1;
+    }
+    return sizes;
+}
+
+static int SweepMain(int argc, char* argv[]) {
+    vector<std::pair<int, int> > sizes(1, std::make_pair(64, 64));
+    vector<double> ks(1, 500);
+    vector<double> kd(1, 100);
+    vector<double> dt(1, 0.0001);
+    int steps = 1000;
+    SweepOptions options;
+    options.jobs = 0;
+    options.sample = 10;
+    options.settleSpeed = 0.01;
+    options.layout = ROW_MAJOR;
+    options.drag = true;
+    options.pinned = true;
+    options.wind = 0;
+    string out = "sweep.csv";
+
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--no-drag") {
+            options.drag = false;
+            continue;
+        }
+        if (arg == "--free") {
+            options.pinned = false;
+            continue;
+        }
+        if (arg != "--size" && arg != "--ks" && arg != "--kd" && arg != "--dt" &&
+            arg != "--steps" && arg != "--jobs" && arg != "--sample" && arg != "--settle" &&
+            arg != "--layout" && arg != "--wind" && arg != "--out") {
+            Usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        if (i + 1 >= argc) {
+            cout << arg << " needs 1 value" << endl;
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (arg == "--size") {
+            sizes = ParseSizes(value);
+        } else if (arg == "--ks") {
+            ks = ParseList(value);
+        } else if (arg == "--kd") {
+            kd = ParseList(value);
+        } else if (arg == "--dt") {
+            dt = ParseList(value);
+        } else if (arg == "--steps") {
+            steps = atoi(value);
+        } else if (arg == "--jobs") {
+            options.jobs = atoi(value);
+        } else if (arg == "--sample") {
+            options.sample = atoi(value);
+        } else if (arg == "--settle") {
+            options.settleSpeed = atof(value);
+        } else if (arg == "--layout") {
+            int layout = ParseLayout(value);
+            if (layout < 0)
+                return 1;
+            options.layout = (NodeLayout) layout;
+        } else if (arg == "--wind") {
+            options.wind = atof(value);
+        } else if (arg == "--out") {
+            out = value;
+        }
+    }
+    for (const std::pair<int, int>& size : sizes) {
+        if (size.first < 2 || size.second < 2) {
+            cout << "--size takes sizes like 64x64, of at least 2x2 nodes" << endl;
+            return 1;
+        }
+    }
+    for (double t : dt) {
+        if (t <= 0) {
+            cout << "The time steps have to be > 0" << endl;
+            return 1;
+        }
+    }
+    if (ks.empty() || kd.empty() || dt.empty() || sizes.empty() || steps < 1 ||
+        options.sample < 1) {
+        cout << "The sweep needs a value of each parameter, steps >= 1 and sample >= 1" << endl;
+        return 1;
+    }
+
+    vector<SweepRun> runs = SweepGrid(sizes, ks, kd, dt, steps);
+    printf("%d runs of %d steps\n", (int) runs.size(), steps);
+    double start = omp_get_wtime();
+    RunSweep(runs, options);
+    printf("%.1f s\n", omp_get_wtime() - start);
+    return WriteSweepCsv(runs, out) ? 0 : 1;
+}
+
+// "out.obj" and step 120 give "out_000120.obj"
+static string FrameFile(const string& file, int step) {
+    char number[16];
+    snprintf(number, sizeof(number), "_%06d", step);
+    size_t dot = file.rfind('.');
+    if (dot == string::npos || file.find('/', dot) != string::npos)
+        return file + number;
+    return file.substr(0, dot) + number + file.substr(dot);
+}
+
+static bool WritePositions(SpringSystem& ss, const string& file) {
+    FILE* out = fopen(file.c_str(), "w");
+    if (!out) {
+        cout << "Can't write " << file << endl;
+        return false;
+    }
+    const int dimX = ss.DimX();
+    const int dimY = ss.DimY();
+    const bool obj = file.size() > 4 && file.compare(file.size() - 4, 4, ".obj") == 0;
+    if (obj) {
+        for (int r = 0; r < dimY; ++r) {
+            for (int c = 0; c < dimX; ++c) {
+                const highp_dvec3& p = ss.GetNode(r, c).pos;
+                fprintf(out, "v %.9g %.9g %.9g\n", p.x, p.y, p.z);
+            }
+        }
+        // the two triangles of every quad, the vertices count from 1
+        for (int r = 0; r < dimY - 1; ++r) {
+            for (int c = 0; c < dimX - 1; ++c) {
+                int ul = r * dimX + c + 1;
+                int ll = ul + dimX;
+                fprintf(out, "f %d %d %d\nf %d %d %d\n", ul, ll, ul + 1, ul + 1, ll, ll + 1);
+            }
+        }
+    } else {
+        fprintf(out, "row,col,x,y,z\n");
+        for (int r = 0; r < dimY; ++r) {
+            for (int c = 0; c < dimX; ++c) {
+                const highp_dvec3& p = ss.GetNode(r, c).pos;
+                fprintf(out, "%d,%d,%.17g,%.17g,%.17g\n", r, c, p.x, p.y, p.z);
+            }
+        }
+    }
+    fclose(out);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "sweep") == 0)
+        return SweepMain(argc, argv);
+
+    int dimX = 64;
+    int dimY = 64;
+    double ks = 500;
+    double kd = 100;
+    int steps = 1000;
+    double dt = 0.0001;
+    int layout = -1;
+    bool tiled = false;
+    int threads = 0;
+    bool tune = false;
+    double wind = 0;
+    bool drag = true;
+    bool pinned = true;
+    vector<Sphere> spheres;
+    string out;
+    int every = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        // how many values the option takes
+        int values = 0;
+        if (arg == "--size")
+            values = 2;
+        else if (arg == "--sphere")
+            values = 4;
+        else if (arg == "--ks" || arg == "--kd" || arg == "--steps" || arg == "--dt" ||
+                 arg == "--layout" || arg == "--threads" || arg == "--wind" || arg == "--out" ||
+                 arg == "--every")
+            values = 1;
+        else if (arg != "--tiled" && arg != "--tune" && arg != "--no-drag" && arg != "--free") {
+            Usage();
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        if (i + values >= argc) {
+            cout << arg << " needs " << values << (values == 1 ? " value" : " values") << endl;
+            return 1;
+        }
+        const char* value = argv[i + 1];
+        if (arg == "--size") {
+            dimX = atoi(argv[i + 1]);
+            dimY = atoi(argv[i + 2]);
+        } else if (arg == "--ks") {
+            ks = atof(value);
+        } else if (arg == "--kd") {
+            kd = atof(value);
+        } else if (arg == "--steps") {
+            steps = atoi(value);
+        } else if (arg == "--dt") {
+            dt = atof(value);
+        } else if (arg == "--layout") {
+            layout = ParseLayout(value);
+            if (layout < 0)
+                return 1;
+        } else if (arg == "--tiled") {
+            tiled = true;
+        } else if (arg == "--threads") {
+            threads = atoi(value);
+        } else if (arg == "--tune") {
+            tune = true;
+        } else if (arg == "--wind") {
+            wind = atof(value);
+        } else if (arg == "--no-drag") {
+            drag = false;
+        } else if (arg == "--free") {
+            pinned = false;
+        } else if (arg == "--sphere") {
+            spheres.push_back(Sphere(glm::vec3(atof(argv[i + 1]), atof(argv[i + 2]),
+                                               atof(argv[i + 3])), atof(argv[i + 4])));
+        } else if (arg == "--out") {
+            out = value;
+        } else if (arg == "--every") {
+            every = atoi(value);
+        }
+        i += values;
+    }
+    if (dimX < 2 || dimY < 2 || steps < 0 || dt <= 0) {
+        cout << "The cloth needs at least 2x2 nodes, steps >= 0 and dt > 0" << endl;
+        return 1;
+    }
+    if (every > 0 && out.empty()) {
+        cout << "--every needs --out" << endl;
+        return 1;
+    }
+
+    SpringSystem ss(dimX, dimY, ks, kd);
+    ss.AutoTune(tune);
+    ss.SimSetup();
+    if (layout >= 0)
+        ss.SetLayout((NodeLayout) layout);
+    if (tiled)
+        ss.Tiled(true);
+    if (threads > 0)
+        ss.Threads(threads);
+    ss.Drag(drag);
+    ss.wind = wind;
+    ss.stuck = pinned;
+
+    printf("%dx%d cloth, ks %g, kd %g, %d steps of %g s, %d threads\n", dimX, dimY, ks, kd,
+           steps, dt, ss.Threads() > 0 ? ss.Threads() : omp_get_max_threads());
+    double stepping = 0;
+    for (int step = 1; step <= steps; ++step) {
+        double start = omp_get_wtime();
+        if (spheres.empty())
+            ss.Update(dt);
+        else
+            ss.Update(dt, spheres);
+        stepping += omp_get_wtime() - start;
+        if (every > 0 && step % every == 0 && !WritePositions(ss, FrameFile(out, step)))
+            return 1;
+    }
+    printf("%.3f s   %.1f steps/s   %.3g node steps/s\n", stepping,
+           stepping > 0 ? steps / stepping : 0.0,
+           stepping > 0 ? (double) dimX * dimY * steps / stepping : 0.0);
+    if (!out.empty() && !WritePositions(ss, out))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef SRC_INCLUDE_ADAPTIVE_CLOTH_H_
+#define SRC_INCLUDE_ADAPTIVE_CLOTH_H_
+
+#include "include/utils.h"
+#include "include/glsl_shader.h"
+#include "include/spring_system.h"
+#include <unordered_map>
+
+// Cloth whose resolution follows the folds. The sheet is split into tiles of
+// tileCells x tileCells base cells and every tile is a quad-tree refined to a uniform
+// depth 0..maxLevel, so a tile at level L has 2^L times the base resolution. Tiles are
+// refined where the cloth is strained or curved, coarsened where it is flat, and kept
+// within one level of their neighbours.
+//
+// Nodes are addressed by integer coordinates on the finest possible lattice and the
+// springs form a general graph, stored as a CSR neighbour list. The force kernel
+// gathers over that list one node at a time, so it runs in parallel without races no
+// matter where the resolution changes. Nodes on the fine side of a coarse/fine tile
+// edge (hanging nodes) are kept on the coarse edge: their forces and mass go to the
+// two edge end points and their state is interpolated back after each step.
+class AdaptiveCloth {
+    public:
+        AdaptiveCloth(int tilesX, int tilesY, int tileCells, int maxLevel, double ks, double kd);
+        ~AdaptiveCloth();
+        void Setup();
+        void ClothSetup();
+        void GLSetup();
+        void Update(double dt);
+        void HandleCollisions(vector<Sphere>& spheres);
+        void Adapt();
+        void Render(const mat4& V, const mat4& P);
+
+        int NumNodes() { return nodes_.size(); }
+        int TileLevel(int tx, int ty) { return tileLevel_[ty * tilesX_ + tx]; }
+        // the node count after each of the last rebuilds, oldest first
+        const vector<int>& NodeCountHistory() { return nodeCounts_; }
+        void SetThresholds(double refine, double coarsen) {
+            refineThreshold_ = refine;
+            coarsenThreshold_ = coarsen;
+        }
+
+        bool stuck;
+
+    private:
+        long long Key(int i, int j) const { return (long long) j * (fineW_ + 1) + i; }
+        // the node at lattice point (i, j), which has to be one. Only reads lookup_, so
+        // it is safe from several threads.
+        int NodeId(int i, int j) const { return lookup_.at(Key(i, j)); }
+        int Step(int level) { return 1 << (maxLevel_ - level); }
+        int TileAt(int i, int j);
+        highp_dvec3 OldPos(int i, int j, int tile, bool vel);
+        void Rebuild(const vector<int>& newLevels);
+        void Balance();
+        double TileMetric(int tile);
+        void UploadTopology();
+
+        int tilesX_;
+        int tilesY_;
+        int tileCells_;
+        int maxLevel_;
+        // size of the whole cloth in finest lattice units
+        int fineW_;
+        int fineH_;
+        double fineSpacing_;
+        double density_;
+        double KS_;
+        double KD_;
+
+        vector<int> tileLevel_;
+        double refineThreshold_;
+        double coarsenThreshold_;
+
+        vector<Node> nodes_;
+        vector<highp_dvec3> forces_;
+        vector<double> mass_;
+        vector<int> fineI_;
+        vector<int> fineJ_;
+        vector<unsigned char> pinned_;
+        std::unordered_map<long long, int> lookup_;
+
+        // CSR springs: neighbours of node n are adj_[adjStart_[n] .. adjStart_[n + 1])
+        vector<int> adjStart_;
+        vector<int> adj_;
+        vector<double> adjRest_;
+
+        vector<int> hanging_;
+        vector<int> hangA_;
+        vector<int> hangB_;
+
+        vector<int> nodeCounts_;
+
+        vector<unsigned int> indices_;
+        vector<vec3> posArray_;
+        vector<vec3> normals_;
+        vector<vec2> texCoords_;
+        bool glReady_;
+        bool topologyDirty_;
+
+        GLSLShader shader_;
+        GLint texture_;
+        GLuint vao_;
+        GLuint vbos_[CLOTH_TOTAL_VBOS];
+};
+
+#endif  // SRC_INCLUDE_ADAPTIVE_CLOTH_H_
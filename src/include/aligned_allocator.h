@@ -0,0 +1,45 @@
+#ifndef SRC_INCLUDE_ALIGNED_ALLOCATOR_H_
+#define SRC_INCLUDE_ALIGNED_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// a cache line, and the width of an AVX-512 register
+#define SIMD_ALIGN 64
+
+// Allocator for std::vector whose storage starts on an ALIGN byte boundary, so loops
+// over it can use aligned vector loads. std::allocator only promises 16 bytes.
+template <typename T, size_t ALIGN>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, ALIGN> other;
+    };
+
+    AlignedAllocator() {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, ALIGN>&) {}
+
+    T* allocate(size_t n) {
+        void* p = nullptr;
+        if (posix_memalign(&p, ALIGN, n * sizeof(T)) != 0)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { free(p); }
+};
+
+template <typename T, typename U, size_t ALIGN>
+bool operator==(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) {
+    return true;
+}
+
+template <typename T, typename U, size_t ALIGN>
+bool operator!=(const AlignedAllocator<T, ALIGN>&, const AlignedAllocator<U, ALIGN>&) {
+    return false;
+}
+
+#endif  // SRC_INCLUDE_ALIGNED_ALLOCATOR_H_
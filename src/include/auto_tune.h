@@ -0,0 +1,33 @@
+#ifndef SRC_INCLUDE_AUTO_TUNE_H_
+#define SRC_INCLUDE_AUTO_TUNE_H_
+
+#include "include/spring_system.h"
+
+// How a SpringSystem steps: the node layout and whether it goes a tile at a time, the
+// OpenMP threads and the instruction set of the kernels.
+struct StepConfig {
+    NodeLayout layout;
+    bool tiled;
+    int tileRows;
+    int tileCols;
+    int threads;
+    CpuLevel level;
+};
+
+// Finds the fastest StepConfig for the grid of ss and sets ss up with it. The candidates
+// are timed on ss itself, a few steps each, one setting at a time: the step (row major,
+// PADDED or tiled with a few tile sizes) on every thread first, then the thread count
+// for it, then the kernel level (not if CLOTH_ISA picks it). With a TaskPool the PADDED
+// step is timed as the task graph on it. The nodes are put back as they were afterwards.
+//
+// The choice is cached in a file, one line per CPU model, thread count and grid size, so
+// the next run with the same grid only reads it. The file is $CLOTH_TUNE_CACHE, or
+// cloth_tune in $XDG_CACHE_HOME or ~/.cache. CLOTH_TUNE=again times the candidates even
+// if there is a cached choice.
+void TuneStep(SpringSystem& ss);
+// sets ss up to step as config says
+void ApplyStepConfig(SpringSystem& ss, const StepConfig& config);
+// like "tiled 32x64, 4 threads, avx2"
+string StepConfigName(const StepConfig& config);
+
+#endif  // SRC_INCLUDE_AUTO_TUNE_H_
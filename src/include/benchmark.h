@@ -0,0 +1,23 @@
+#ifndef SRC_INCLUDE_BENCHMARK_H_
+#define SRC_INCLUDE_BENCHMARK_H_
+
+// Timings that run without a window, started with "proj bench <name> [args]".
+
+// FixedSpringSystem against SpringSystem of the same size for the fixed sizes we ship
+void BenchmarkFixedGrids(int steps);
+// tiled against the phase by phase step on a dim x dim cloth, for a few tile sizes
+void BenchmarkTiled(int dim, int steps);
+// row major against the other node layouts on a dim x dim cloth, with cache and TLB
+// misses from the hardware counters where the kernel lets us read them
+void BenchmarkLayouts(int dim, int steps);
+// how far MixedSpringSystem drifts from the double simulation over a long fall
+void BenchmarkDrift(int dim, int steps);
+// the PADDED step as a task graph on a TaskPool against the same step with OpenMP
+void BenchmarkTasks(int dim, int steps);
+// steps per second and memory bandwidth per NUMA node for 1, 2, 4 ... threads, with the
+// nodes all on the first thread's memory and with NumaBands
+void BenchmarkNuma(int dim, int steps);
+// the PADDED step with the kernels of every CpuLevel this CPU runs, against CPU_SSE2
+void BenchmarkIsa(int dim, int steps);
+
+#endif  // SRC_INCLUDE_BENCHMARK_H_
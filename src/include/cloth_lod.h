@@ -0,0 +1,65 @@
+#ifndef SRC_INCLUDE_CLOTH_LOD_H_
+#define SRC_INCLUDE_CLOTH_LOD_H_
+
+#include "include/spring_system.h"
+
+// Multi-resolution cloth. Several SpringSystems cover the same piece of cloth at
+// different resolutions (finest first) and only one of them is simulated at a time.
+// Whichever one is active is upsampled with Catmull-Rom interpolation onto a fixed fine
+// render mesh, optionally with procedural wrinkles where the cloth is compressed.
+// Switching levels resamples the state onto the new grid and cross-fades the render
+// mesh over a few frames so there is no visible pop.
+//
+// levelDims are the columns of each level, the rows follow from the aspect ratio of the
+// render grid.
+class ClothLOD {
+    public:
+        ClothLOD(int renderDimX, int renderDimY, const vector<int>& levelDims, double ks,
+                 double kd);
+        ~ClothLOD();
+        ClothLOD(const ClothLOD&) = delete;
+        ClothLOD& operator=(const ClothLOD&) = delete;
+        void Setup();
+        void SpringSetup(bool vertical);
+        void Update(double dt);
+        void HandleCollisions(vector<Sphere>& spheres);
+        void Render(const mat4& V, const mat4& P);
+
+        void SelectLevel(int level);
+        void UpdateLevel(const vec3& cameraPos);
+
+        void ChangeVizualization() { render_->ChangeVizualization(); }
+        SpringSystem& Active() { return *levels_[active_]; }
+        int ActiveLevel() { return active_; }
+        int NumLevels() { return levels_.size(); }
+        void SetSwitchDistances(const vector<double>& d) { switchDistances_ = d; }
+        void SetNodeBudget(int nodes) { nodeBudget_ = nodes; }
+        void SetWrinkles(double amplitude, double frequency) {
+            wrinkleAmplitude_ = amplitude;
+            wrinkleFrequency_ = frequency;
+        }
+
+    private:
+        void Transfer(SpringSystem& from, SpringSystem& to);
+        void Upsample(SpringSystem& from, vector<highp_dvec3>& out);
+
+        vector<SpringSystem*> levels_;
+        SpringSystem* render_;
+        int active_;
+
+        // level i is used from switchDistances_[i] away, with some hysteresis
+        vector<double> switchDistances_;
+        double hysteresis_;
+        int nodeBudget_;
+
+        double wrinkleAmplitude_;
+        double wrinkleFrequency_;
+
+        // render mesh positions of the last frame and the cross-fade after a switch
+        vector<highp_dvec3> fine_;
+        vector<highp_dvec3> fadeOffset_;
+        int fadeFrames_;
+        int fadeLeft_;
+};
+
+#endif  // SRC_INCLUDE_CLOTH_LOD_H_
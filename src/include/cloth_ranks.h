@@ -0,0 +1,84 @@
+#ifndef SRC_INCLUDE_CLOTH_RANKS_H_
+#define SRC_INCLUDE_CLOTH_RANKS_H_
+
+#include "include/spring_system.h"
+#include <atomic>
+
+// most processes a cloth can be split across
+#define MAX_RANKS 64
+
+// One cloth stepped by several processes on the same machine. The rows are split into
+// bands (SpringSystem::RowBand), one per process (rank), and every rank steps a
+// SpringSystem of its own rows plus a halo row from each neighbouring band, which is
+// all the forces on its own rows depend on. After every step each rank copies its first
+// and last rows into a POSIX shared memory segment and, once all ranks are through a
+// barrier, takes its halo rows from its neighbours' copies. The copies alternate
+// between two sets so the next step can start without a second barrier.
+//
+// The ranks use the PADDED layout, whose forces add up in the same order whatever the
+// grid's height, so they end up with exactly the nodes of a single SpringSystem. The
+// halo rows themselves are stepped with wrong forces and overwritten. Strain limiting
+// works on whole chains of springs and dynamic spheres on the whole cloth, neither is
+// supported here.
+class ClothRank {
+    public:
+        // what the segment starts with, filled in by the launcher
+        struct Header {
+            int numRanks;
+            int dimX;
+            int dimY;
+            int steps;
+            double ks;
+            double kd;
+            double dt;
+            // barrier: ranks through it so far and how many times it opened
+            std::atomic<int> arrived;
+            std::atomic<int> generation;
+            // seconds each rank took for its steps
+            double seconds[MAX_RANKS];
+        };
+
+        // maps the segment the launcher made
+        ClothRank(const string& segment, int rank);
+        ~ClothRank();
+        ClothRank(const ClothRank&) = delete;
+        ClothRank& operator=(const ClothRank&) = delete;
+
+        bool Opened() { return header_ != nullptr; }
+        // the steps from the header, then the rank's rows go to the result
+        void Run();
+
+        // bytes of the segment for a cloth and number of ranks
+        static size_t SegmentSize(int numRanks, int dimX, int dimY);
+        // start of the final positions of the whole cloth in the segment, row major
+        static highp_dvec3* Result(Header* header);
+        // the state every rank and the single process reference start from
+        static void StartState(SpringSystem& ss, int firstRow);
+
+    private:
+        void Barrier();
+        // first and last row of this rank out to the set of a step, then the halo rows in
+        void ExchangeHalos(int step);
+        // the two boundary rows of rank r in the set of a step
+        Node* Halo(int step, int r);
+
+        Header* header_;
+        size_t size_;
+        int rank_;
+        // rows [firstRow_, endRow_) of the cloth are this rank's
+        int firstRow_;
+        int endRow_;
+        // 1 if there is a halo row above (local row 0) or below
+        int haloAbove_;
+        int haloBelow_;
+        SpringSystem* ss_;
+};
+
+// Forks numRanks processes that step a dim x dim cloth for steps steps as above, then
+// steps the same cloth in this process and prints the steps per second of both and how
+// far apart they ended up. Returns the exit code for main.
+int LaunchRanks(const char* program, int numRanks, int dim, int steps);
+// the body of a rank process, started by LaunchRanks as "<program> rank <segment> <rank>"
+int RunRank(const string& segment, int rank);
+
+#endif  // SRC_INCLUDE_CLOTH_RANKS_H_
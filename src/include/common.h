@@ -0,0 +1,27 @@
+#ifndef SRC_INCLUDE_COMMON_H_
+#define SRC_INCLUDE_COMMON_H_
+
+// What the simulation needs from utils.h, without OpenGL or SDL
+
+#include "glm/glm.hpp"
+#include "glm/ext.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace glm;
+using namespace std;
+
+inline ostream& operator <<(ostream& out, const vec3& v) {
+    out << v.x << " " << v.y << " " << v.z;
+    return out;
+}
+
+inline ostream& operator <<(ostream& out, const vec4& v) {
+    out << v.x << " " << v.y << " " << v.z << " " << v.w;
+    return out;
+}
+
+#endif  // SRC_INCLUDE_COMMON_H_
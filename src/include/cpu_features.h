@@ -0,0 +1,23 @@
+#ifndef SRC_INCLUDE_CPU_FEATURES_H_
+#define SRC_INCLUDE_CPU_FEATURES_H_
+
+// Instruction set levels the hot kernels are compiled for. The binary is built for the
+// baseline (SSE2 on x86-64) and the kernels in level_kernels.h are compiled once more
+// for each level above it, in kernels_<level>.cpp. Which ones run is decided once, from
+// what the CPU and the OS support.
+enum CpuLevel {
+    CPU_SSE2,
+    CPU_AVX2,
+    CPU_AVX512,
+    CPU_LEVELS
+};
+
+// the best level this machine runs
+CpuLevel DetectCpuLevel();
+// The level the kernels of a new SpringSystem run at: the detected one, or the one
+// CLOTH_ISA names ("sse2", "avx2" or "avx512") if the machine runs it. Printed on the
+// first call.
+CpuLevel KernelLevel();
+const char* CpuLevelName(CpuLevel level);
+
+#endif  // SRC_INCLUDE_CPU_FEATURES_H_
@@ -0,0 +1,48 @@
+#ifndef SRC_INCLUDE_DRAPE_SOLVER_H_
+#define SRC_INCLUDE_DRAPE_SOLVER_H_
+
+#include "include/spring_system.h"
+
+typedef struct DrapeResult {
+    int iterations;
+    int cgIterations;
+    double energy;
+    double gradNorm;
+    bool converged;
+} DrapeResult;
+
+// Finds the cloth's resting shape directly instead of stepping it until it stops moving.
+// Minimizes the spring plus gravity energy with Newton's method and a backtracking line
+// search; each Newton system is solved matrix free with preconditioned CG. Spheres are
+// kept out with a stiff penalty and the pinned row stays fixed.
+class DrapeSolver {
+    public:
+        DrapeSolver();
+        DrapeResult Solve(SpringSystem& ss, vector<Sphere>& spheres);
+
+        void SetMaxIterations(int iters) { maxIterations_ = iters; }
+        void SetTolerance(double tol) { tolerance_ = tol; }
+        void SetPenalty(double p) { penalty_ = p; }
+
+    private:
+        double Energy(const vector<double>& x, vector<double>& grad);
+        void Hessian(const vector<double>& x, const vector<double>& v, vector<double>& out);
+        void Diagonal(const vector<double>& x, vector<double>& diag);
+        int SolveNewton(const vector<double>& x, const vector<double>& g, vector<double>& dir);
+
+        // the problem being solved, set up by Solve
+        SpringSystem* ss_;
+        vector<Sphere>* spheres_;
+        int dimX_;
+        int dimY_;
+        double ks_;
+        double rest_;
+        double mass_;
+
+        int maxIterations_;
+        int maxCGIterations_;
+        double tolerance_;
+        double penalty_;
+};
+
+#endif  // SRC_INCLUDE_DRAPE_SOLVER_H_
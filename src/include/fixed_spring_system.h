@@ -0,0 +1,256 @@
+#ifndef SRC_INCLUDE_FIXED_SPRING_SYSTEM_H_
+#define SRC_INCLUDE_FIXED_SPRING_SYSTEM_H_
+
+#include "include/spring_system.h"
+#include "include/spring_kernels.h"
+#include <array>
+
+// x, y and z of S vectors, each in its own array
+template <int S>
+struct FixedSoA {
+    void Zero() {
+        x.fill(0);
+        y.fill(0);
+        z.fill(0);
+    }
+
+    std::array<double, S> x;
+    std::array<double, S> y;
+    std::array<double, S> z;
+};
+
+// SpringSystem for small props whose size is known when compiling (8x8, 16x16, ...).
+// The nodes live in a std::array inside the object and the step kernels are
+// instantiated with the size as a constant, so no threads are started for grids this
+// small and every loop bound is known.
+//
+// The force kernel copies the nodes into fixed size x/y/z arrays and works out the
+// force of every spring and drag triangle on its own, so each of those loops is a
+// plain vectorizable stencil over contiguous rows instead of a scatter into both ends.
+// The pieces are then added up per node in the same order SpringSystem adds them, so
+// both give the same result. Everything else, including masks, strain limiting and
+// rendering, is the regular SpringSystem.
+template <int DX, int DY>
+class FixedSpringSystem : public SpringSystem {
+    public:
+        FixedSpringSystem(double ks, double kd) :
+            FixedSpringSystem(ks, kd, 0.1, 0.1) {}
+        FixedSpringSystem(double ks, double kd, double restLength, double mass) :
+            SpringSystem(DX, DY, ks, kd, restLength, mass, fixedNodes_.data()) {
+            // the padding of these is read as "no spring / no triangle here"
+            tri1_.Zero();
+            tri2_.Zero();
+            vertical_.Zero();
+            horizontal_.Zero();
+        }
+        // the base class points into fixedNodes_, so a copy would share the wrong nodes
+        FixedSpringSystem(const FixedSpringSystem&) = delete;
+        FixedSpringSystem& operator=(const FixedSpringSystem&) = delete;
+
+        // the kernels below index the nodes row by row, and these grids fit in cache
+        // whatever the order
+        void SetLayout(NodeLayout layout) override {
+            if (layout != ROW_MAJOR)
+                cout << "FixedSpringSystem only supports the row major layout" << endl;
+        }
+
+        void ComputeForces(highp_dvec3* forces) override {
+            if (masked_) {
+                SpringSystem::ComputeForces(forces);
+                return;
+            }
+            typedef void (FixedSpringSystem::*ForceKernel)(highp_dvec3*);
+            static const ForceKernel kernels[8] = {
+                &FixedSpringSystem::FixedForces<false, false, false>,
+                &FixedSpringSystem::FixedForces<false, false, true>,
+                &FixedSpringSystem::FixedForces<false, true, false>,
+                &FixedSpringSystem::FixedForces<false, true, true>,
+                &FixedSpringSystem::FixedForces<true, false, false>,
+                &FixedSpringSystem::FixedForces<true, false, true>,
+                &FixedSpringSystem::FixedForces<true, true, false>,
+                &FixedSpringSystem::FixedForces<true, true, true>
+            };
+            (this->*kernels[4 * drag_ + 2 * (wind != 0) + stuck])(forces);
+        }
+
+    protected:
+        void Integrate(double dt, const Sphere* spheres, int numSpheres) override {
+            typedef void (SpringSystem::*IntegrateKernel)(double, const Sphere*, int);
+            static const IntegrateKernel integrators[8] = {
+                &FixedSpringSystem::template IntegrateT<SYMPLECTIC_EULER, false, false, N>,
+                &FixedSpringSystem::template IntegrateT<SYMPLECTIC_EULER, false, true, N>,
+                &FixedSpringSystem::template IntegrateT<SYMPLECTIC_EULER, true, false, N>,
+                &FixedSpringSystem::template IntegrateT<SYMPLECTIC_EULER, true, true, N>,
+                &FixedSpringSystem::template IntegrateT<EXPLICIT_EULER, false, false, N>,
+                &FixedSpringSystem::template IntegrateT<EXPLICIT_EULER, false, true, N>,
+                &FixedSpringSystem::template IntegrateT<EXPLICIT_EULER, true, false, N>,
+                &FixedSpringSystem::template IntegrateT<EXPLICIT_EULER, true, true, N>
+            };
+            int kernel = 4 * (integrator_ == EXPLICIT_EULER) + 2 * (numSpheres > 0) + masked_;
+            (this->*integrators[kernel])(dt, spheres, numSpheres);
+        }
+
+    private:
+        static const int N = DX * DY;
+        // quad (r, c) is stored at Quad(r, c), with a border of empty quads at r, c = -1
+        // and at r = DY - 1, c = DX - 1
+        static const int QUADS = (DX + 1) * (DY + 1);
+        static int Quad(int r, int c) { return (r + 1) * (DX + 1) + c + 1; }
+
+        template <bool DRAG, bool WIND, bool PINNED>
+        void FixedForces(highp_dvec3* forces);
+
+        std::array<Node, N> fixedNodes_;
+
+        FixedSoA<N> pos_;
+        FixedSoA<N> vel_;
+        // drag of the two triangles of every quad, already split 3 ways
+        FixedSoA<QUADS> tri1_;
+        FixedSoA<QUADS> tri2_;
+        // force on node i from the spring to the node above / to the left of it, padded
+        // with empty springs on the first row / column and past the end
+        FixedSoA<N + DX> vertical_;
+        FixedSoA<N + 1> horizontal_;
+};
+
+template <int DX, int DY>
+template <bool DRAG, bool WIND, bool PINNED>
+void FixedSpringSystem<DX, DY>::FixedForces(highp_dvec3* forces) {
+    for (int i = 0; i < N; ++i) {
+        pos_.x[i] = nodes_[i].pos.x;
+        pos_.y[i] = nodes_[i].pos.y;
+        pos_.z[i] = nodes_[i].pos.z;
+        vel_.x[i] = nodes_[i].vel.x;
+        vel_.y[i] = nodes_[i].vel.y;
+        vel_.z[i] = nodes_[i].vel.z;
+    }
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+
+    // drag force
+    if (DRAG) {
+        const double pc = 10;
+        for (int r = 0; r < DY - 1; ++r) {
+            #pragma omp simd
+            for (int c = 0; c < DX - 1; ++c) {
+                const int ul = r*DX + c;
+                const int ur = ul + 1;
+                const int ll = ul + DX;
+                const int lr = ll + 1;
+                const int q = Quad(r, c);
+
+                // first triangle
+                double vx = (vel_.x[ul] + vel_.x[ur] + vel_.x[ll]) / 3.0;
+                double vy = (vel_.y[ul] + vel_.y[ur] + vel_.y[ll]) / 3.0;
+                double vz = (vel_.z[ul] + vel_.z[ur] + vel_.z[ll]) / 3.0;
+                if (WIND) {
+                    vx -= wind.x;
+                    vy -= wind.y;
+                    vz -= wind.z;
+                }
+                double ax = pos_.x[ll] - pos_.x[ul], ay = pos_.y[ll] - pos_.y[ul], az = pos_.z[ll] - pos_.z[ul];
+                double bx = pos_.x[ur] - pos_.x[ul], by = pos_.y[ur] - pos_.y[ul], bz = pos_.z[ur] - pos_.z[ul];
+                double nx = ay * bz - by * az;
+                double ny = az * bx - bz * ax;
+                double nz = ax * by - bx * ay;
+                double s = -.5*pc*(sqrt(vx*vx + vy*vy + vz*vz)*(vx*nx + vy*ny + vz*nz));
+                double ln = 2*sqrt(nx*nx + ny*ny + nz*nz);
+                tri1_.x[q] = s * nx / ln / 3.0;
+                tri1_.y[q] = s * ny / ln / 3.0;
+                tri1_.z[q] = s * nz / ln / 3.0;
+
+                // second triangle
+                vx = (vel_.x[lr] + vel_.x[ur] + vel_.x[ll]) / 3.0;
+                vy = (vel_.y[lr] + vel_.y[ur] + vel_.y[ll]) / 3.0;
+                vz = (vel_.z[lr] + vel_.z[ur] + vel_.z[ll]) / 3.0;
+                if (WIND) {
+                    vx -= wind.x;
+                    vy -= wind.y;
+                    vz -= wind.z;
+                }
+                ax = pos_.x[ur] - pos_.x[lr], ay = pos_.y[ur] - pos_.y[lr], az = pos_.z[ur] - pos_.z[lr];
+                bx = pos_.x[ll] - pos_.x[lr], by = pos_.y[ll] - pos_.y[lr], bz = pos_.z[ll] - pos_.z[lr];
+                nx = ay * bz - by * az;
+                ny = az * bx - bz * ax;
+                nz = ax * by - bx * ay;
+                s = -.5*pc*(sqrt(vx*vx + vy*vy + vz*vz)*(vx*nx + vy*ny + vz*nz));
+                ln = 2*sqrt(nx*nx + ny*ny + nz*nz);
+                tri2_.x[q] = s * nx / ln / 3.0;
+                tri2_.y[q] = s * ny / ln / 3.0;
+                tri2_.z[q] = s * nz / ln / 3.0;
+            }
+        }
+    }
+
+    // springs between node i and the node above it
+    for (int i = DX; i < N; ++i) {
+        double dx = pos_.x[i] - pos_.x[i - DX];
+        double dy = pos_.y[i] - pos_.y[i - DX];
+        double dz = pos_.z[i] - pos_.z[i - DX];
+        double dd = dx*dx + dy*dy + dz*dz;
+        double l = sqrt(dd);
+        double inv = 1.0 / sqrt(dd);
+        double ex = dx * inv, ey = dy * inv, ez = dz * inv;
+        double v1 = ex * vel_.x[i] + ey * vel_.y[i] + ez * vel_.z[i];
+        double v2 = ex * vel_.x[i - DX] + ey * vel_.y[i - DX] + ez * vel_.z[i - DX];
+        double f = SpringForce(KS_, KD_, l, restLength_, v1, v2);
+        vertical_.x[i] = f * ex;
+        vertical_.y[i] = f * ey;
+        vertical_.z[i] = f * ez;
+    }
+    // springs between node i and the node left of it
+    for (int r = 0; r < DY; ++r) {
+        for (int c = 1; c < DX; ++c) {
+            const int i = r*DX + c;
+            double dx = pos_.x[i] - pos_.x[i - 1];
+            double dy = pos_.y[i] - pos_.y[i - 1];
+            double dz = pos_.z[i] - pos_.z[i - 1];
+            double dd = dx*dx + dy*dy + dz*dz;
+            double l = sqrt(dd);
+            double inv = 1.0 / sqrt(dd);
+            double ex = dx * inv, ey = dy * inv, ez = dz * inv;
+            double v1 = ex * vel_.x[i] + ey * vel_.y[i] + ez * vel_.z[i];
+            double v2 = ex * vel_.x[i - 1] + ey * vel_.y[i - 1] + ez * vel_.z[i - 1];
+            double f = SpringForce(KS_, KD_, l, restLength_, v1, v2);
+            horizontal_.x[i] = f * ex;
+            horizontal_.y[i] = f * ey;
+            horizontal_.z[i] = f * ez;
+        }
+    }
+
+    // every node adds up its pieces, the empty padding entries add exactly 0
+    const highp_dvec3 gravity = GRAVITY * mass_;
+    for (int r = 0; r < DY; ++r) {
+        for (int c = 0; c < DX; ++c) {
+            const int i = r*DX + c;
+            double fx = gravity.x, fy = gravity.y, fz = gravity.z;
+            if (WIND) {
+                fx += wind.x;
+                fy += wind.y;
+                fz += wind.z;
+            }
+            if (DRAG) {
+                const int q[6] = { Quad(r - 1, c - 1), Quad(r - 1, c), Quad(r - 1, c),
+                                   Quad(r, c - 1), Quad(r, c - 1), Quad(r, c) };
+                fx += tri2_.x[q[0]]; fy += tri2_.y[q[0]]; fz += tri2_.z[q[0]];
+                fx += tri1_.x[q[1]]; fy += tri1_.y[q[1]]; fz += tri1_.z[q[1]];
+                fx += tri2_.x[q[2]]; fy += tri2_.y[q[2]]; fz += tri2_.z[q[2]];
+                fx += tri1_.x[q[3]]; fy += tri1_.y[q[3]]; fz += tri1_.z[q[3]];
+                fx += tri2_.x[q[4]]; fy += tri2_.y[q[4]]; fz += tri2_.z[q[4]];
+                fx += tri1_.x[q[5]]; fy += tri1_.y[q[5]]; fz += tri1_.z[q[5]];
+            }
+            fx += vertical_.x[i]; fy += vertical_.y[i]; fz += vertical_.z[i];
+            fx -= vertical_.x[i + DX]; fy -= vertical_.y[i + DX]; fz -= vertical_.z[i + DX];
+            fx += horizontal_.x[i]; fy += horizontal_.y[i]; fz += horizontal_.z[i];
+            fx -= horizontal_.x[i + 1]; fy -= horizontal_.y[i + 1]; fz -= horizontal_.z[i + 1];
+            forces[i] = highp_dvec3(fx, fy, fz);
+        }
+    }
+
+    if (PINNED) {
+        for (int c = 0; c < DX; ++c) {
+            forces[c] = highp_dvec3(0, 0, 0);
+        }
+    }
+}
+
+#endif  // SRC_INCLUDE_FIXED_SPRING_SYSTEM_H_
@@ -0,0 +1,32 @@
+#ifndef SRC_INCLUDE_FIXED_TIMESTEP_H_
+#define SRC_INCLUDE_FIXED_TIMESTEP_H_
+
+// Turns measured frame times into a whole number of fixed length steps. Time left over
+// carries into the next frame, so the simulation keeps pace with the wall clock at any
+// frame rate, and Alpha() is how far into the next step the wall clock is, for drawing
+// between the last two states. At most maxSteps steps run per frame: when the machine
+// can't keep up, the rest of the time is dropped and the simulation runs slower than
+// real time instead of needing more steps every frame.
+class FixedTimestep {
+    public:
+        FixedTimestep(double step, int maxSteps);
+
+        // adds dt seconds and returns the number of steps to take
+        int Advance(double dt);
+        void Reset() { accumulator_ = 0; }
+
+        double Step() { return step_; }
+        // seconds not yet stepped, less than one step after Advance
+        double Accumulated() { return accumulator_; }
+        double Alpha() { return accumulator_ / step_; }
+        // seconds dropped so far because of the limit
+        double Dropped() { return dropped_; }
+
+    private:
+        double step_;
+        int maxSteps_;
+        double accumulator_;
+        double dropped_;
+};
+
+#endif  // SRC_INCLUDE_FIXED_TIMESTEP_H_
@@ -0,0 +1,91 @@
+#ifndef SRC_INCLUDE_LATTICE_SYSTEM_H_
+#define SRC_INCLUDE_LATTICE_SYSTEM_H_
+
+#include "include/utils.h"
+#include "include/glsl_shader.h"
+#include "include/spring_system.h"
+
+// nodes are stored in cubic tiles of LATTICE_TILE^3 so neighbours in all three
+// directions are usually in the same few cache lines
+#define LATTICE_TILE_BITS 2
+#define LATTICE_TILE (1 << LATTICE_TILE_BITS)
+#define LATTICE_TILE_MASK (LATTICE_TILE - 1)
+#define LATTICE_TILE_NODES (LATTICE_TILE * LATTICE_TILE * LATTICE_TILE)
+
+// Jelly-like soft body: a dimX x dimY x dimZ lattice of nodes where every node is tied
+// to its 26 neighbours with the same damped springs as the cloth. Only the outer faces
+// are turned into triangles for rendering.
+class LatticeSystem {
+    public:
+        LatticeSystem();
+        LatticeSystem(int dimx, int dimy, int dimz, double ks, double kd);
+        ~LatticeSystem();
+        LatticeSystem(const LatticeSystem&) = delete;
+        LatticeSystem& operator=(const LatticeSystem&) = delete;
+        void Setup();
+        void LatticeSetup(highp_dvec3 origin);
+        void SurfaceSetup();
+        void GLSetup();
+        void Update(double dt);
+        void Render(const mat4& V, const mat4& P);
+        void HandleCollisions(Sphere& sphere);
+        void HandleCollisions(vector<Sphere>& spheres);
+        void UpdateGPUPositions();
+        void RecalculateNormals();
+
+        int Index(int x, int y, int z) {
+            int tile = ((z >> LATTICE_TILE_BITS) * tilesY_ + (y >> LATTICE_TILE_BITS)) * tilesX_ +
+                       (x >> LATTICE_TILE_BITS);
+            int local = (((z & LATTICE_TILE_MASK) << LATTICE_TILE_BITS) + (y & LATTICE_TILE_MASK))
+                        << LATTICE_TILE_BITS;
+            return tile * LATTICE_TILE_NODES + local + (x & LATTICE_TILE_MASK);
+        }
+        Node& GetNode(int x, int y, int z) { return nodes_[Index(x, y, z)]; }
+
+        int DimX() { return dimX_; }
+        int DimY() { return dimY_; }
+        int DimZ() { return dimZ_; }
+        int NumSurfaceNodes() { return surfaceNodes_.size(); }
+        void Pause() { paused_ = !paused_; }
+
+        double GetKS() { return KS_; }
+        double GetKD() { return KD_; }
+        void SetKS(double ks) { KS_ = ks; }
+        void SetKD(double kd) { KD_ = kd; }
+
+        bool stuck;
+
+    private:
+        void AddFace(int axis, bool high);
+
+        int dimX_;
+        int dimY_;
+        int dimZ_;
+        int tilesX_;
+        int tilesY_;
+        int tilesZ_;
+        int numSlots_;
+        double KS_;
+        double KD_;
+        double mass_;
+        double restLength_;
+        bool paused_;
+
+        // the state is double buffered so every node can gather from its neighbours
+        // while other threads write the next step
+        Node* nodes_;
+        Node* next_;
+
+        // lattice node each surface vertex comes from and the surface triangles
+        vector<int> surfaceNodes_;
+        vector<int> surfaceIds_;
+        vector<unsigned int> surfaceIndices_;
+        vec3* posArray_;
+        vec3* normals_;
+
+        GLSLShader shader_;
+        GLuint vao_;
+        GLuint vbos_[3];
+};
+
+#endif  // SRC_INCLUDE_LATTICE_SYSTEM_H_
@@ -0,0 +1,613 @@
+#ifndef SRC_INCLUDE_LEVEL_KERNELS_H_
+#define SRC_INCLUDE_LEVEL_KERNELS_H_
+
+// The hot kernels of SpringSystem: the row major and tiled steps, the phases of the
+// PADDED step, the band integrator, the normals and the node loop of the collisions.
+// They are templates on the CpuLevel they are compiled for. spring_system.cpp includes
+// this for the baseline (CPU_SSE2) and kernels_<level>.cpp include it after a
+// "#pragma GCC target" and instantiate it with LEVEL_KERNELS, so the same loops are
+// vectorised once per level. The headers these use have to be included before the
+// pragma, so what they define keeps the baseline target and can be shared by every
+// level. Only the masked kernels have no levels.
+//
+// None of the levels enable FMA and nothing in here may be reassociated, so every level
+// gives exactly the same result.
+
+#include "include/spring_system.h"
+#include "include/spring_law.h"
+#include "include/spring_kernels.h"
+#include <omp.h>
+#include <algorithm>
+
+// the two triangle normals of the quads with their upper left node in the rows
+template <CpuLevel LEVEL>
+void SpringSystem::QuadNormalsT(int rowBegin, int rowEnd) {
+    const int quadRowEnd = std::min(rowEnd, dimY_ - 1);
+    for (int r = rowBegin; r < quadRowEnd; ++r) {
+        for (int c = 0; c < dimX_ - 1; ++c) {
+            vec3 ul = posArray_[NodeIndex(r, c)];
+            vec3 ll = posArray_[NodeIndex(r + 1, c)];
+            vec3 ur = posArray_[NodeIndex(r, c + 1)];
+            vec3 lr = posArray_[NodeIndex(r + 1, c + 1)];
+            vec3 e12 = ll - ul;
+            vec3 e13 = ur - ul;
+            vec3 e34 = lr - ur;
+            int q = 2 * (r * (dimX_ - 1) + c);
+            quadNormals_[q] = cross(e12, e13);
+            quadNormals_[q + 1] = cross(-e13, e34);
+        }
+    }
+}
+
+template <CpuLevel LEVEL>
+void SpringSystem::GatherNormalsT(int rowBegin, int rowEnd) {
+    const int quadsX = dimX_ - 1;
+    const vec3* quads = &quadNormals_[0];
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            vec3 n(0, 0, 0);
+            // lower right of the quad up and left, lower left of the one up, upper right
+            // of the one left and upper left of its own
+            if (r > 0 && c > 0)
+                n += quads[2 * ((r - 1) * quadsX + c - 1) + 1];
+            if (r > 0 && c < quadsX) {
+                n += quads[2 * ((r - 1) * quadsX + c)];
+                n += quads[2 * ((r - 1) * quadsX + c) + 1];
+            }
+            if (r < dimY_ - 1 && c > 0) {
+                n += quads[2 * (r * quadsX + c - 1)];
+                n += quads[2 * (r * quadsX + c - 1) + 1];
+            }
+            if (r < dimY_ - 1 && c < quadsX)
+                n += quads[2 * (r * quadsX + c)];
+            normals_[NodeIndex(r, c)] = normalize(n);
+        }
+    }
+}
+
+template <CpuLevel LEVEL, Integrator INTEGRATOR, bool COLLIDE>
+void SpringSystem::IntegrateBandT(int begin, int end) {
+    for (int i = begin; i < end; ++i)
+        IntegrateNode<INTEGRATOR, COLLIDE>(nodes_[i], forces_[i], mass_, stepDt_, stepSpheres_,
+                                           stepNumSpheres_);
+}
+
+// ComputeForces on the PADDED layout. Every quad and spring is worked out for every
+// storage index in one flat loop, the ones touching a ghost with zero drag or stiffness,
+// and then each node adds up its pieces in the order ComputeForcesT does, so both give
+// the same forces. The threads split each phase the same way and only wait for each
+// other between phases.
+template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+void SpringSystem::PaddedForcesT(highp_dvec3* forces) {
+    #pragma omp parallel
+    {
+        int rowBegin, rowEnd;
+        RowBand(numNodes_ / padStride_, omp_get_thread_num(), omp_get_num_threads(), rowBegin,
+                rowEnd);
+        PaddedGatherT<LEVEL>(rowBegin * padStride_, rowEnd * padStride_);
+        #pragma omp barrier
+        PaddedPiecesT<LEVEL, DRAG, WIND>(rowBegin * padStride_, rowEnd * padStride_);
+        #pragma omp barrier
+        // storage row r + 1 holds row r of the cloth
+        PaddedSumT<LEVEL, DRAG, WIND, PINNED>(std::max(0, rowBegin - 1),
+                                               std::min(dimY_, rowEnd - 1), forces);
+    }
+}
+
+// the nodes in [begin, end) to the SoA copies
+template <CpuLevel LEVEL>
+void SpringSystem::PaddedGatherT(int begin, int end) {
+    double* px = &padPos_.x[0];
+    double* py = &padPos_.y[0];
+    double* pz = &padPos_.z[0];
+    double* vx = &padVel_.x[0];
+    double* vy = &padVel_.y[0];
+    double* vz = &padVel_.z[0];
+    #pragma omp simd
+    for (int i = begin; i < end; ++i) {
+        px[i] = nodes_[i].pos.x;
+        py[i] = nodes_[i].pos.y;
+        pz[i] = nodes_[i].pos.z;
+        vx[i] = nodes_[i].vel.x;
+        vy[i] = nodes_[i].vel.y;
+        vz[i] = nodes_[i].vel.z;
+    }
+}
+
+// the drag of the quads and the forces of the springs stored at [begin, end), from the
+// SoA copies of those indices and of up to a row of storage on either side
+template <CpuLevel LEVEL, bool DRAG, bool WIND>
+void SpringSystem::PaddedPiecesT(int begin, int end) {
+    const int n = numNodes_;
+    const int stride = padStride_;
+    const double* px = &padPos_.x[0];
+    const double* py = &padPos_.y[0];
+    const double* pz = &padPos_.z[0];
+    const double* vx = &padVel_.x[0];
+    const double* vy = &padVel_.y[0];
+    const double* vz = &padVel_.z[0];
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+
+    // drag force, quads from the ghost above and left of node (0, 0) to node
+    // (dimY_ - 1, dimX_ - 1)
+    double* t1x = &padTri1_.x[0];
+    double* t1y = &padTri1_.y[0];
+    double* t1z = &padTri1_.z[0];
+    double* t2x = &padTri2_.x[0];
+    double* t2y = &padTri2_.y[0];
+    double* t2z = &padTri2_.z[0];
+    if (DRAG) {
+        const double* weight = &quadWeight_[0];
+        const int first = std::max(begin, NodeIndex(0, 0) - stride - 1);
+        const int last = std::min(end - 1, NodeIndex(dimY_ - 1, dimX_ - 1));
+        #pragma omp simd
+        for (int ul = first; ul <= last; ++ul) {
+            const int ur = ul + 1;
+            const int ll = ul + stride;
+            const int lr = ll + 1;
+            const double pc = 10 * weight[ul];
+
+            // first triangle
+            double wx = (vx[ul] + vx[ur] + vx[ll]) / 3.0;
+            double wy = (vy[ul] + vy[ur] + vy[ll]) / 3.0;
+            double wz = (vz[ul] + vz[ur] + vz[ll]) / 3.0;
+            if (WIND) {
+                wx -= wind.x;
+                wy -= wind.y;
+                wz -= wind.z;
+            }
+            double ax = px[ll] - px[ul], ay = py[ll] - py[ul], az = pz[ll] - pz[ul];
+            double bx = px[ur] - px[ul], by = py[ur] - py[ul], bz = pz[ur] - pz[ul];
+            double nx = ay * bz - by * az;
+            double ny = az * bx - bz * ax;
+            double nz = ax * by - bx * ay;
+            double s = -.5*pc*(sqrt(wx*wx + wy*wy + wz*wz)*(wx*nx + wy*ny + wz*nz));
+            double ln = 2*sqrt(nx*nx + ny*ny + nz*nz);
+            t1x[ul] = s * nx / ln / 3.0;
+            t1y[ul] = s * ny / ln / 3.0;
+            t1z[ul] = s * nz / ln / 3.0;
+
+            // second triangle
+            wx = (vx[lr] + vx[ur] + vx[ll]) / 3.0;
+            wy = (vy[lr] + vy[ur] + vy[ll]) / 3.0;
+            wz = (vz[lr] + vz[ur] + vz[ll]) / 3.0;
+            if (WIND) {
+                wx -= wind.x;
+                wy -= wind.y;
+                wz -= wind.z;
+            }
+            ax = px[ur] - px[lr], ay = py[ur] - py[lr], az = pz[ur] - pz[lr];
+            bx = px[ll] - px[lr], by = py[ll] - py[lr], bz = pz[ll] - pz[lr];
+            nx = ay * bz - by * az;
+            ny = az * bx - bz * ax;
+            nz = ax * by - bx * ay;
+            s = -.5*pc*(sqrt(wx*wx + wy*wy + wz*wz)*(wx*nx + wy*ny + wz*nz));
+            ln = 2*sqrt(nx*nx + ny*ny + nz*nz);
+            t2x[ul] = s * nx / ln / 3.0;
+            t2y[ul] = s * ny / ln / 3.0;
+            t2z[ul] = s * nz / ln / 3.0;
+        }
+    }
+
+    // spring between node i and the one a row up, for every node below the first row
+    // of storage
+    double* fvx = &padVertical_.x[0];
+    double* fvy = &padVertical_.y[0];
+    double* fvz = &padVertical_.z[0];
+    const double* verticalWeight = &verticalWeight_[0];
+    const int stop = std::min(end, n);
+    #pragma omp simd
+    for (int i = std::max(begin, stride); i < stop; ++i) {
+        const int j = i - stride;
+        double dx = px[i] - px[j];
+        double dy = py[i] - py[j];
+        double dz = pz[i] - pz[j];
+        double dd = dx*dx + dy*dy + dz*dz;
+        double l = sqrt(dd);
+        double inv = 1.0 / sqrt(dd);
+        double ex = dx * inv, ey = dy * inv, ez = dz * inv;
+        double v1 = ex * vx[i] + ey * vy[i] + ez * vz[i];
+        double v2 = ex * vx[j] + ey * vy[j] + ez * vz[j];
+        double f = SpringForce(KS_ * verticalWeight[i], KD_ * verticalWeight[i], l, restLength_,
+                               v1, v2);
+        fvx[i] = f * ex;
+        fvy[i] = f * ey;
+        fvz[i] = f * ez;
+    }
+    // and the one to the left of it
+    double* fhx = &padHorizontal_.x[0];
+    double* fhy = &padHorizontal_.y[0];
+    double* fhz = &padHorizontal_.z[0];
+    const double* horizontalWeight = &horizontalWeight_[0];
+    #pragma omp simd
+    for (int i = std::max(begin, 1); i < stop; ++i) {
+        const int j = i - 1;
+        double dx = px[i] - px[j];
+        double dy = py[i] - py[j];
+        double dz = pz[i] - pz[j];
+        double dd = dx*dx + dy*dy + dz*dz;
+        double l = sqrt(dd);
+        double inv = 1.0 / sqrt(dd);
+        double ex = dx * inv, ey = dy * inv, ez = dz * inv;
+        double v1 = ex * vx[i] + ey * vy[i] + ez * vz[i];
+        double v2 = ex * vx[j] + ey * vy[j] + ez * vz[j];
+        double f = SpringForce(KS_ * horizontalWeight[i], KD_ * horizontalWeight[i], l,
+                               restLength_, v1, v2);
+        fhx[i] = f * ex;
+        fhy[i] = f * ey;
+        fhz[i] = f * ez;
+    }
+}
+
+// every node of rows [rowBegin, rowEnd) adds up its pieces, the ones from ghosts add
+// exactly 0
+template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+void SpringSystem::PaddedSumT(int rowBegin, int rowEnd, highp_dvec3* forces) {
+    const int stride = padStride_;
+    const double* t1x = &padTri1_.x[0];
+    const double* t1y = &padTri1_.y[0];
+    const double* t1z = &padTri1_.z[0];
+    const double* t2x = &padTri2_.x[0];
+    const double* t2y = &padTri2_.y[0];
+    const double* t2z = &padTri2_.z[0];
+    const double* fvx = &padVertical_.x[0];
+    const double* fvy = &padVertical_.y[0];
+    const double* fvz = &padVertical_.z[0];
+    const double* fhx = &padHorizontal_.x[0];
+    const double* fhy = &padHorizontal_.y[0];
+    const double* fhz = &padHorizontal_.z[0];
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+    const highp_dvec3 gravity = GRAVITY * mass_;
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        const int start = NodeIndex(r, 0);
+        const int stop = start + dimX_;
+        #pragma omp simd
+        for (int i = start; i < stop; ++i) {
+            double fx = gravity.x, fy = gravity.y, fz = gravity.z;
+            if (WIND) {
+                fx += wind.x;
+                fy += wind.y;
+                fz += wind.z;
+            }
+            if (DRAG) {
+                const int up = i - stride;
+                fx += t2x[up - 1]; fy += t2y[up - 1]; fz += t2z[up - 1];
+                fx += t1x[up]; fy += t1y[up]; fz += t1z[up];
+                fx += t2x[up]; fy += t2y[up]; fz += t2z[up];
+                fx += t1x[i - 1]; fy += t1y[i - 1]; fz += t1z[i - 1];
+                fx += t2x[i - 1]; fy += t2y[i - 1]; fz += t2z[i - 1];
+                fx += t1x[i]; fy += t1y[i]; fz += t1z[i];
+            }
+            fx += fvx[i]; fy += fvy[i]; fz += fvz[i];
+            fx -= fvx[i + stride]; fy -= fvy[i + stride]; fz -= fvz[i + stride];
+            fx += fhx[i]; fy += fhy[i]; fz += fhz[i];
+            fx -= fhx[i + 1]; fy -= fhy[i + 1]; fz -= fhz[i + 1];
+            forces[i] = highp_dvec3(fx, fy, fz);
+        }
+    }
+
+    if (PINNED && rowBegin == 0 && rowBegin < rowEnd) {
+        for (int c = 0; c < dimX_; ++c) {
+            forces[NodeIndex(0, c)] = highp_dvec3(0, 0, 0);
+        }
+    }
+}
+
+// The drag of every quad and the force of every spring go to forcePieces_ first, then
+// every node adds up its own in a fixed order, so the threads never write the same node
+// and the forces don't depend on how the rows were split between them.
+template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+void SpringSystem::ComputeForcesT(highp_dvec3* forces) {
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+    const int cells = dimX_ * dimY_;
+    forcePieces_.resize(4 * cells);
+    // quad, vertical spring and horizontal spring (r, c) at r * dimX_ + c: the quad with
+    // its upper left node at (r, c) and the springs to the node above and to the left
+    highp_dvec3* tri1 = &forcePieces_[0];
+    highp_dvec3* tri2 = tri1 + cells;
+    highp_dvec3* vertical = tri2 + cells;
+    highp_dvec3* horizontal = vertical + cells;
+
+    // drag force
+    if (DRAG) {
+        #pragma omp parallel for
+        for (int r = 0; r < dimY_ - 1; ++r) {
+            for (int c = 0; c < dimX_ - 1; ++c) {
+                Node& ul = GetNode(r, c);
+                Node& ll = GetNode(r + 1, c);
+                Node& ur = GetNode(r, c + 1);
+                Node& lr = GetNode(r + 1, c + 1);
+
+                double pc = 10;
+                highp_dvec3 n, v, force;
+                // first triangle
+                v = (ul.vel + ur.vel + ll.vel) / 3.0;
+                if (WIND)
+                    v -= wind;
+                n = cross(ll.pos - ul.pos, ur.pos - ul.pos);
+                force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                tri1[r * dimX_ + c] = force / 3.0;
+
+                // second triangle
+                v = (lr.vel + ur.vel + ll.vel) / 3.0;
+                if (WIND)
+                    v -= wind;
+                n = cross(ur.pos - lr.pos, ll.pos - lr.pos);
+                force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                tri2[r * dimX_ + c] = force / 3.0;
+            }
+        }
+    }
+    #pragma omp parallel for
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            Node& n1 = GetNode(r, c);
+            if (r > 0) {
+                Node& n2 = GetNode(r - 1, c);
+                double l = length(n1.pos - n2.pos);
+                highp_dvec3 e = normalize(n1.pos - n2.pos);
+                double v1 = dot(e, n1.vel);
+                double v2 = dot(e, n2.vel);
+                vertical[r * dimX_ + c] = SpringForce(KS_, KD_, l, restLength_, v1, v2) * e;
+            }
+            if (c > 0) {
+                Node& n2 = GetNode(r, c - 1);
+                double l = length(n1.pos - n2.pos);
+                highp_dvec3 e = normalize(n1.pos - n2.pos);
+                double v1 = dot(e, n1.vel);
+                double v2 = dot(e, n2.vel);
+                horizontal[r * dimX_ + c] = SpringForce(KS_, KD_, l, restLength_, v1, v2) * e;
+            }
+        }
+    }
+
+    // gravity and wind, then the quads up left, up, left and own, then the springs up,
+    // down, left and right
+    #pragma omp parallel for
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r * dimX_ + c;
+            highp_dvec3 f = GRAVITY * mass_;
+            if (WIND)
+                f += wind;
+            if (DRAG) {
+                if (r > 0 && c > 0)
+                    f += tri2[i - dimX_ - 1];
+                if (r > 0 && c < dimX_ - 1) {
+                    f += tri1[i - dimX_];
+                    f += tri2[i - dimX_];
+                }
+                if (r < dimY_ - 1 && c > 0) {
+                    f += tri1[i - 1];
+                    f += tri2[i - 1];
+                }
+                if (r < dimY_ - 1 && c < dimX_ - 1)
+                    f += tri1[i];
+            }
+            if (r > 0)
+                f += vertical[i];
+            if (r < dimY_ - 1)
+                f -= vertical[i + dimX_];
+            if (c > 0)
+                f += horizontal[i];
+            if (c < dimX_ - 1)
+                f -= horizontal[i + 1];
+            forces[NodeIndex(r, c)] = f;
+        }
+    }
+
+    if (PINNED) {
+        for (int c = 0; c < dimX_; ++c) {
+            forces[NodeIndex(0, c)] = vec3(0, 0, 0);
+        }
+    }
+}
+
+// One pass over the grid in tiles of tileRows_ x tileCols_ nodes. Quads and springs on
+// the border of a tile are worked out by both tiles that touch them, which is cheaper
+// than going back to memory for them. Every tile only writes its own nodes of next_, so
+// tiles run in parallel without races and the result does not depend on the threads.
+template <CpuLevel LEVEL, bool DRAG, bool WIND, bool COLLIDE, Integrator INTEGRATOR>
+void SpringSystem::TiledStepT(double dt, const Sphere* spheres, int numSpheres) {
+    const int tilesX = (dimX_ + tileCols_ - 1) / tileCols_;
+    const int tilesY = (dimY_ + tileRows_ - 1) / tileRows_;
+    const int stride = tileCols_ + 1;
+    const int scratchSize = (tileRows_ + 1) * stride;
+    tileScratch_.resize(4 * scratchSize * omp_get_max_threads());
+    const highp_dvec3 gravity = GRAVITY * mass_;
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+    const highp_dvec3 zero(0, 0, 0);
+
+    #pragma omp parallel
+    {
+        // quad (r0 - 1 + i, c0 - 1 + j) is at i * stride + j, and so are the spring from
+        // node (r0 + i, c0 + j) to the node above it and to the node left of it
+        highp_dvec3* tri1 = &tileScratch_[4 * scratchSize * omp_get_thread_num()];
+        highp_dvec3* tri2 = tri1 + scratchSize;
+        highp_dvec3* vertical = tri2 + scratchSize;
+        highp_dvec3* horizontal = vertical + scratchSize;
+
+        #pragma omp for schedule(static)
+        for (int t = 0; t < tilesX * tilesY; ++t) {
+            const int r0 = (t / tilesX) * tileRows_;
+            const int c0 = (t % tilesX) * tileCols_;
+            const int h = std::min(tileRows_, dimY_ - r0);
+            const int w = std::min(tileCols_, dimX_ - c0);
+
+            // drag force
+            if (DRAG) {
+                for (int i = 0; i <= h; ++i) {
+                    int r = r0 - 1 + i;
+                    for (int j = 0; j <= w; ++j) {
+                        int c = c0 - 1 + j;
+                        if (r < 0 || c < 0 || r >= dimY_ - 1 || c >= dimX_ - 1) {
+                            tri1[i*stride + j] = zero;
+                            tri2[i*stride + j] = zero;
+                            continue;
+                        }
+                        Node& ul = GetNode(r, c);
+                        Node& ll = GetNode(r + 1, c);
+                        Node& ur = GetNode(r, c + 1);
+                        Node& lr = GetNode(r + 1, c + 1);
+
+                        double pc = 10;
+                        highp_dvec3 n, v, force;
+                        // first triangle
+                        v = (ul.vel + ur.vel + ll.vel) / 3.0;
+                        if (WIND)
+                            v -= wind;
+                        n = cross(ll.pos - ul.pos, ur.pos - ul.pos);
+                        force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                        tri1[i*stride + j] = force / 3.0;
+
+                        // second triangle
+                        v = (lr.vel + ur.vel + ll.vel) / 3.0;
+                        if (WIND)
+                            v -= wind;
+                        n = cross(ur.pos - lr.pos, ll.pos - lr.pos);
+                        force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                        tri2[i*stride + j] = force / 3.0;
+                    }
+                }
+            }
+            for (int i = 0; i <= h; ++i) {
+                int r = r0 + i;
+                for (int j = 0; j < w; ++j) {
+                    int c = c0 + j;
+                    if (r < 1 || r >= dimY_)
+                        vertical[i*stride + j] = zero;
+                    else
+                        vertical[i*stride + j] = SpringVector(GetNode(r, c), GetNode(r - 1, c),
+                                                              KS_, KD_, restLength_);
+                }
+            }
+            for (int i = 0; i < h; ++i) {
+                int r = r0 + i;
+                for (int j = 0; j <= w; ++j) {
+                    int c = c0 + j;
+                    if (c < 1 || c >= dimX_)
+                        horizontal[i*stride + j] = zero;
+                    else
+                        horizontal[i*stride + j] = SpringVector(GetNode(r, c), GetNode(r, c - 1),
+                                                                KS_, KD_, restLength_);
+                }
+            }
+
+            for (int i = 0; i < h; ++i) {
+                for (int j = 0; j < w; ++j) {
+                    highp_dvec3 f = gravity;
+                    if (WIND)
+                        f += wind;
+                    if (DRAG) {
+                        f += tri2[i*stride + j];
+                        f += tri1[i*stride + j + 1];
+                        f += tri2[i*stride + j + 1];
+                        f += tri1[(i + 1)*stride + j];
+                        f += tri2[(i + 1)*stride + j];
+                        f += tri1[(i + 1)*stride + j + 1];
+                    }
+                    f += vertical[i*stride + j];
+                    f -= vertical[(i + 1)*stride + j];
+                    f += horizontal[i*stride + j];
+                    f -= horizontal[i*stride + j + 1];
+                    if (stuck && r0 + i == 0)
+                        f = zero;
+
+                    int idx = NodeIndex(r0 + i, c0 + j);
+                    Node n = nodes_[idx];
+                    if (INTEGRATOR == SYMPLECTIC_EULER) {
+                        n.vel += f/mass_ * dt;
+                        n.pos += n.vel * dt;
+                    } else {
+                        n.pos += n.vel * dt;
+                        n.vel += f/mass_ * dt;
+                    }
+                    if (COLLIDE)
+                        for (int s = 0; s < numSpheres; ++s)
+                            CollideKinematic(n, spheres[s]);
+                    next_[idx] = n;
+                }
+            }
+        }
+    }
+    std::swap(nodes_, next_);
+}
+
+// the node loop of HandleCollisions, every thread into its own slots of sphereImpulses_
+template <CpuLevel LEVEL>
+void SpringSystem::CollideSpheresT(Sphere* spheres, int numSpheres) {
+    #pragma omp parallel
+    {
+        highp_dvec3* impulses = &sphereImpulses_[2 * omp_get_thread_num() * numSpheres];
+        highp_dvec3* pushes = impulses + numSpheres;
+        const int numActive = NumActiveNodes();
+        #pragma omp for schedule(static)
+        for (int k = 0; k < numActive; ++k) {
+            // padding slots of a Morton layout are not nodes and must not push spheres
+            Node& n = nodes_[masked_ ? activeNodes_[k] : NodeIndex(k / dimX_, k % dimX_)];
+            for (int s = 0; s < numSpheres; ++s) {
+                Sphere& sphere = spheres[s];
+                if (!sphere.Dynamic()) {
+                    CollideKinematic(n, sphere);
+                    continue;
+                }
+                vec3 p = n.pos;
+                double d = glm::length(p - sphere.position);
+                if (d >= sphere.radius + COLLISION_RANGE)
+                    continue;
+                vec3 normal = glm::normalize(p - sphere.position);
+
+                highp_dvec3 dn = normal;
+                double share = sphere.mass / (mass_ + sphere.mass);
+                double depth = COLLISION_OFFSET + sphere.radius - d;
+                n.pos += share * depth * dn;
+                highp_dvec3 push = -(1 - share) * depth * dn;
+                if (dot(push, push) > dot(pushes[s], pushes[s]))
+                    pushes[s] = push;
+                double vn = dot(n.vel - highp_dvec3(sphere.velocity), dn);
+                if (vn < 0) {
+                    double j = -vn * mass_ * share;
+                    n.vel += j / mass_ * dn;
+                    impulses[s] -= j * dn;
+                }
+            }
+        }
+    }
+}
+
+#define LEVEL_KERNEL_TILED(PREFIX, LEVEL, DRAG, WIND, COLLIDE) \
+    PREFIX template void SpringSystem::TiledStepT<LEVEL, DRAG, WIND, COLLIDE, SYMPLECTIC_EULER>( \
+        double, const Sphere*, int); \
+    PREFIX template void SpringSystem::TiledStepT<LEVEL, DRAG, WIND, COLLIDE, EXPLICIT_EULER>( \
+        double, const Sphere*, int);
+
+#define LEVEL_KERNEL_FORCES(PREFIX, LEVEL, DRAG, WIND) \
+    PREFIX template void SpringSystem::ComputeForcesT<LEVEL, DRAG, WIND, false>(highp_dvec3*); \
+    PREFIX template void SpringSystem::ComputeForcesT<LEVEL, DRAG, WIND, true>(highp_dvec3*); \
+    LEVEL_KERNEL_TILED(PREFIX, LEVEL, DRAG, WIND, false) \
+    LEVEL_KERNEL_TILED(PREFIX, LEVEL, DRAG, WIND, true) \
+    PREFIX template void SpringSystem::PaddedPiecesT<LEVEL, DRAG, WIND>(int, int); \
+    PREFIX template void SpringSystem::PaddedForcesT<LEVEL, DRAG, WIND, false>(highp_dvec3*); \
+    PREFIX template void SpringSystem::PaddedForcesT<LEVEL, DRAG, WIND, true>(highp_dvec3*); \
+    PREFIX template void SpringSystem::PaddedSumT<LEVEL, DRAG, WIND, false>( \
+        int, int, highp_dvec3*); \
+    PREFIX template void SpringSystem::PaddedSumT<LEVEL, DRAG, WIND, true>( \
+        int, int, highp_dvec3*);
+
+// Every kernel above for one level. PREFIX is empty to instantiate them and extern to
+// leave them to the file that does.
+#define LEVEL_KERNELS(PREFIX, LEVEL) \
+    LEVEL_KERNEL_FORCES(PREFIX, LEVEL, false, false) \
+    LEVEL_KERNEL_FORCES(PREFIX, LEVEL, false, true) \
+    LEVEL_KERNEL_FORCES(PREFIX, LEVEL, true, false) \
+    LEVEL_KERNEL_FORCES(PREFIX, LEVEL, true, true) \
+    PREFIX template void SpringSystem::PaddedGatherT<LEVEL>(int, int); \
+    PREFIX template void SpringSystem::IntegrateBandT<LEVEL, SYMPLECTIC_EULER, false>(int, int); \
+    PREFIX template void SpringSystem::IntegrateBandT<LEVEL, SYMPLECTIC_EULER, true>(int, int); \
+    PREFIX template void SpringSystem::IntegrateBandT<LEVEL, EXPLICIT_EULER, false>(int, int); \
+    PREFIX template void SpringSystem::IntegrateBandT<LEVEL, EXPLICIT_EULER, true>(int, int); \
+    PREFIX template void SpringSystem::QuadNormalsT<LEVEL>(int, int); \
+    PREFIX template void SpringSystem::GatherNormalsT<LEVEL>(int, int); \
+    PREFIX template void SpringSystem::CollideSpheresT<LEVEL>(Sphere*, int);
+
+#endif  // SRC_INCLUDE_LEVEL_KERNELS_H_
@@ -0,0 +1,88 @@
+#ifndef SRC_INCLUDE_MIXED_SPRING_SYSTEM_H_
+#define SRC_INCLUDE_MIXED_SPRING_SYSTEM_H_
+
+#include "include/spring_system.h"
+
+// nodes are grouped into MIXED_TILE x MIXED_TILE tiles sharing one double origin
+#define MIXED_TILE 32
+// a tile whose first node is further than this from the tile origin gets a new origin
+#define REBASE_DISTANCE 1.0
+
+// x, y and z of a run of float vectors, each in its own array
+struct FloatSoA {
+    void Resize(int n) {
+        x.assign(n, 0);
+        y.assign(n, 0);
+        z.assign(n, 0);
+    }
+
+    vector<float> x;
+    vector<float> y;
+    vector<float> z;
+};
+
+// Mixed precision copy of a SpringSystem for long runs and big cloths, where the doubles
+// cost twice the memory traffic. Positions are float offsets from a double origin per
+// tile, so they keep float precision relative to the tile wherever the cloth goes, and
+// velocities and forces are floats. The velocity and position updates, the two sums
+// that run for the whole simulation, are Kahan compensated: the rounding error of every
+// step is kept per node and fed into the next one. The force pass reads 24 bytes per
+// node instead of 48 and works on floats throughout.
+//
+// Load copies the state and parameters (springs, drag, wind, pinning) of a SpringSystem,
+// Step advances it with symplectic Euler, and Store writes the positions back, e.g. for
+// drawing. Masks, strain limiting and the other integrators are not supported.
+class MixedSpringSystem {
+    public:
+        MixedSpringSystem();
+
+        void Load(SpringSystem& ss);
+        void Store(SpringSystem& ss);
+        void Step(double dt);
+        // every sphere is treated as kinematic
+        void HandleCollisions(vector<Sphere>& spheres);
+
+        void Clear() { dimX_ = dimY_ = 0; }
+        bool Loaded() { return dimX_ > 0; }
+        // without compensation the offsets and velocities are plain float sums
+        void Compensated(bool c) { compensated_ = c; }
+        bool Compensated() { return compensated_; }
+        highp_dvec3 Position(int r, int c);
+        int DimX() { return dimX_; }
+        int DimY() { return dimY_; }
+
+    private:
+        int Tile(int r, int c) { return (r / MIXED_TILE) * tilesX_ + c / MIXED_TILE; }
+        void ComputeForces();
+        void Rebase();
+
+        int dimX_;
+        int dimY_;
+        int tilesX_;
+        double ks_;
+        double kd_;
+        double restLength_;
+        double mass_;
+        bool drag_;
+        bool stuck_;
+        highp_dvec3 wind_;
+        bool compensated_;
+
+        vector<highp_dvec3> origins_;
+        FloatSoA offsets_;
+        FloatSoA vel_;
+        // what the Kahan sums of the offsets and velocities lost so far
+        FloatSoA compensation_;
+        FloatSoA velCompensation_;
+        FloatSoA forces_;
+
+        // positions in the frame of tile 0 for the force pass, and the forces of the
+        // springs to the node above / left of each node and of the drag triangles
+        FloatSoA local_;
+        FloatSoA vertical_;
+        FloatSoA horizontal_;
+        FloatSoA tri1_;
+        FloatSoA tri2_;
+};
+
+#endif  // SRC_INCLUDE_MIXED_SPRING_SYSTEM_H_
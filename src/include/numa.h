@@ -0,0 +1,36 @@
+#ifndef SRC_INCLUDE_NUMA_H_
+#define SRC_INCLUDE_NUMA_H_
+
+#include <cstddef>
+#include <vector>
+
+// Where the CPUs and the memory of a machine with several NUMA nodes (sockets) are, and
+// pinning threads to CPUs. Everything reads Linux's /sys and syscalls; elsewhere the
+// machine is one node and pinning does nothing.
+
+// the CPUs of each NUMA node, one node with every CPU if the machine doesn't say
+std::vector<std::vector<int> > NumaNodes();
+// the NUMA node of a CPU, 0 if unknown
+int CpuNumaNode(int cpu);
+// the CPU the calling thread runs on, -1 if unknown
+int CurrentCpu();
+
+// The CPUs for numThreads threads, thread t goes to cpus[t]. CLOTH_AFFINITY picks them:
+// "compact" (the default) fills one NUMA node before the next so neighbouring row bands
+// share a node, "spread" deals the threads out over the nodes in turn, "none" leaves
+// them to the scheduler (an empty list) and a list like "0-7,16-23" names the CPUs,
+// used in turn.
+std::vector<int> AffinityCpus(int numThreads);
+// pins the calling thread to a CPU, false if the OS won't
+bool PinThread(int cpu);
+// Pins thread t of the OpenMP team to cpus[t], nothing if cpus is empty. OpenMP keeps
+// its threads from one parallel region to the next, so they stay pinned until the
+// thread count changes.
+void PinOpenMPThreads(const std::vector<int>& cpus);
+
+// the NUMA node the page holding p is on, -1 if unknown or not touched yet
+int PageNumaNode(const void* p);
+// moves the whole pages of [p, p + bytes) to the NUMA node of the calling thread
+void MoveToThisNode(void* p, size_t bytes);
+
+#endif  // SRC_INCLUDE_NUMA_H_
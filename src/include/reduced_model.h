@@ -0,0 +1,57 @@
+#ifndef SRC_INCLUDE_REDUCED_MODEL_H_
+#define SRC_INCLUDE_REDUCED_MODEL_H_
+
+#include "include/spring_system.h"
+
+// Reduced order (subspace) dynamics for background cloth with small deformations.
+// A PCA basis U is built from recorded snapshots of the full simulation, and the
+// forces are linearized around the mean shape and projected into the basis once:
+//     q'' = (f0 + K q + D q') / m,    x = mean + U q
+// so a step costs O(k^2) for k modes no matter how many nodes the cloth has. Only
+// Reconstruct touches every node, as one parallel matrix-vector product.
+class ReducedModel {
+    public:
+        ReducedModel();
+        ReducedModel(int maxSnapshots);
+
+        // Snapshots are only taken while recording, so a cloth that never goes reduced
+        // doesn't pay for them. Turning it off or building drops the snapshots.
+        void Recording(bool r);
+        bool Recording() { return recording_; }
+        void Record(SpringSystem& ss);
+        void ClearSnapshots() { snapshots_.clear(); }
+        int NumSnapshots() { return snapshots_.size(); }
+
+        bool Build(SpringSystem& ss, int numModes);
+        void Project(SpringSystem& ss);
+        void Step(double dt);
+        void Reconstruct(SpringSystem& ss);
+
+        void Clear() { numModes_ = 0; }
+        int NumModes() { return numModes_; }
+        bool Built() { return numModes_ > 0; }
+
+    private:
+        void Forces(SpringSystem& ss, const vector<double>& x, const vector<double>& v,
+                    vector<double>& reduced);
+
+        int maxSnapshots_;
+        bool recording_;
+        vector<vector<double> > snapshots_;
+
+        int numDofs_;
+        int numModes_;
+        double mass_;
+        vector<double> mean_;
+        // numDofs_ x numModes_, row major so each node's rows are contiguous
+        vector<double> basis_;
+        vector<double> f0_;
+        // numModes_ x numModes_ reduced stiffness and damping
+        vector<double> K_;
+        vector<double> D_;
+
+        vector<double> q_;
+        vector<double> qd_;
+};
+
+#endif  // SRC_INCLUDE_REDUCED_MODEL_H_
@@ -0,0 +1,97 @@
+#ifndef SRC_INCLUDE_SIM_THREAD_H_
+#define SRC_INCLUDE_SIM_THREAD_H_
+
+#include "include/utils.h"
+#include "include/spring_system.h"
+#include "include/reduced_model.h"
+#include "include/mixed_spring_system.h"
+#include "include/triple_buffer.h"
+#include "include/spsc_queue.h"
+#include "include/fixed_timestep.h"
+#include "include/substep_scheduler.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// cloth frames (StepCloth calls) per second of wall clock time
+#define SIM_RATE 60
+// frames a slow machine may take to catch up before it drops time
+#define SIM_MAX_STEPS 4
+
+// what the renderer needs of one simulated frame and the one before it
+struct ClothFrame {
+    // draws between the previous and the current frame, alpha going from 0 to 1
+    void Interpolate(float alpha, vector<vec3>& outPositions, vector<mat4>& outSpheres) const;
+
+    // node positions in storage order, see SpringSystem::CopyPositions
+    vector<vec3> positions;
+    vector<mat4> spheres;
+    vector<vec3> previous;
+    vector<mat4> previousSpheres;
+    // steady clock seconds the current frame belongs to
+    double time;
+};
+
+// one frame of the cloth: the kinematic spheres move by frameDt and the cloth (full,
+// reduced or mixed precision) takes its substeps together with the dynamic spheres, as
+// many as the scheduler plans
+void StepCloth(SpringSystem& ss, vector<Sphere>& spheres, ReducedModel& reduced,
+               MixedSpringSystem& mixed, SubstepScheduler& scheduler, float frameDt);
+
+// the keys that only change simulation parameters and sphere motion, true if the
+// event was one of them
+bool HandleSimInput(const SDL_Event& event, SpringSystem& ss, vector<Sphere>& spheres,
+                    SubstepScheduler& scheduler);
+
+// Steps the cloth on its own thread at SIM_RATE frames per second of wall clock time, so
+// rendering and input never wait for the substeps and a slow frame on either side doesn't
+// slow down the other. Every frame is published through a triple buffer the render
+// thread reads with Frame() and draws one frame behind, at Alpha() of the way from the
+// previous to the current one, so the motion is smooth at any display rate. Input events
+// go the other way through a queue with Post(), both lock free.
+//
+// Changes to the structure of the cloth (layout, mask, reduced or mixed mode, drape)
+// rebuild GL buffers and must run on the render thread; it holds Mutex() while making
+// them, which the simulation thread also holds for every frame.
+class SimThread {
+    public:
+        SimThread(SpringSystem& ss, vector<Sphere>& spheres, ReducedModel& reduced,
+                  MixedSpringSystem& mixed, SubstepScheduler& scheduler);
+        ~SimThread();
+
+        void Start();
+        void Stop();
+
+        // false if the queue is full and the event was dropped
+        bool Post(const SDL_Event& event) { return events_.Push(event); }
+        std::mutex& Mutex() { return mutex_; }
+        // the newest published frame
+        const ClothFrame& Frame() {
+            frames_.Update();
+            return frames_.Front();
+        }
+        // where to draw between the previous and the current state of frame, the renderer
+        // stays one frame behind the simulation so it always has both
+        float Alpha(const ClothFrame& frame);
+        // publishes the cloth as it is now, with Mutex() held after a structural change
+        // so the renderer doesn't draw one more frame in the old layout
+        void Publish();
+
+    private:
+        void Run();
+        void Capture(vector<vec3>& positions, vector<mat4>& spheres);
+
+        SpringSystem& ss_;
+        vector<Sphere>& spheres_;
+        ReducedModel& reduced_;
+        MixedSpringSystem& mixed_;
+        SubstepScheduler& scheduler_;
+
+        std::thread thread_;
+        std::atomic<bool> running_;
+        std::mutex mutex_;
+        TripleBuffer<ClothFrame> frames_;
+        SpscQueue<SDL_Event, 256> events_;
+};
+
+#endif  // SRC_INCLUDE_SIM_THREAD_H_
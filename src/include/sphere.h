@@ -1,20 +1,25 @@
 #ifndef SRC_INCLUDE_SPHERE_H_
 #define SRC_INCLUDE_SPHERE_H_
 
-#include "include/utils.h"
+#include "include/common.h"
 
 class Sphere {
     public:
         Sphere();
         Sphere(glm::vec3 pos, float r);
+        Sphere(glm::vec3 pos, float r, float m);
         ~Sphere();
 
         void Update(float dt);
+        void ApplyImpulse(glm::vec3 j);
+        bool Dynamic() { return mass > 0; }
         glm::mat4 GetModelMatrix();
 
         glm::vec3 position;
         glm::vec3 velocity;
         float radius;
+        // 0 means the sphere is kinematic (infinite mass) and only moves by its velocity
+        float mass;
 };
 
 #endif  // SRC_INCLUDE_SPHERE_H_
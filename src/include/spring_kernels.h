@@ -0,0 +1,65 @@
+#ifndef SRC_INCLUDE_SPRING_KERNELS_H_
+#define SRC_INCLUDE_SPRING_KERNELS_H_
+
+// Integration kernel of SpringSystem and the per node helpers of the step kernels. It
+// lives in a header so FixedSpringSystem can instantiate it for its own grid size: NUM_NODES is 0 for a grid whose size is only
+// known at run time, otherwise it is the node count and the loop bound is a constant.
+
+#include "include/spring_system.h"
+#include "include/spring_law.h"
+
+// grids smaller than this are stepped on one thread, forking costs more than the work
+#define FIXED_PARALLEL_NODES 4096
+
+// what a kinematic sphere does to a node touching it
+static inline void CollideKinematic(Node& n, const Sphere& sphere) {
+    vec3 p = n.pos;
+    vec3 v = n.vel;
+    double d = glm::length(p - sphere.position);
+    if (d >= sphere.radius + COLLISION_RANGE)
+        return;
+    vec3 normal = glm::normalize(p - sphere.position);
+    vec3 bounce = dot(v, normal) * normal;
+    n.vel -= COLLISION_BOUNCE * bounce;
+    // n.pos += normal * (.2 + sphere.radius - d);
+    // n.vel = -n.vel;
+    n.pos = sphere.position + (COLLISION_OFFSET + sphere.radius) * normal;
+}
+
+// force of the spring from n2 to n1 on n1
+static inline highp_dvec3 SpringVector(const Node& n1, const Node& n2, double ks, double kd,
+                                       double rest) {
+    double l = length(n1.pos - n2.pos);
+    highp_dvec3 e = normalize(n1.pos - n2.pos);
+    double v1 = dot(e, n1.vel);
+    double v2 = dot(e, n2.vel);
+    return SpringForce(ks, kd, l, rest, v1, v2) * e;
+}
+
+// one node of a step, with the force on it
+template <Integrator INTEGRATOR, bool COLLIDE>
+static inline void IntegrateNode(Node& n, const highp_dvec3& force, double mass, double dt,
+                                 const Sphere* spheres, int numSpheres) {
+    if (INTEGRATOR == SYMPLECTIC_EULER) {
+        n.vel += force/mass * dt;
+        n.pos += n.vel * dt;
+    } else {
+        n.pos += n.vel * dt;
+        n.vel += force/mass * dt;
+    }
+    if (COLLIDE)
+        for (int s = 0; s < numSpheres; ++s)
+            CollideKinematic(n, spheres[s]);
+}
+
+template <Integrator INTEGRATOR, bool COLLIDE, bool MASKED, int NUM_NODES>
+void SpringSystem::IntegrateT(double dt, const Sphere* spheres, int numSpheres) {
+    const int count = MASKED ? activeNodes_.size() : (NUM_NODES > 0 ? NUM_NODES : numNodes_);
+    #pragma omp parallel for schedule(static) if (NUM_NODES == 0 || NUM_NODES >= FIXED_PARALLEL_NODES)
+    for (int k = 0; k < count; ++k) {
+        int i = MASKED ? activeNodes_[k] : k;
+        IntegrateNode<INTEGRATOR, COLLIDE>(nodes_[i], forces_[i], mass_, dt, spheres, numSpheres);
+    }
+}
+
+#endif  // SRC_INCLUDE_SPRING_KERNELS_H_
@@ -0,0 +1,19 @@
+#ifndef SRC_INCLUDE_SPRING_LAW_H_
+#define SRC_INCLUDE_SPRING_LAW_H_
+
+#define GRAVITY highp_dvec3(0, -9.81, 0)
+
+// nodes closer than radius + COLLISION_RANGE to a sphere are pushed out to
+// radius + COLLISION_OFFSET and lose COLLISION_BOUNCE times their normal velocity
+#define COLLISION_RANGE .09
+#define COLLISION_OFFSET .1
+#define COLLISION_BOUNCE 1.5
+
+// Damped spring force along the unit vector e from node 2 to node 1, where l is the
+// current length and v1, v2 are the node velocities projected onto e. Written on plain
+// doubles so SIMD loops can evaluate it one lane at a time.
+inline double SpringForce(double ks, double kd, double l, double rest, double v1, double v2) {
+    return -ks*(l - rest) - kd*(v1 - v2);
+}
+
+#endif  // SRC_INCLUDE_SPRING_LAW_H_
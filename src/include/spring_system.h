@@ -1,9 +1,11 @@
 #ifndef SRC_INCLUDE_SPRING_SYSTEM_H_
 #define SRC_INCLUDE_SPRING_SYSTEM_H_
 
-#include "include/utils.h"
-#include "include/glsl_shader.h"
+#include "include/common.h"
 #include "include/sphere.h"
+#include "include/task_pool.h"
+#include "include/cpu_features.h"
+#include "include/aligned_allocator.h"
 
 typedef struct Node {
     Node() {
@@ -27,17 +29,84 @@ typedef struct Node {
 #define CLOTH_INDICES 3
 #define CLOTH_TOTAL_VBOS 4
 
+// Order of the nodes in memory. Row major keeps vertical neighbours a whole row apart,
+// MORTON orders the whole grid along a Z curve (padded up to the enclosing power of two
+// square, so best for square grids) and BLOCKED_MORTON stores row major 8x8 blocks
+// along a Z curve, so both neighbours of most nodes share a 3KB block and runs of 8
+// nodes stay contiguous for the row loops. PADDED is row major with a border of ghost
+// nodes around the grid and every row padded to a multiple of 8 nodes, so the force
+// kernel runs the same loop over every node (see padStride_).
+enum NodeLayout {
+    ROW_MAJOR,
+    MORTON,
+    BLOCKED_MORTON,
+    PADDED
+};
+
+// x, y and z of a run of vectors, each in its own array starting on a cache line
+struct SoA {
+    typedef vector<double, AlignedAllocator<double, SIMD_ALIGN> > Array;
+
+    void Resize(int n) {
+        x.assign(n, 0);
+        y.assign(n, 0);
+        z.assign(n, 0);
+    }
+
+    Array x;
+    Array y;
+    Array z;
+};
+
+enum Integrator {
+    SYMPLECTIC_EULER,
+    EXPLICIT_EULER
+};
+
+// the OpenGL objects of a SpringSystem, only spring_system_gl.cpp knows them
+struct ClothGL;
+
 class SpringSystem {
     public:
         SpringSystem();
         SpringSystem(int dimx, int dimy, double ks, double kd);
+        SpringSystem(int dimx, int dimy, double ks, double kd, double restLength, double mass);
+        virtual ~SpringSystem();
+        // the nodes, graphs and render arrays are owned by the SpringSystem
+        SpringSystem(const SpringSystem&) = delete;
+        SpringSystem& operator=(const SpringSystem&) = delete;
         void Setup();
+        // Setup without OpenGL, for running without a window. The simulation is in its
+        // own library (libcloth) and the drawing in spring_system_gl.cpp, which only the
+        // windowed program links.
+        void SimSetup();
         void SpringSetup(bool vertical);
+        // the vertex, normal, tex coord and index arrays, GLSetup does this too
+        void RenderSetup();
         void GLSetup();
         void Update(double dt);
+        // step followed by collisions with the spheres. If that can be done node by node
+        // the collisions are folded into the integration loop.
+        void Update(double dt, vector<Sphere>& spheres);
+        virtual void ComputeForces(highp_dvec3* forces);
+        void LimitStrain(double dt);
         void Render(const mat4& V, const mat4& P);
+        // draws the cloth with positions from CopyPositions instead of the nodes, so it
+        // can be drawn while another thread steps it
+        void Render(const mat4& V, const mat4& P, const vector<vec3>& positions);
+        // node positions in storage order
+        void CopyPositions(vector<vec3>& positions);
         void HandleCollisions(Sphere& sphere);
-        Node& GetNode(int r, int c) { return nodes_[r*dimX_ + c]; }
+        void HandleCollisions(vector<Sphere>& spheres);
+        void HandleCollisions(Sphere* spheres, int numSpheres);
+        Node& GetNode(int r, int c) { return nodes_[NodeIndex(r, c)]; }
+        // where node (r, c) is stored. The per row and per column offsets add up to the
+        // index for every layout.
+        int NodeIndex(int r, int c) { return rowOffset_[r] + colOffset_[c]; }
+        // size of the node storage, more than DimX() * DimY() if the layout pads the grid
+        int NumStorageNodes() { return numNodes_; }
+        virtual void SetLayout(NodeLayout layout);
+        NodeLayout Layout() { return layout_; }
 
         void ChangeVizualization() { textured_ = !textured_; }
         void Pause() { paused_ = !paused_; }
@@ -47,15 +116,155 @@ class SpringSystem {
         int DimY() { return dimY_; }
         void Drag(bool d) { drag_ = d; }
         bool Drag() { return drag_; }
+        // the wind as a force on each node, and the air velocity the drag works against
+        highp_dvec3 WindVector() { return wind_ * wind; }
 
+        double GetMass() { return mass_; }
+        double GetRestLength() { return restLength_; }
         double GetKS() { return KS_; }
         double GetKD() { return KD_; }
         void SetKS(double ks) { KS_ = ks; }
         void SetKD(double kd) { KD_ = kd; }
 
+        void StrainLimit(bool s) { strainLimit_ = s; }
+        bool StrainLimit() { return strainLimit_; }
+        void SetStretchRange(double minStretch, double maxStretch) {
+            minStretch_ = minStretch;
+            maxStretch_ = maxStretch;
+        }
+        void SetStrainIterations(int iters) { strainIterations_ = iters; }
+        void SetIntegrator(Integrator integrator) { integrator_ = integrator; }
+
+        // Tiled mode steps the grid one tile at a time through every phase (forces, drag,
+        // springs, integration and fused collisions) before moving on to the next tile,
+        // so each step streams the nodes from memory once instead of once per phase.
+        // Meant for grids too big for the caches, about 512x512 and up.
+        void Tiled(bool t);
+        bool Tiled() { return tiled_; }
+        void SetTileSize(int rows, int cols) {
+            tileRows_ = rows;
+            tileCols_ = cols;
+        }
+        int TileRows() { return tileRows_; }
+        int TileCols() { return tileCols_; }
+        // OpenMP threads the step runs on, 0 (the default) for as many as OpenMP gives it
+        void Threads(int n) { threads_ = n; }
+        int Threads() { return threads_; }
+        // the instruction set of the hot kernels, KernelLevel() to start with
+        void Isa(CpuLevel level) { level_ = level; }
+        CpuLevel Isa() { return level_; }
+        // With auto tuning Setup times the ways of stepping a grid this size and keeps the
+        // fastest (TuneStep in auto_tune.h).
+        void AutoTune(bool a) { autoTune_ = a; }
+        bool AutoTune() { return autoTune_; }
+        Integrator GetIntegrator() { return integrator_; }
+
+        // With a pool the step of a PADDED cloth without a mask and the normals and
+        // vertex data of any cloth without one run as task graphs on it: the grid is cut
+        // into bands of rows and each band goes on to its next phase as soon as the bands
+        // next to it are through the one it needs, instead of every thread waiting for
+        // all the others at the end of each phase. nullptr goes back to OpenMP. The
+        // results are the same either way.
+        void Pool(TaskPool* pool) { pool_ = pool; }
+        TaskPool* Pool() { return pool_; }
+        // The normals graph runs on this pool instead if set. A thread drawing the cloth
+        // while another one steps it needs a pool of its own: waiting on a shared pool it
+        // would pick up the step's tasks too.
+        void NormalsPool(TaskPool* pool) { normalsPool_ = pool; }
+
+        // For huge cloths on machines with several NUMA nodes. Pins the OpenMP threads to
+        // the CPUs AffinityCpus (numa.h) picks and moves each thread's band of rows of the
+        // nodes, forces and SoA copies to the memory of its node. The PADDED step keeps
+        // every thread on its own band (RowBand) through all the phases, the tiled step
+        // hands out its tiles in row order so each thread's tiles are about its band.
+        // Stays on through layout changes.
+        void NumaBands(bool n);
+        bool NumaBands() { return numaBands_; }
+
+        // Storage for n nodes, rowLength to a row, all at the origin. Every page is first
+        // touched by the OpenMP thread whose row band it falls in, so it ends up on that
+        // thread's NUMA node. FreeNodes releases it.
+        static Node* AllocateNodes(int n, int rowLength);
+        static void FreeNodes(Node* nodes);
+        // rows [begin, end) of band part of parts
+        static void RowBand(int rows, int part, int parts, int& begin, int& end) {
+            begin = (long long) rows * part / parts;
+            end = (long long) rows * (part + 1) / parts;
+        }
+
+        // Cuts holes and outlines into the cloth. nodeMask has dimX * dimY entries and a
+        // node takes part in the simulation and drawing only if its entry is non zero.
+        // The optional spring masks ((dimY - 1) * dimX vertical springs below each node,
+        // dimY * (dimX - 1) horizontal springs right of each node) cut single springs;
+        // a spring is always cut if either of its nodes is masked out. An all ones mask
+        // moves the cloth like no mask only up to rounding, the colored passes add up
+        // each node's forces in another order.
+        void SetMask(const vector<unsigned char>& nodeMask,
+                     const vector<unsigned char>& verticalMask = vector<unsigned char>(),
+                     const vector<unsigned char>& horizontalMask = vector<unsigned char>());
+        void ClearMask();
+        bool Masked() { return masked_; }
+        bool NodeActive(int r, int c) { return !masked_ || nodeMask_[r*dimX_ + c]; }
+        int NumActiveNodes() { return masked_ ? activeNodes_.size() : dimX_ * dimY_; }
+
         bool stuck;
         double wind;
-    private:
+    protected:
+        // nodes live in storage owned by the caller (see FixedSpringSystem)
+        SpringSystem(int dimx, int dimy, double ks, double kd, double restLength, double mass,
+                     Node* nodes);
+
+        // The step kernels are instantiated for every combination of the features they
+        // support and the matching one is picked once per step, so a disabled feature
+        // costs nothing in the node loops.
+        // The ones with a CpuLevel are in level_kernels.h and also instantiated for every
+        // level.
+        template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+        void ComputeForcesT(highp_dvec3* forces);
+        template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+        void PaddedForcesT(highp_dvec3* forces);
+        // the phases of PaddedForcesT over a range of storage indices or rows
+        template <CpuLevel LEVEL>
+        void PaddedGatherT(int begin, int end);
+        template <CpuLevel LEVEL, bool DRAG, bool WIND>
+        void PaddedPiecesT(int begin, int end);
+        template <CpuLevel LEVEL, bool DRAG, bool WIND, bool PINNED>
+        void PaddedSumT(int rowBegin, int rowEnd, highp_dvec3* forces);
+        template <Integrator INTEGRATOR, bool COLLIDE, bool MASKED, int NUM_NODES>
+        void IntegrateT(double dt, const Sphere* spheres, int numSpheres);
+        virtual void Integrate(double dt, const Sphere* spheres, int numSpheres);
+        void Step(double dt, const Sphere* spheres, int numSpheres);
+        template <CpuLevel LEVEL, bool DRAG, bool WIND, bool COLLIDE, Integrator INTEGRATOR>
+        void TiledStepT(double dt, const Sphere* spheres, int numSpheres);
+        template <bool DRAG, bool WIND, bool PINNED>
+        void ComputeMaskedForcesT(highp_dvec3* forces);
+        // the task graph versions of Step and of the normals (see Pool)
+        int NumBands(TaskPool& pool, int rows);
+        void GraphStep(double dt, const Sphere* spheres, int numSpheres);
+        template <CpuLevel LEVEL, Integrator INTEGRATOR, bool COLLIDE>
+        void IntegrateBandT(int begin, int end);
+        // posArray_ from source (the nodes if nullptr) and the normals from posArray_
+        void PrepareUpload(const vec3* source);
+        void GraphNormals(const vec3* source);
+        // the phases of GraphNormals over a band of rows
+        void UploadRows(int rowBegin, int rowEnd);
+        template <CpuLevel LEVEL>
+        void QuadNormalsT(int rowBegin, int rowEnd);
+        template <CpuLevel LEVEL>
+        void GatherNormalsT(int rowBegin, int rowEnd);
+        template <CpuLevel LEVEL>
+        void CollideSpheresT(Sphere* spheres, int numSpheres);
+        void PlaceBands();
+        // nodes to a row of storage, rows only mean something for ROW_MAJOR and PADDED
+        int StorageRowLength() { return layout_ == PADDED ? padStride_ : dimX_; }
+        void BuildRenderIndices();
+        // the vertex buffers from posArray_ and normals_
+        void UploadPositions();
+        void UploadRenderData();
+        void Draw(const mat4& V, const mat4& P);
+        void FillTexCoords();
+        void SetupGhosts();
+
         highp_dvec3 wind_;
         bool drag_;
         int dimX_;
@@ -63,12 +272,92 @@ class SpringSystem {
         double KS_;
         double KD_;
         Node* nodes_;
+        // the storage the nodes were given by a derived class, which frees it, nullptr if
+        // they came from AllocateNodes. The tiled step may swap it into next_.
+        Node* callerNodes_;
+        vector<highp_dvec3> forces_;
+        // the drag of each quad and the force of each spring, see ComputeForcesT
+        vector<highp_dvec3> forcePieces_;
+
+        // The tiled step writes the new state to next_ and swaps it with nodes_. Each
+        // thread works out the drag of the quads and the forces of the springs touching
+        // its tile (one node of halo on every side) in its own scratch, then adds them
+        // up per node in the order ComputeForces does.
+        bool tiled_;
+        int tileRows_;
+        int tileCols_;
+        Node* next_;
+        vector<highp_dvec3> tileScratch_;
 
         double initDX_;
         double initDY_;
         double mass_;
         double restLength_;
 
+        Integrator integrator_;
+        bool strainLimit_;
+        double minStretch_;
+        double maxStretch_;
+        int strainIterations_;
+
+        NodeLayout layout_;
+        vector<int> rowOffset_;
+        vector<int> colOffset_;
+
+        // With the PADDED layout every storage row is padStride_ nodes. The ghosts are
+        // parked far from the cloth, each at its own spot, and the springs and quads that
+        // touch one get zero stiffness and drag through these weights, so a spring or
+        // quad is computed for every storage index and none of the loops has a boundary.
+        int padStride_;
+        vector<double> verticalWeight_;
+        vector<double> horizontalWeight_;
+        vector<double> quadWeight_;
+        SoA padPos_;
+        SoA padVel_;
+        SoA padTri1_;
+        SoA padTri2_;
+        SoA padVertical_;
+        SoA padHorizontal_;
+
+        // The graphs are built for one kernel and band count (their keys) and rebuilt when
+        // either changes. The arguments of the step being run and the positions being
+        // uploaded are passed to the band kernels through the members after them. Each quad's
+        // two triangle normals go to quadNormals_ and every node adds up its own.
+        TaskPool* pool_;
+        TaskPool* normalsPool_;
+        TaskGraph* stepGraph_;
+        int stepGraphKey_;
+        TaskGraph* normalsGraph_;
+        int normalsGraphKey_;
+        double stepDt_;
+        const Sphere* stepSpheres_;
+        int stepNumSpheres_;
+        const vec3* uploadSource_;
+        vector<vec3> quadNormals_;
+
+        bool numaBands_;
+        bool autoTune_;
+        int threads_;
+        CpuLevel level_;
+
+        // With a mask every loop runs over compacted lists of what is left, so masked out
+        // parts cost nothing and the work is split evenly between threads. Springs and
+        // quads are split into 4 colors each whose members share no node, so each color
+        // is processed in parallel without races. Colors 0 and 1 are vertical springs,
+        // 2 and 3 horizontal ones. The lists hold storage indices: both ends of every
+        // spring, and ul, ll, ur, lr of every quad. The first pinnedSprings_ springs of a
+        // color start on the top row. The masks are kept to rebuild the lists.
+        bool masked_;
+        vector<unsigned char> nodeMask_;
+        vector<unsigned char> verticalMask_;
+        vector<unsigned char> horizontalMask_;
+        vector<int> activeNodes_;
+        vector<int> springs_[4];
+        int pinnedSprings_[4];
+        // which of the two triangles of each quad are present
+        vector<int> quads_[4];
+        vector<unsigned char> quadTris_[4];
+
         bool textured_;
         bool paused_;
 
@@ -79,17 +368,16 @@ class SpringSystem {
         vec2* texCoords_;
         unsigned int* indices_;
         vector<unsigned int> spring_indices_;
+        // per thread impulses on each sphere and its deepest push, combined after the
+        // collision pass
+        vector<highp_dvec3> sphereImpulses_;
 
-        // opengl shit
-        GLSLShader cloth_shader_;
-        GLSLShader spring_shader_;
-        GLint cloth_texture_;
-        GLuint cloth_vao_;
-        GLuint cloth_vbos_[CLOTH_TOTAL_VBOS];
-        GLuint cube_vao_;
-        GLuint cube_vbo_;
-        GLuint spring_vao_;
-        GLuint spring_vbo_;
+        // opengl shit, made by GLSetup. The index and tex coord buffers are uploaded
+        // again before the next draw once renderDataChanged_ says they are out of date.
+        ClothGL* gl_;
+        // frees gl_, set by GLSetup since only spring_system_gl.cpp knows what a ClothGL is
+        void (*glDeleter_)(ClothGL*);
+        bool renderDataChanged_;
 };
 
 #endif  // SRC_INCLUDE_SPRING_SYSTEM_H_
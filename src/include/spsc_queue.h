@@ -0,0 +1,46 @@
+#ifndef SRC_INCLUDE_SPSC_QUEUE_H_
+#define SRC_INCLUDE_SPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+
+// Lock free ring buffer of at most N values (a power of two) from one producer thread to
+// one consumer thread. Push fails when the queue is full and Pop when it is empty, the
+// caller decides what to do about it. The two counters only ever grow and live on their
+// own cache lines, so the threads don't fight over one line on every call.
+template <typename T, int N>
+class SpscQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+    public:
+        SpscQueue() : head_(0), tail_(0) {}
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // producer side
+        bool Push(const T& value) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - head_.load(std::memory_order_acquire) == N)
+                return false;
+            items_[tail & (N - 1)] = value;
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side
+        bool Pop(T& value) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_.load(std::memory_order_acquire))
+                return false;
+            value = items_[head & (N - 1)];
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+        T items_[N];
+};
+
+#endif  // SRC_INCLUDE_SPSC_QUEUE_H_
@@ -0,0 +1,80 @@
+#ifndef SRC_INCLUDE_STRAND_SYSTEM_H_
+#define SRC_INCLUDE_STRAND_SYSTEM_H_
+
+#include "include/utils.h"
+#include "include/glsl_shader.h"
+#include "include/sphere.h"
+
+// number of strands advanced together by one SIMD instruction
+#define STRAND_LANES 8
+
+#define STRAND_PX 0
+#define STRAND_PY 1
+#define STRAND_PZ 2
+#define STRAND_VX 3
+#define STRAND_VY 4
+#define STRAND_VZ 5
+#define STRAND_COMPONENTS 6
+
+// Ropes / hair as chains of nodes joined by the same damped springs as the cloth. The
+// strands are grouped into blocks of STRAND_LANES and stored AoSoA: for every node of a
+// block each component is a row of STRAND_LANES doubles, one per strand, so the inner
+// loops run across strands instead of along them.
+class StrandSystem {
+    public:
+        StrandSystem();
+        StrandSystem(int numStrands, int nodesPerStrand, double ks, double kd);
+        ~StrandSystem();
+        StrandSystem(const StrandSystem&) = delete;
+        StrandSystem& operator=(const StrandSystem&) = delete;
+        void Setup();
+        void StrandSetup();
+        void GLSetup();
+        void Update(double dt);
+        void Render(const mat4& V, const mat4& P);
+        void HandleCollisions(Sphere& sphere);
+        void HandleCollisions(vector<Sphere>& spheres);
+
+        highp_dvec3 GetNode(int strand, int i);
+        void SetRoot(int strand, highp_dvec3 pos);
+        void UpdateGPUPositions();
+
+        int NumStrands() { return numStrands_; }
+        int NodesPerStrand() { return nodesPerStrand_; }
+        void Pause() { paused_ = !paused_; }
+
+        double GetKS() { return KS_; }
+        double GetKD() { return KD_; }
+        void SetKS(double ks) { KS_ = ks; }
+        void SetKD(double kd) { KD_ = kd; }
+        void SetBendKS(double kb) { bendKS_ = kb; }
+
+    private:
+        double* Lane(int block, int node, int component) {
+            return &data_[((block * nodesPerStrand_ + node) * STRAND_COMPONENTS + component)
+                          * STRAND_LANES];
+        }
+
+        int numStrands_;
+        int numBlocks_;
+        int nodesPerStrand_;
+        double KS_;
+        double KD_;
+        double bendKS_;
+        double mass_;
+        double restLength_;
+        bool paused_;
+
+        double* data_;
+        // per thread force scratch for one block, 3 * nodesPerStrand_ lanes each
+        vector<double> forces_;
+
+        vec3* posArray_;
+        vector<unsigned int> indices_;
+
+        GLSLShader shader_;
+        GLuint vao_;
+        GLuint vbos_[2];
+};
+
+#endif  // SRC_INCLUDE_STRAND_SYSTEM_H_
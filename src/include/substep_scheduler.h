@@ -0,0 +1,91 @@
+#ifndef SRC_INCLUDE_SUBSTEP_SCHEDULER_H_
+#define SRC_INCLUDE_SUBSTEP_SCHEDULER_H_
+
+#include "include/spring_system.h"
+#include "include/reduced_model.h"
+#include "include/mixed_spring_system.h"
+#include <chrono>
+
+// seconds of CPU time a cloth frame may take
+#define FRAME_BUDGET 0.008
+// share of the budget the substeps are planned to fill, the rest absorbs noise
+#define BUDGET_HEADROOM 0.85
+// share of the budget a better level has to fit in before it is tried again
+#define UPGRADE_HEADROOM 0.6
+
+// the ways to step the cloth, from the most to the least expensive
+enum QualityLevel {
+    // double precision, 15 or more substeps
+    QUALITY_FULL,
+    // MixedSpringSystem, 15 substeps
+    QUALITY_MIXED,
+    // strain limiting keeps the cloth stable down to 3 substeps
+    QUALITY_STRAIN_LIMITED,
+    // ReducedModel built from the frames recorded while strain limited
+    QUALITY_REDUCED,
+    QUALITY_LEVELS
+};
+
+// Picks the quality level and substep count of every cloth frame so the frame fits in a
+// CPU time budget. The substeps (Update and HandleCollisions) and the rest of the frame
+// are timed with the steady clock and kept as running averages per level. Within a level
+// the substeps are as many as the budget allows, between the level's minimum and
+// maximum. When even the minimum doesn't fit the next cheaper level is switched to, and
+// after a second of frames within budget the next better one is tried again if its last
+// known cost fits well under the budget.
+//
+// While enabled it owns the strain limiting, mixed and reduced modes of the cloth.
+// Switches are printed as they happen and the level, substeps and frame times once a
+// second.
+class SubstepScheduler {
+    public:
+        SubstepScheduler(double budget);
+
+        void Enabled(bool e) { enabled_ = e; }
+        bool Enabled() { return enabled_; }
+        double Budget() { return budget_; }
+        QualityLevel Level() { return level_; }
+
+        // the substeps for the next frame, switching the cloth to another level first if
+        // the last frames call for it
+        int Plan(SpringSystem& ss, ReducedModel& reduced, MixedSpringSystem& mixed);
+        // around the frame that was planned, SubstepsDone right after the last substep
+        void StartFrame();
+        void SubstepsDone();
+        void EndFrame();
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        static double Seconds(Clock::duration d) { return std::chrono::duration<double>(d).count(); }
+        static QualityLevel Current(SpringSystem& ss, ReducedModel& reduced, MixedSpringSystem& mixed);
+        bool Available(QualityLevel level, SpringSystem& ss, ReducedModel& reduced);
+        bool Switch(QualityLevel level, SpringSystem& ss, ReducedModel& reduced, MixedSpringSystem& mixed);
+        // seconds a frame of n substeps is expected to take at a level, 0 if it never ran
+        double Expected(QualityLevel level, int n);
+        void Report();
+
+        bool enabled_;
+        double budget_;
+        QualityLevel level_;
+        int substeps_;
+        // running averages of the seconds per substep at each level and of the rest of the frame
+        double substepCost_[QUALITY_LEVELS];
+        double overhead_;
+        // since when the frames have been within budget
+        Clock::time_point calmStart_;
+        // the level changed and its cost is measured afresh
+        bool remeasure_;
+
+        Clock::time_point frameStart_;
+        Clock::time_point substepsEnd_;
+
+        // for the report
+        Clock::time_point reportStart_;
+        int frames_;
+        int overBudget_;
+        double frameTime_;
+        double maxFrameTime_;
+};
+
+#endif  // SRC_INCLUDE_SUBSTEP_SCHEDULER_H_
@@ -0,0 +1,57 @@
+#ifndef SRC_INCLUDE_SWEEP_H_
+#define SRC_INCLUDE_SWEEP_H_
+
+#include "include/spring_system.h"
+
+// One run of a parameter sweep: a cloth of its own stepped from the start state of
+// SimSetup, and what came out of it.
+struct SweepRun {
+    int dimX;
+    int dimY;
+    double ks;
+    double kd;
+    double dt;
+    int steps;
+
+    // no position went non-finite and no spring stretched past SWEEP_BLOWUP_STRAIN
+    bool stable;
+    // steps actually taken, fewer than steps if the cloth blew up
+    int stepsDone;
+    // largest (length / rest length - 1) of a structural spring seen
+    double maxStrain;
+    // simulated seconds from which the fastest node stayed slower than the settle speed
+    // to the end, -1 if it never settled
+    double settleTime;
+    double stepsPerSecond;
+};
+
+// a spring stretched this far past its rest length means the cloth blew up
+#define SWEEP_BLOWUP_STRAIN 10.0
+
+struct SweepOptions {
+    // threads running the runs, every core if 0
+    int jobs;
+    // the strain and node speeds are checked every sample steps
+    int sample;
+    // the cloth counts as settled once no node moves faster than this, in m/s
+    double settleSpeed;
+    NodeLayout layout;
+    bool drag;
+    bool pinned;
+    double wind;
+};
+
+// every combination of the sizes ("cols x rows" pairs), stiffnesses, dampings and time
+// steps, steps steps each
+vector<SweepRun> SweepGrid(const vector<std::pair<int, int> >& sizes, const vector<double>& ks,
+                           const vector<double>& kd, const vector<double>& dt, int steps);
+
+// Runs all of runs, each on one thread with a SpringSystem of its own, options.jobs of
+// them at a time. The threads take the next run as soon as they finish one, biggest
+// first, so the cores stay busy until the last few runs.
+void RunSweep(vector<SweepRun>& runs, const SweepOptions& options);
+
+// one line per run, false if the file can't be written
+bool WriteSweepCsv(const vector<SweepRun>& runs, const string& file);
+
+#endif  // SRC_INCLUDE_SWEEP_H_
@@ -0,0 +1,103 @@
+#ifndef SRC_INCLUDE_TASK_POOL_H_
+#define SRC_INCLUDE_TASK_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGraph;
+
+// Persistent worker threads for running TaskGraphs. Every worker has its own queue: it
+// takes the newest job from its own queue, whose data is still in its cache, and when
+// that is empty steals the oldest job from someone else's. Threads outside the pool
+// (the ones calling TaskGraph::Run) share one more queue and work on jobs until their
+// graph is done. A thread that finds no work sleeps on a condition variable instead of
+// spinning, so an idle pool costs nothing between phases or frames.
+class TaskPool {
+    public:
+        // numThreads - 1 workers, the thread running a graph is the last one
+        explicit TaskPool(int numThreads);
+        ~TaskPool();
+        TaskPool(const TaskPool&) = delete;
+        TaskPool& operator=(const TaskPool&) = delete;
+
+        int NumThreads() { return workers_.size() + 1; }
+
+    private:
+        friend class TaskGraph;
+
+        struct Job {
+            TaskGraph* graph;
+            int task;
+        };
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        void Push(const Job& job);
+        bool Pop(int queue, Job& job);
+        bool Steal(int thief, Job& job);
+        // runs one job, false if there was none
+        bool RunOne();
+        // works on jobs until remaining is 0
+        void Wait(const std::atomic<int>& remaining);
+        // a graph's last task is done, its thread may be asleep
+        void Finished();
+        void WorkerLoop(int index);
+
+        std::vector<std::thread> workers_;
+        // one per worker and the shared one of the outside threads last
+        std::vector<std::unique_ptr<Queue> > queues_;
+        // jobs in all queues
+        std::atomic<int> queued_;
+        std::mutex sleepMutex_;
+        std::condition_variable wake_;
+        bool stop_;
+};
+
+// Tasks and the order they have to run in. The graph is built once and run any number
+// of times: every run does each task exactly once, a task only after all the tasks
+// that precede it, and tasks without an order between them may run at the same time on
+// different threads. Tasks must not throw or wait for each other.
+class TaskGraph {
+    public:
+        TaskGraph();
+        TaskGraph(const TaskGraph&) = delete;
+        TaskGraph& operator=(const TaskGraph&) = delete;
+
+        // the new task's id
+        int Add(std::function<void()> task);
+        // after doesn't start before before is done
+        void Precede(int before, int after);
+        void Clear();
+        int Size() { return tasks_.size(); }
+
+        // returns when every task has run
+        void Run(TaskPool& pool);
+
+    private:
+        friend class TaskPool;
+
+        struct Task {
+            std::function<void()> run;
+            std::vector<int> successors;
+            int predecessors;
+        };
+
+        void Execute(int task);
+
+        std::vector<Task> tasks_;
+        // tasks each task still waits for in this run, and tasks not done yet
+        std::unique_ptr<std::atomic<int>[]> waiting_;
+        int waitingSize_;
+        std::atomic<int> remaining_;
+        TaskPool* pool_;
+};
+
+#endif  // SRC_INCLUDE_TASK_POOL_H_
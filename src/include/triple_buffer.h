@@ -0,0 +1,46 @@
+#ifndef SRC_INCLUDE_TRIPLE_BUFFER_H_
+#define SRC_INCLUDE_TRIPLE_BUFFER_H_
+
+#include <atomic>
+
+// Lock free handoff of the newest value from one producer thread to one consumer
+// thread. The producer fills Back() and publishes it, the consumer picks up the newest
+// published value with Update() and reads it from Front(). Neither side ever waits: the
+// third buffer sits in the middle and is swapped with the producer's or the consumer's
+// buffer in one atomic exchange, so values the consumer was too slow to see are simply
+// replaced by newer ones.
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() : middle_(Pack(1, false)), back_(2), front_(0) {}
+        TripleBuffer(const TripleBuffer&) = delete;
+        TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+        // producer side
+        T& Back() { return buffers_[back_]; }
+        void Publish() {
+            back_ = Index(middle_.exchange(Pack(back_, true), std::memory_order_acq_rel));
+        }
+
+        // consumer side, true if Front() changed
+        bool Update() {
+            if (!Fresh(middle_.load(std::memory_order_acquire)))
+                return false;
+            front_ = Index(middle_.exchange(Pack(front_, false), std::memory_order_acq_rel));
+            return true;
+        }
+        const T& Front() const { return buffers_[front_]; }
+
+    private:
+        // the middle buffer's index and whether it holds a value the consumer has not seen
+        static int Pack(int index, bool fresh) { return index | (fresh ? 4 : 0); }
+        static int Index(int packed) { return packed & 3; }
+        static bool Fresh(int packed) { return (packed & 4) != 0; }
+
+        T buffers_[3];
+        std::atomic<int> middle_;
+        int back_;
+        int front_;
+};
+
+#endif  // SRC_INCLUDE_TRIPLE_BUFFER_H_
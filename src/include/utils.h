@@ -4,26 +4,7 @@
 #include <GL/glew.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_opengl.h>
-#include "glm/glm.hpp"
-#include "glm/ext.hpp"
-#include <cstdlib>
-#include <iostream>
-#include <fstream>
-#include <string>
-#include <vector>
-
-using namespace glm;
-using namespace std;
-
-inline ostream& operator <<(ostream& out, const vec3& v) {
-    out << v.x << " " << v.y << " " << v.z;
-    return out;
-}
-
-inline ostream& operator <<(ostream& out, const vec4& v) {
-    out << v.x << " " << v.y << " " << v.z << " " << v.w;
-    return out;
-}
+#include "include/common.h"
 
 GLuint LoadTexture(string path);
 
@@ -0,0 +1,14 @@
+// The kernels of level_kernels.h compiled for CPU_AVX2. Only this file is built for the
+// wider instructions, they run if KernelLevel says the CPU has them.
+
+// everything the kernels use keeps the baseline target
+#include "include/spring_system.h"
+#include "include/spring_law.h"
+#include "include/spring_kernels.h"
+#include <omp.h>
+#include <algorithm>
+
+#pragma GCC target("avx2")
+#include "include/level_kernels.h"
+
+LEVEL_KERNELS(, CPU_AVX2)
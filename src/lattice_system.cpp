@@ -0,0 +1,263 @@
+#include "include/lattice_system.h"
+#include "include/spring_law.h"
+#include <omp.h>
+
+LatticeSystem::LatticeSystem() :
+    LatticeSystem(8, 8, 8, 300, 2) {}
+
+LatticeSystem::LatticeSystem(int dimx, int dimy, int dimz, double ks, double kd) {
+    dimX_ = dimx;
+    dimY_ = dimy;
+    dimZ_ = dimz;
+    tilesX_ = (dimX_ + LATTICE_TILE - 1) / LATTICE_TILE;
+    tilesY_ = (dimY_ + LATTICE_TILE - 1) / LATTICE_TILE;
+    tilesZ_ = (dimZ_ + LATTICE_TILE - 1) / LATTICE_TILE;
+    numSlots_ = tilesX_ * tilesY_ * tilesZ_ * LATTICE_TILE_NODES;
+    nodes_ = new Node[numSlots_];
+    next_ = new Node[numSlots_];
+    posArray_ = nullptr;
+    normals_ = nullptr;
+
+    KS_ = ks;
+    KD_ = kd;
+    mass_ = 0.05;
+    restLength_ = 0.1;
+    paused_ = false;
+    stuck = false;
+}
+
+LatticeSystem::~LatticeSystem() {
+    delete [] nodes_;
+    delete [] next_;
+    delete [] posArray_;
+    delete [] normals_;
+}
+
+void LatticeSystem::LatticeSetup(highp_dvec3 origin) {
+    for (int z = 0; z < dimZ_; ++z) {
+        for (int y = 0; y < dimY_; ++y) {
+            for (int x = 0; x < dimX_; ++x) {
+                Node& n = GetNode(x, y, z);
+                n.pos = origin + restLength_ * highp_dvec3(x, y, z);
+                n.vel = highp_dvec3(0, 0, 0);
+            }
+        }
+    }
+}
+
+void LatticeSystem::Setup() {
+    // drop it centered over the default sphere
+    LatticeSetup(highp_dvec3(2.5 - 0.5 * restLength_ * (dimX_ - 1), 4,
+                             2.5 - 0.5 * restLength_ * (dimZ_ - 1)));
+    SurfaceSetup();
+    GLSetup();
+}
+
+// Adds the two triangles of every quad on one side of the lattice. axis is the face
+// normal; u and v are the next two axes in cyclic order so cross(u, v) points along
+// +axis, and the winding is flipped on the low side to keep the faces pointing out.
+void LatticeSystem::AddFace(int axis, bool high) {
+    int dims[3] = { dimX_, dimY_, dimZ_ };
+    int u = (axis + 1) % 3;
+    int v = (axis + 2) % 3;
+    int coord[3];
+    coord[axis] = high ? dims[axis] - 1 : 0;
+    auto vertex = [&](int i, int j) {
+        coord[u] = i;
+        coord[v] = j;
+        int slot = Index(coord[0], coord[1], coord[2]);
+        if (surfaceIds_[slot] < 0) {
+            surfaceIds_[slot] = surfaceNodes_.size();
+            surfaceNodes_.push_back(slot);
+        }
+        return (unsigned int) surfaceIds_[slot];
+    };
+    for (int j = 0; j < dims[v] - 1; ++j) {
+        for (int i = 0; i < dims[u] - 1; ++i) {
+            unsigned int p00 = vertex(i, j);
+            unsigned int p10 = vertex(i + 1, j);
+            unsigned int p01 = vertex(i, j + 1);
+            unsigned int p11 = vertex(i + 1, j + 1);
+            unsigned int tris[6] = { p00, p10, p11, p00, p11, p01 };
+            if (!high) {
+                std::swap(tris[1], tris[2]);
+                std::swap(tris[4], tris[5]);
+            }
+            surfaceIndices_.insert(surfaceIndices_.end(), tris, tris + 6);
+        }
+    }
+}
+
+void LatticeSystem::SurfaceSetup() {
+    surfaceNodes_.clear();
+    surfaceIndices_.clear();
+    surfaceIds_.assign(numSlots_, -1);
+    for (int axis = 0; axis < 3; ++axis) {
+        AddFace(axis, false);
+        AddFace(axis, true);
+    }
+    delete [] posArray_;
+    delete [] normals_;
+    posArray_ = new vec3[surfaceNodes_.size()];
+    normals_ = new vec3[surfaceNodes_.size()];
+}
+
+void LatticeSystem::GLSetup() {
+    shader_.LoadFromFile(GL_VERTEX_SHADER, "shaders/plain_shader.vert");
+    shader_.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/plain_shader.frag");
+    shader_.CreateAndLinkProgram();
+    shader_.Enable();
+    shader_.AddAttribute("verts");
+    shader_.AddAttribute("normals");
+    shader_.AddUniform("model");
+    shader_.AddUniform("VP");
+    shader_.AddUniform("normalMatrix");
+    shader_.AddUniform("textured");
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    glGenBuffers(3, vbos_);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * surfaceNodes_.size(), NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(shader_["verts"]);
+    glVertexAttribPointer(shader_["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * surfaceNodes_.size(), NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(shader_["normals"]);
+    glVertexAttribPointer(shader_["normals"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos_[2]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * surfaceIndices_.size(),
+                 &surfaceIndices_[0], GL_STATIC_DRAW);
+}
+
+// Each node sums the springs to all of its neighbours and writes only its own slot of
+// the next state, so the tiles can be stepped in parallel without any races. Every
+// spring is evaluated from both ends, which is cheaper than synchronizing the scatter.
+void LatticeSystem::Update(double dt) {
+    if (paused_)
+        return;
+
+    const double rest[4] = { 0, restLength_, sqrt(2.0) * restLength_, sqrt(3.0) * restLength_ };
+    const int numTiles = tilesX_ * tilesY_ * tilesZ_;
+
+    #pragma omp parallel for schedule(static)
+    for (int t = 0; t < numTiles; ++t) {
+        int tx = t % tilesX_;
+        int ty = (t / tilesX_) % tilesY_;
+        int tz = t / (tilesX_ * tilesY_);
+        for (int lz = 0; lz < LATTICE_TILE; ++lz) {
+            int z = tz * LATTICE_TILE + lz;
+            for (int ly = 0; ly < LATTICE_TILE; ++ly) {
+                int y = ty * LATTICE_TILE + ly;
+                for (int lx = 0; lx < LATTICE_TILE; ++lx) {
+                    int x = tx * LATTICE_TILE + lx;
+                    if (x >= dimX_ || y >= dimY_ || z >= dimZ_)
+                        continue;
+
+                    int i = Index(x, y, z);
+                    const Node& n1 = nodes_[i];
+                    highp_dvec3 force = GRAVITY * mass_;
+                    for (int dz = -1; dz <= 1; ++dz) {
+                        if (z + dz < 0 || z + dz >= dimZ_)
+                            continue;
+                        for (int dy = -1; dy <= 1; ++dy) {
+                            if (y + dy < 0 || y + dy >= dimY_)
+                                continue;
+                            for (int dx = -1; dx <= 1; ++dx) {
+                                if (x + dx < 0 || x + dx >= dimX_)
+                                    continue;
+                                int k = dx*dx + dy*dy + dz*dz;
+                                if (k == 0)
+                                    continue;
+                                const Node& n2 = nodes_[Index(x + dx, y + dy, z + dz)];
+                                double l = length(n1.pos - n2.pos);
+                                highp_dvec3 e = (n1.pos - n2.pos) / l;
+                                double v1 = dot(e, n1.vel);
+                                double v2 = dot(e, n2.vel);
+                                force += SpringForce(KS_, KD_, l, rest[k], v1, v2) * e;
+                            }
+                        }
+                    }
+
+                    Node& out = next_[i];
+                    if (stuck && y == dimY_ - 1) {
+                        out = n1;
+                        continue;
+                    }
+                    out.vel = n1.vel + force / mass_ * dt;
+                    out.pos = n1.pos + out.vel * dt;
+                }
+            }
+        }
+    }
+    std::swap(nodes_, next_);
+}
+
+void LatticeSystem::HandleCollisions(vector<Sphere>& spheres) {
+    for (Sphere& sphere : spheres)
+        HandleCollisions(sphere);
+}
+
+// same response the cloth gets from a kinematic sphere
+void LatticeSystem::HandleCollisions(Sphere& sphere) {
+    highp_dvec3 center = sphere.position;
+    #pragma omp parallel for
+    for (int z = 0; z < dimZ_; ++z) {
+        for (int y = 0; y < dimY_; ++y) {
+            for (int x = 0; x < dimX_; ++x) {
+                Node& n = GetNode(x, y, z);
+                double d = length(n.pos - center);
+                if (d < sphere.radius + COLLISION_RANGE) {
+                    highp_dvec3 normal = (n.pos - center) / d;
+                    n.vel -= COLLISION_BOUNCE * dot(n.vel, normal) * normal;
+                    n.pos = center + (COLLISION_OFFSET + sphere.radius) * normal;
+                }
+            }
+        }
+    }
+}
+
+void LatticeSystem::RecalculateNormals() {
+    int numVerts = surfaceNodes_.size();
+    for (int i = 0; i < numVerts; ++i)
+        normals_[i] = vec3(0, 0, 0);
+    for (size_t i = 0; i < surfaceIndices_.size(); i += 3) {
+        vec3 a = posArray_[surfaceIndices_[i + 0]];
+        vec3 b = posArray_[surfaceIndices_[i + 1]];
+        vec3 c = posArray_[surfaceIndices_[i + 2]];
+        vec3 n = cross(b - a, c - a);
+        normals_[surfaceIndices_[i + 0]] += n;
+        normals_[surfaceIndices_[i + 1]] += n;
+        normals_[surfaceIndices_[i + 2]] += n;
+    }
+    for (int i = 0; i < numVerts; ++i)
+        normals_[i] = normalize(normals_[i]);
+}
+
+void LatticeSystem::UpdateGPUPositions() {
+    int numVerts = surfaceNodes_.size();
+    for (int i = 0; i < numVerts; ++i)
+        posArray_[i] = nodes_[surfaceNodes_[i]].pos;
+    RecalculateNormals();
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numVerts, &posArray_[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numVerts, &normals_[0], GL_STREAM_DRAW);
+}
+
+void LatticeSystem::Render(const mat4& V, const mat4& P) {
+    mat4 VP = P * V;
+    UpdateGPUPositions();
+    shader_.Enable();
+    glBindVertexArray(vao_);
+    mat4 model(1);
+    glUniformMatrix4fv(shader_["VP"], 1, GL_FALSE, value_ptr(VP));
+    glUniformMatrix4fv(shader_["model"], 1, GL_FALSE, value_ptr(model));
+    mat4 nM = transpose(inverse(V));
+    glUniformMatrix4fv(shader_["normalMatrix"], 1, GL_FALSE, value_ptr(nM));
+    glUniform1i(shader_["textured"], false);
+    glDrawElements(GL_TRIANGLES, surfaceIndices_.size(), GL_UNSIGNED_INT, 0);
+}
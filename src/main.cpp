@@ -7,10 +7,25 @@
 #include "include/shape_vertices.h"
 #include "include/spring_system.h"
 #include "include/sphere.h"
+#include "include/strand_system.h"
+#include "include/lattice_system.h"
+#include "include/drape_solver.h"
+#include "include/reduced_model.h"
+#include "include/mixed_spring_system.h"
+#include "include/cloth_lod.h"
+#include "include/adaptive_cloth.h"
+#include "include/benchmark.h"
+#include "include/sim_thread.h"
+#include "include/numa.h"
+#include "include/cloth_ranks.h"
+#include <omp.h>
+#include <algorithm>
 
 using namespace std;
 
-bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& c, Sphere& sphere);
+bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& c, vector<Sphere>& spheres,
+                 ReducedModel& reduced, MixedSpringSystem& mixed, SubstepScheduler& scheduler,
+                 SimThread* sim);
 void callback(void* data);
 
 int main(int argc, char** argv) {
@@ -18,6 +33,37 @@ int main(int argc, char** argv) {
 	int start_cols = 10;
 	int start_ks = 500;
 	int start_kd = 100;
+	int start_strands = 0;
+	int start_jelly = 0;
+	int start_lod = 0;
+	int start_adaptive = -1;
+	// "proj ranks <processes> [dim] [steps]" splits a cloth across processes, which are
+	// started as "proj rank <segment> <rank>"
+	if (argc > 3 && string(argv[1]) == "rank")
+		return RunRank(argv[2], stoi(argv[3]));
+	if (argc > 2 && string(argv[1]) == "ranks")
+		return LaunchRanks(argv[0], stoi(argv[2]), argc > 3 ? stoi(argv[3]) : 512,
+		                   argc > 4 ? stoi(argv[4]) : 100);
+	if (argc > 2 && string(argv[1]) == "bench") {
+		string name = argv[2];
+		if (name == "fixed")
+			BenchmarkFixedGrids(argc > 3 ? stoi(argv[3]) : 20000);
+		else if (name == "tiled")
+			BenchmarkTiled(argc > 3 ? stoi(argv[3]) : 1024, argc > 4 ? stoi(argv[4]) : 20);
+		else if (name == "layout")
+			BenchmarkLayouts(argc > 3 ? stoi(argv[3]) : 2048, argc > 4 ? stoi(argv[4]) : 10);
+		else if (name == "drift")
+			BenchmarkDrift(argc > 3 ? stoi(argv[3]) : 16, argc > 4 ? stoi(argv[4]) : 1000000);
+		else if (name == "tasks")
+			BenchmarkTasks(argc > 3 ? stoi(argv[3]) : 512, argc > 4 ? stoi(argv[4]) : 50);
+		else if (name == "numa")
+			BenchmarkNuma(argc > 3 ? stoi(argv[3]) : 4096, argc > 4 ? stoi(argv[4]) : 5);
+		else if (name == "isa")
+			BenchmarkIsa(argc > 3 ? stoi(argv[3]) : 1024, argc > 4 ? stoi(argv[4]) : 20);
+		else
+			cout << "unknown benchmark " << name << endl;
+		return 0;
+	}
 	if (argc > 1) {
 		start_rows = stoi(argv[1]);
 		if (argc > 2) {
@@ -26,6 +72,18 @@ int main(int argc, char** argv) {
 				start_ks = stoi(argv[3]);
 				if (argc > 4) {
 					start_kd = stoi(argv[4]);
+					if (argc > 5) {
+						start_strands = stoi(argv[5]);
+						if (argc > 6) {
+							start_jelly = stoi(argv[6]);
+							if (argc > 7) {
+								start_lod = stoi(argv[7]);
+								if (argc > 8) {
+									start_adaptive = stoi(argv[8]);
+								}
+							}
+						}
+					}
 				}
 			}
 		}
@@ -111,11 +169,91 @@ int main(int argc, char** argv) {
 	glVertexAttribPointer(shader["normals"], 3, GL_FLOAT, GL_FALSE, 0, (void*)CUBE_VERTS_SIZE);
 	*/
 
-	Sphere sphere(glm::vec3(2.5, 2.5, 2.5), 1);
+	// the first sphere is moved with the arrow keys, the rest are dropped with 'b'
+	vector<Sphere> spheres;
+	spheres.push_back(Sphere(glm::vec3(2.5, 2.5, 2.5), 1));
 
-    SpringSystem springSystem = SpringSystem(start_rows, start_cols, start_ks, start_kd);
+    SpringSystem springSystem(start_rows, start_cols, start_ks, start_kd);
+	// the padded step and the normals run as task graphs on a pool of their own, 'e'
+	// switches back to OpenMP
+	TaskPool pool(omp_get_max_threads());
+	springSystem.Pool(&pool);
+	// CLOTH_TUNE=on (or again, see auto_tune.h) times the ways of stepping this cloth
+	springSystem.AutoTune(getenv("CLOTH_TUNE") != nullptr);
 	springSystem.Setup();
+	// otherwise big cloths, which don't fit in the caches, are stepped a tile at a time
+	// and the others get the ghost border so the force loops have no boundary cases
+	if (!springSystem.AutoTune()) {
+		if (start_rows * start_cols >= 512 * 512)
+			springSystem.Tiled(true);
+		else
+			springSystem.SetLayout(PADDED);
+	}
+	// with more than one socket every thread keeps its rows in the memory next to it
+	if (start_rows * start_cols >= 512 * 512 && NumaNodes().size() > 1)
+		springSystem.NumaBands(true);
+
+	StrandSystem* strands = nullptr;
+	if (start_strands > 0) {
+		strands = new StrandSystem(start_strands, 40, 50, 0.5);
+		strands->Setup();
+	}
 
+	LatticeSystem* jelly = nullptr;
+	if (start_jelly > 0) {
+		jelly = new LatticeSystem(start_jelly, start_jelly, start_jelly, 300, 2);
+		jelly->Setup();
+	}
+
+
+	// with a render resolution given, the cloth is simulated at rows, rows/2 or rows/4
+	// across depending on how far away the camera is and drawn at that resolution, all
+	// with the shape of the full cloth
+	ClothLOD* lod = nullptr;
+	if (start_lod > 0) {
+		vector<int> levels;
+		for (int d = start_rows; d >= 4 && levels.size() < 3; d /= 2)
+			levels.push_back(d);
+		int lodDimY = std::max(2, (int) lround((start_lod - 1) * (start_cols - 1) /
+		                                       (double) (start_rows - 1)) + 1);
+		lod = new ClothLOD(start_lod, lodDimY, levels, start_ks, start_kd);
+		lod->SetWrinkles(0.02, 20);
+		lod->Setup();
+	}
+
+	// with a maximum refinement level given, an adaptive cloth of about rows x cols base
+	// cells replaces the regular one and refines itself where it folds
+	AdaptiveCloth* adaptive = nullptr;
+	if (start_adaptive >= 0) {
+		adaptive = new AdaptiveCloth(std::max(1, start_cols / 4), std::max(1, start_rows / 4), 4,
+		                             start_adaptive, start_ks, start_kd);
+		adaptive->Setup();
+	}
+
+	// 'm' records the full simulation and then switches to a reduced model built from it
+	ReducedModel reduced;
+	// 'y' steps the cloth in mixed precision, copied back for drawing every frame
+	MixedSpringSystem mixed;
+
+	// the substeps and the cloth's mode are picked to fit the frame budget, 'f' turns it
+	// off, the LOD and adaptive cloths have their own ways of saving time
+	SubstepScheduler scheduler(FRAME_BUDGET);
+	scheduler.Enabled(!lod && !adaptive);
+
+	// a plain cloth is stepped on its own thread, the strands, jelly and the cloths that
+	// adapt to the camera are stepped with the rendering
+	SimThread sim(springSystem, spheres, reduced, mixed, scheduler);
+	bool threaded = !strands && !jelly && !lod && !adaptive;
+	// the normals of the drawn copy are worked out on a smaller pool of their own, on the
+	// step's pool the drawing thread would help with the substeps while it waits
+	TaskPool normalsPool(std::max(1, omp_get_max_threads() / 2));
+	if (threaded) {
+		springSystem.NormalsPool(&normalsPool);
+		sim.Start();
+	}
+	FixedTimestep timestep(1.0 / SIM_RATE, SIM_MAX_STEPS);
+	vector<vec3> clothPositions;
+	vector<mat4> sphereModels;
 
     bool quit = false;
     SDL_Event event;
@@ -130,18 +268,71 @@ int main(int argc, char** argv) {
 
         // Process all input events
         while (SDL_PollEvent(&event) && !quit) {
-            quit = HandleInput(event, dt, springSystem, camera, sphere);
+            quit = HandleInput(event, dt, springSystem, camera, spheres, reduced, mixed, scheduler,
+			                   threaded ? &sim : nullptr);
 		}
 
         // update
         camera.Update(dt);
-		sphere.Update(dt);
-
-        for (int i = 0; i < 15; i++) {
-            springSystem.Update(0.0001);
-			springSystem.HandleCollisions(sphere);
-        }
+		if (!threaded) {
+			// as many cloth frames as the clock moved on, see SimThread::Run, drawn as they
+			// are after the last one
+			int steps = timestep.Advance(dt);
+			for (int step = 0; step < steps; ++step) {
+				for (Sphere& sphere : spheres)
+					if (!sphere.Dynamic())
+						sphere.Update(timestep.Step());
 
+                // strain limiting keeps the springs from overstretching, so it can take bigger steps
+                int substeps = springSystem.StrainLimit() ? 3 : 15;
+                if (!adaptive && !lod)
+                    substeps = scheduler.Plan(springSystem, reduced, mixed);
+                scheduler.StartFrame();
+                for (int i = 0; i < substeps; i++) {
+                    // spheres with mass are stepped with the cloth so they exchange momentum every substep
+					for (Sphere& sphere : spheres)
+						if (sphere.Dynamic())
+							sphere.Update(0.0015 / substeps);
+					if (adaptive) {
+						adaptive->Update(0.0015 / substeps);
+						adaptive->HandleCollisions(spheres);
+					} else if (lod) {
+						lod->Update(0.0015 / substeps);
+						lod->HandleCollisions(spheres);
+					} else if (mixed.Loaded()) {
+						mixed.Step(0.0015 / substeps);
+						mixed.HandleCollisions(spheres);
+					} else if (reduced.Built()) {
+						reduced.Step(0.0015 / substeps);
+					} else {
+						springSystem.Update(0.0015 / substeps, spheres);
+					}
+					if (strands) {
+						strands->Update(0.0015 / substeps);
+						strands->HandleCollisions(spheres);
+					}
+					if (jelly) {
+						jelly->Update(0.0015 / substeps);
+						jelly->HandleCollisions(spheres);
+					}
+                }
+				scheduler.SubstepsDone();
+				if (adaptive) {
+					int before = adaptive->NumNodes();
+					adaptive->Adapt();
+					if (adaptive->NumNodes() != before)
+						cout << "adaptive cloth: " << before << " -> " << adaptive->NumNodes() << " nodes" << endl;
+				} else if (lod)
+					lod->UpdateLevel(camera.Pos());
+				else if (mixed.Loaded())
+					mixed.Store(springSystem);
+				else if (reduced.Built())
+					reduced.Reconstruct(springSystem);
+				else if (reduced.Recording())
+					reduced.Record(springSystem);
+				scheduler.EndFrame();
+			}
+		}
 
         // draw
         glClearColor(1, 1, 1, 0);
@@ -162,13 +353,26 @@ int main(int argc, char** argv) {
         glUniform1i(shader["textured"], true);
         glDrawArrays(GL_TRIANGLES, 0, 6);
 
+		// the threaded cloth and spheres are drawn between the last two frames the
+		// simulation thread published
+		if (threaded) {
+			const ClothFrame& frame = sim.Frame();
+			frame.Interpolate(sim.Alpha(frame), clothPositions, sphereModels);
+		} else {
+			sphereModels.clear();
+			for (Sphere& sphere : spheres)
+				sphereModels.push_back(sphere.GetModelMatrix());
+		}
+
 		glBindVertexArray(sphere_vao);
-		model = sphere.GetModelMatrix();
-        glUniformMatrix4fv(shader["model"], 1, GL_FALSE, value_ptr(model));
-		nM = transpose(inverse(camera.View() * model));
-        glUniformMatrix4fv(shader["normalMatrix"], 1,  GL_FALSE, value_ptr(nM));
         glUniform1i(shader["textured"], false);
-        glDrawElements(GL_TRIANGLES, sphereMesh->GetNumTriangles() * 3, GL_UNSIGNED_INT, 0);
+		for (const mat4& sphereModel : sphereModels) {
+			model = sphereModel;
+			glUniformMatrix4fv(shader["model"], 1, GL_FALSE, value_ptr(model));
+			nM = transpose(inverse(camera.View() * model));
+			glUniformMatrix4fv(shader["normalMatrix"], 1,  GL_FALSE, value_ptr(nM));
+			glDrawElements(GL_TRIANGLES, sphereMesh->GetNumTriangles() * 3, GL_UNSIGNED_INT, 0);
+		}
 
 		/*
 		glBindVertexArray(cube_vao);
@@ -178,24 +382,62 @@ int main(int argc, char** argv) {
         glDrawArrays(GL_TRIANGLES, 0, 36);
 		*/
 
-        springSystem.Render(camera.View(), camera.Proj());
+		if (adaptive)
+			adaptive->Render(camera.View(), camera.Proj());
+		else if (lod)
+			lod->Render(camera.View(), camera.Proj());
+		else if (threaded)
+			springSystem.Render(camera.View(), camera.Proj(), clothPositions);
+		else
+			springSystem.Render(camera.View(), camera.Proj());
+		if (strands)
+			strands->Render(camera.View(), camera.Proj());
+		if (jelly)
+			jelly->Render(camera.View(), camera.Proj());
 
         fpsC.EndFrame();
         SDL_GL_SwapWindow(window);
     }
 
     // Clean up
+	sim.Stop();
+	delete strands;
+	delete jelly;
+	delete lod;
+	delete adaptive;
     SDL_Quit();
 
     return 0;
 }
 
-bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& camera, Sphere& sphere) {
+bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& camera, vector<Sphere>& spheres,
+                 ReducedModel& reduced, MixedSpringSystem& mixed, SubstepScheduler& scheduler,
+                 SimThread* sim) {
     bool quit = false;
+    // parameters and sphere motion belong to the simulation, which may run on its own thread
+    if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+        if (sim)
+            sim->Post(event);
+        else
+            HandleSimInput(event, ss, spheres, scheduler);
+    }
     if (event.type == SDL_QUIT) {
         quit = true;
     } else if (event.type == SDL_KEYDOWN) { // && event.key.repeat == 0) {
-		bool print = false;
+        // these change the structure of the cloth and rebuild its buffers, the simulation
+        // thread waits for them
+        std::unique_lock<std::mutex> lock;
+        switch (event.key.keysym.sym) {
+            case SDLK_q:
+            case SDLK_m:
+            case SDLK_y:
+            case SDLK_g:
+            case SDLK_o:
+            case SDLK_e:
+                if (sim)
+                    lock = std::unique_lock<std::mutex>(sim->Mutex());
+                break;
+        }
         switch (event.key.keysym.sym) {
             case SDLK_w:
                 camera.VelZ(1.0f);
@@ -209,86 +451,95 @@ bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& camera, S
             case SDLK_d:
                 camera.VelX(1.0f);
                 break;
-            case SDLK_i:
-				{
-				// increase KS
-				double k = ss.GetKS();
-				ss.SetKS(k + 10);
-				}
-				print = true;
+            case SDLK_ESCAPE:
+                quit = true;
                 break;
-            case SDLK_k:
-				{
-				// decrease KS
-				double k = std::fmax(1, ss.GetKS() - 10);
-				ss.SetKS(k);
-				}
-				print = true;
+            case SDLK_c:
+				ss.ChangeVizualization();
                 break;
-            case SDLK_l:
+            case SDLK_q:
 				{
-				// increase KD
-				double k = ss.GetKD() + 10;
-				ss.SetKD(k + 10);
+				// jump straight to the resting shape
+				DrapeSolver solver;
+				DrapeResult res = solver.Solve(ss, spheres);
+				cout << "Drape: " << res.iterations << " newton / " << res.cgIterations
+					 << " cg iterations, |grad| = " << res.gradNorm << endl;
 				}
-				print = true;
                 break;
-            case SDLK_j:
-				{
-				// decrease KD
-				double k = std::fmax(1, ss.GetKD() - 10);
-				ss.SetKD(k);
+            case SDLK_m:
+				// picking the mode by hand turns the budget off
+				scheduler.Enabled(false);
+				if (reduced.Built()) {
+					reduced.Clear();
+					cout << "Reduced model is off" << endl;
+				} else if (!reduced.Recording()) {
+					reduced.Recording(true);
+					cout << "Recording the cloth for a reduced model, m again to build it" << endl;
+				} else if (reduced.Build(ss, 24)) {
+					cout << "Reduced model is on with " << reduced.NumModes() << " modes" << endl;
+				} else {
+					reduced.Recording(false);
+					cout << "Too few frames recorded for a reduced model" << endl;
 				}
-				print = true;
-                break;
-            case SDLK_ESCAPE:
-                quit = true;
-                break;
-            case SDLK_p:
-				ss.Pause();
-                break;
-            case SDLK_SPACE:
-				ss.Drag(!ss.Drag());
-				if (ss.Drag())
-					cout << "Drag is on" << endl;
-				else
-					cout << "Drag is off" << endl;
-                break;
-            case SDLK_LEFT:
-				sphere.velocity.x = -1;
                 break;
-            case SDLK_RIGHT:
-				sphere.velocity.x = 1;
-                break;
-            case SDLK_UP:
-				sphere.velocity.z = -1;
-                break;
-            case SDLK_DOWN:
-				sphere.velocity.z = 1;
-                break;
-            case SDLK_v:
-				ss.SpringSetup(true);
-                break;
-            case SDLK_x:
-				ss.stuck = !ss.stuck;
+            case SDLK_y:
+				scheduler.Enabled(false);
+				if (mixed.Loaded()) {
+					mixed.Clear();
+					cout << "Mixed precision is off" << endl;
+				} else {
+					mixed.Load(ss);
+					cout << "Mixed precision is on" << endl;
+				}
                 break;
-            case SDLK_z:
-				if (ss.wind == 0)
-				   ss.wind = 1;
-				else
-					ss.wind = 0;
+            case SDLK_g:
+				if (ss.Masked()) {
+					ss.ClearMask();
+					cout << "Cloth is whole again" << endl;
+				} else {
+					// a round hole and a swallowtail cut into the bottom edge
+					int w = ss.DimX();
+					int h = ss.DimY();
+					vector<unsigned char> mask(w * h, 1);
+					for (int r = 0; r < h; ++r) {
+						for (int c = 0; c < w; ++c) {
+							float x = c - 0.5f * w;
+							float y = r - 0.4f * h;
+							if (x * x + y * y < 0.02f * w * h)
+								mask[r * w + c] = 0;
+							if (r > h - 1 - 0.3f * h * (1 - fabs(2.0f * c / (w - 1) - 1)))
+								mask[r * w + c] = 0;
+						}
+					}
+					ss.SetMask(mask);
+					cout << "Cloth is cut, " << ss.NumActiveNodes() << " active nodes" << endl;
+				}
                 break;
-            case SDLK_h:
-				ss.SpringSetup(false);
+            case SDLK_o:
+				{
+					const char* names[4] = { "row major", "Morton", "blocked Morton", "padded" };
+					NodeLayout layout = (NodeLayout) ((ss.Layout() + 1) % 4);
+					ss.SetLayout(layout);
+					cout << "Nodes are stored in " << names[ss.Layout()] << " order" << endl;
+				}
                 break;
-            case SDLK_c:
-				ss.ChangeVizualization();
+            case SDLK_e:
+				{
+					// kept while the cloth runs on OpenMP
+					static TaskPool* pool = nullptr;
+					if (ss.Pool()) {
+						pool = ss.Pool();
+						ss.Pool(nullptr);
+						cout << "Cloth runs on OpenMP" << endl;
+					} else if (pool) {
+						ss.Pool(pool);
+						cout << "Cloth runs on the task pool" << endl;
+					}
+				}
                 break;
         }
-		if (print) {
-			cout << "KS: " << ss.GetKS() << endl;
-			cout << "KD: " << ss.GetKD() << endl;
-		}
+		if (lock)
+			sim->Publish();
     } else if (event.type == SDL_KEYUP) {
         // handle key up events
         switch (event.key.keysym.sym) {
@@ -300,20 +551,6 @@ bool HandleInput(SDL_Event& event, float dt, SpringSystem& ss, Camera& camera, S
             case SDLK_d:
                 camera.VelX(0.0f);
                 break;
-            case SDLK_SPACE:
-                break;
-			case SDLK_LEFT:
-				sphere.velocity.x = 0;
-				break;
-			case SDLK_RIGHT:
-				sphere.velocity.x = 0;
-				break;
-			case SDLK_UP:
-				sphere.velocity.z = 0;
-				break;
-			case SDLK_DOWN:
-				sphere.velocity.z = 0;
-				break;
         }
     } else if (event.type == SDL_MOUSEMOTION) {
         // handle mouse events
@@ -0,0 +1,324 @@
+#include "include/mixed_spring_system.h"
+#include "include/spring_law.h"
+#include <omp.h>
+#include <algorithm>
+
+MixedSpringSystem::MixedSpringSystem() {
+    dimX_ = 0;
+    dimY_ = 0;
+    tilesX_ = 0;
+    compensated_ = true;
+}
+
+void MixedSpringSystem::Load(SpringSystem& ss) {
+    dimX_ = ss.DimX();
+    dimY_ = ss.DimY();
+    ks_ = ss.GetKS();
+    kd_ = ss.GetKD();
+    restLength_ = ss.GetRestLength();
+    mass_ = ss.GetMass();
+    drag_ = ss.Drag();
+    stuck_ = ss.stuck;
+    wind_ = ss.WindVector();
+
+    // each tile starts out at its first node
+    tilesX_ = (dimX_ + MIXED_TILE - 1) / MIXED_TILE;
+    int tilesY = (dimY_ + MIXED_TILE - 1) / MIXED_TILE;
+    origins_.resize(tilesX_ * tilesY);
+    for (int tr = 0; tr < tilesY; ++tr)
+        for (int tc = 0; tc < tilesX_; ++tc)
+            origins_[tr * tilesX_ + tc] = ss.GetNode(tr * MIXED_TILE, tc * MIXED_TILE).pos;
+
+    const int n = dimX_ * dimY_;
+    offsets_.Resize(n);
+    compensation_.Resize(n);
+    velCompensation_.Resize(n);
+    vel_.Resize(n);
+    forces_.Resize(n);
+    local_.Resize(n);
+    vertical_.Resize(n);
+    horizontal_.Resize(n);
+    tri1_.Resize(n);
+    tri2_.Resize(n);
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            Node& node = ss.GetNode(r, c);
+            vec3 offset = vec3(node.pos - origins_[Tile(r, c)]);
+            offsets_.x[i] = offset.x;
+            offsets_.y[i] = offset.y;
+            offsets_.z[i] = offset.z;
+            vel_.x[i] = node.vel.x;
+            vel_.y[i] = node.vel.y;
+            vel_.z[i] = node.vel.z;
+        }
+    }
+}
+
+void MixedSpringSystem::Store(SpringSystem& ss) {
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            Node& node = ss.GetNode(r, c);
+            node.pos = Position(r, c);
+            node.vel = highp_dvec3(vel_.x[i], vel_.y[i], vel_.z[i]) -
+                       highp_dvec3(velCompensation_.x[i], velCompensation_.y[i], velCompensation_.z[i]);
+        }
+    }
+}
+
+// the compensations hold what the sums are short of, with the opposite sign
+highp_dvec3 MixedSpringSystem::Position(int r, int c) {
+    const int i = r*dimX_ + c;
+    highp_dvec3 offset(offsets_.x[i], offsets_.y[i], offsets_.z[i]);
+    highp_dvec3 lost(compensation_.x[i], compensation_.y[i], compensation_.z[i]);
+    return origins_[Tile(r, c)] + (offset - lost);
+}
+
+// The same forces as SpringSystem::ComputeForces, in float. They only depend on where
+// the nodes are relative to each other, so the positions are first brought into the
+// frame of tile 0.
+void MixedSpringSystem::ComputeForces() {
+    const int n = dimX_ * dimY_;
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            vec3 shift = vec3(origins_[Tile(r, c)] - origins_[0]);
+            local_.x[i] = shift.x + offsets_.x[i];
+            local_.y[i] = shift.y + offsets_.y[i];
+            local_.z[i] = shift.z + offsets_.z[i];
+        }
+    }
+    const float* px = &local_.x[0];
+    const float* py = &local_.y[0];
+    const float* pz = &local_.z[0];
+    const float* vx = &vel_.x[0];
+    const float* vy = &vel_.y[0];
+    const float* vz = &vel_.z[0];
+    const vec3 wind = vec3(wind_);
+
+    // drag of the two triangles of quad (r, c), stored at its upper left node
+    if (drag_) {
+        const float pc = 10;
+        #pragma omp parallel for schedule(static)
+        for (int r = 0; r < dimY_ - 1; ++r) {
+            #pragma omp simd
+            for (int c = 0; c < dimX_ - 1; ++c) {
+                const int ul = r*dimX_ + c;
+                const int ur = ul + 1;
+                const int ll = ul + dimX_;
+                const int lr = ll + 1;
+
+                // first triangle
+                float wx = (vx[ul] + vx[ur] + vx[ll]) / 3.0f - wind.x;
+                float wy = (vy[ul] + vy[ur] + vy[ll]) / 3.0f - wind.y;
+                float wz = (vz[ul] + vz[ur] + vz[ll]) / 3.0f - wind.z;
+                float ax = px[ll] - px[ul], ay = py[ll] - py[ul], az = pz[ll] - pz[ul];
+                float bx = px[ur] - px[ul], by = py[ur] - py[ul], bz = pz[ur] - pz[ul];
+                float nx = ay * bz - by * az;
+                float ny = az * bx - bz * ax;
+                float nz = ax * by - bx * ay;
+                float s = -.5f*pc*(sqrtf(wx*wx + wy*wy + wz*wz)*(wx*nx + wy*ny + wz*nz));
+                float ln = 2*sqrtf(nx*nx + ny*ny + nz*nz);
+                tri1_.x[ul] = s * nx / ln / 3.0f;
+                tri1_.y[ul] = s * ny / ln / 3.0f;
+                tri1_.z[ul] = s * nz / ln / 3.0f;
+
+                // second triangle
+                wx = (vx[lr] + vx[ur] + vx[ll]) / 3.0f - wind.x;
+                wy = (vy[lr] + vy[ur] + vy[ll]) / 3.0f - wind.y;
+                wz = (vz[lr] + vz[ur] + vz[ll]) / 3.0f - wind.z;
+                ax = px[ur] - px[lr], ay = py[ur] - py[lr], az = pz[ur] - pz[lr];
+                bx = px[ll] - px[lr], by = py[ll] - py[lr], bz = pz[ll] - pz[lr];
+                nx = ay * bz - by * az;
+                ny = az * bx - bz * ax;
+                nz = ax * by - bx * ay;
+                s = -.5f*pc*(sqrtf(wx*wx + wy*wy + wz*wz)*(wx*nx + wy*ny + wz*nz));
+                ln = 2*sqrtf(nx*nx + ny*ny + nz*nz);
+                tri2_.x[ul] = s * nx / ln / 3.0f;
+                tri2_.y[ul] = s * ny / ln / 3.0f;
+                tri2_.z[ul] = s * nz / ln / 3.0f;
+            }
+        }
+    }
+
+    // springs to the node above
+    const float ks = ks_, kd = kd_, rest = restLength_;
+    #pragma omp parallel for simd schedule(static)
+    for (int i = dimX_; i < n; ++i) {
+        const int j = i - dimX_;
+        float dx = px[i] - px[j], dy = py[i] - py[j], dz = pz[i] - pz[j];
+        float l = sqrtf(dx*dx + dy*dy + dz*dz);
+        float ex = dx / l, ey = dy / l, ez = dz / l;
+        float v1 = ex * vx[i] + ey * vy[i] + ez * vz[i];
+        float v2 = ex * vx[j] + ey * vy[j] + ez * vz[j];
+        float f = -ks*(l - rest) - kd*(v1 - v2);
+        vertical_.x[i] = f * ex;
+        vertical_.y[i] = f * ey;
+        vertical_.z[i] = f * ez;
+    }
+    // and to the node on the left
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dimY_; ++r) {
+        #pragma omp simd
+        for (int c = 1; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            const int j = i - 1;
+            float dx = px[i] - px[j], dy = py[i] - py[j], dz = pz[i] - pz[j];
+            float l = sqrtf(dx*dx + dy*dy + dz*dz);
+            float ex = dx / l, ey = dy / l, ez = dz / l;
+            float v1 = ex * vx[i] + ey * vy[i] + ez * vz[i];
+            float v2 = ex * vx[j] + ey * vy[j] + ez * vz[j];
+            float f = -ks*(l - rest) - kd*(v1 - v2);
+            horizontal_.x[i] = f * ex;
+            horizontal_.y[i] = f * ey;
+            horizontal_.z[i] = f * ez;
+        }
+    }
+
+    // every node adds up its pieces in the order SpringSystem does
+    const vec3 gravity = vec3(GRAVITY * mass_) + wind;
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            float fx = gravity.x, fy = gravity.y, fz = gravity.z;
+            if (drag_) {
+                const int up = i - dimX_;
+                if (r > 0 && c > 0) {
+                    fx += tri2_.x[up - 1]; fy += tri2_.y[up - 1]; fz += tri2_.z[up - 1];
+                }
+                if (r > 0 && c < dimX_ - 1) {
+                    fx += tri1_.x[up]; fy += tri1_.y[up]; fz += tri1_.z[up];
+                    fx += tri2_.x[up]; fy += tri2_.y[up]; fz += tri2_.z[up];
+                }
+                if (r < dimY_ - 1 && c > 0) {
+                    fx += tri1_.x[i - 1]; fy += tri1_.y[i - 1]; fz += tri1_.z[i - 1];
+                    fx += tri2_.x[i - 1]; fy += tri2_.y[i - 1]; fz += tri2_.z[i - 1];
+                }
+                if (r < dimY_ - 1 && c < dimX_ - 1) {
+                    fx += tri1_.x[i]; fy += tri1_.y[i]; fz += tri1_.z[i];
+                }
+            }
+            if (r > 0) {
+                fx += vertical_.x[i]; fy += vertical_.y[i]; fz += vertical_.z[i];
+            }
+            if (r < dimY_ - 1) {
+                fx -= vertical_.x[i + dimX_]; fy -= vertical_.y[i + dimX_]; fz -= vertical_.z[i + dimX_];
+            }
+            if (c > 0) {
+                fx += horizontal_.x[i]; fy += horizontal_.y[i]; fz += horizontal_.z[i];
+            }
+            if (c < dimX_ - 1) {
+                fx -= horizontal_.x[i + 1]; fy -= horizontal_.y[i + 1]; fz -= horizontal_.z[i + 1];
+            }
+            if (stuck_ && r == 0)
+                fx = fy = fz = 0;
+            forces_.x[i] = fx;
+            forces_.y[i] = fy;
+            forces_.z[i] = fz;
+        }
+    }
+}
+
+// sum += x, with what the float sum rounds away kept in c and taken back next time
+static inline void KahanAdd(float& sum, float& c, float x) {
+    float y = x - c;
+    float t = sum + y;
+    c = (t - sum) - y;
+    sum = t;
+}
+
+void MixedSpringSystem::Step(double dt) {
+    ComputeForces();
+    const int n = dimX_ * dimY_;
+    const float h = dt;
+    const float mass = mass_;
+    if (compensated_) {
+        #pragma omp parallel for simd schedule(static)
+        for (int i = 0; i < n; ++i) {
+            KahanAdd(vel_.x[i], velCompensation_.x[i], forces_.x[i] / mass * h);
+            KahanAdd(vel_.y[i], velCompensation_.y[i], forces_.y[i] / mass * h);
+            KahanAdd(vel_.z[i], velCompensation_.z[i], forces_.z[i] / mass * h);
+            KahanAdd(offsets_.x[i], compensation_.x[i], (vel_.x[i] - velCompensation_.x[i]) * h);
+            KahanAdd(offsets_.y[i], compensation_.y[i], (vel_.y[i] - velCompensation_.y[i]) * h);
+            KahanAdd(offsets_.z[i], compensation_.z[i], (vel_.z[i] - velCompensation_.z[i]) * h);
+        }
+    } else {
+        #pragma omp parallel for simd schedule(static)
+        for (int i = 0; i < n; ++i) {
+            vel_.x[i] += forces_.x[i] / mass * h;
+            vel_.y[i] += forces_.y[i] / mass * h;
+            vel_.z[i] += forces_.z[i] / mass * h;
+            offsets_.x[i] += vel_.x[i] * h;
+            offsets_.y[i] += vel_.y[i] * h;
+            offsets_.z[i] += vel_.z[i] * h;
+        }
+    }
+    Rebase();
+}
+
+// Moves the origin of every tile that wandered off onto its first node, so the offsets
+// stay small and keep their precision. The float shift is added to the double origin
+// exactly, only the offsets round.
+void MixedSpringSystem::Rebase() {
+    const int tilesY = origins_.size() / tilesX_;
+    for (int tr = 0; tr < tilesY; ++tr) {
+        for (int tc = 0; tc < tilesX_; ++tc) {
+            const int first = tr * MIXED_TILE * dimX_ + tc * MIXED_TILE;
+            vec3 shift(offsets_.x[first], offsets_.y[first], offsets_.z[first]);
+            if (fabs(shift.x) < REBASE_DISTANCE && fabs(shift.y) < REBASE_DISTANCE &&
+                fabs(shift.z) < REBASE_DISTANCE)
+                continue;
+            origins_[tr * tilesX_ + tc] += highp_dvec3(shift);
+            const int rEnd = std::min(dimY_, (tr + 1) * MIXED_TILE);
+            const int cEnd = std::min(dimX_, (tc + 1) * MIXED_TILE);
+            for (int r = tr * MIXED_TILE; r < rEnd; ++r) {
+                for (int c = tc * MIXED_TILE; c < cEnd; ++c) {
+                    const int i = r*dimX_ + c;
+                    offsets_.x[i] -= shift.x;
+                    offsets_.y[i] -= shift.y;
+                    offsets_.z[i] -= shift.z;
+                }
+            }
+        }
+    }
+}
+
+void MixedSpringSystem::HandleCollisions(vector<Sphere>& spheres) {
+    const int numSpheres = spheres.size();
+    #pragma omp parallel for schedule(static)
+    for (int r = 0; r < dimY_; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            const int i = r*dimX_ + c;
+            for (int s = 0; s < numSpheres; ++s) {
+                Sphere& sphere = spheres[s];
+                highp_dvec3 p = Position(r, c);
+                highp_dvec3 center = highp_dvec3(sphere.position);
+                double d = length(p - center);
+                if (d >= sphere.radius + COLLISION_RANGE)
+                    continue;
+                vec3 normal = vec3(normalize(p - center));
+                vec3 v(vel_.x[i] - velCompensation_.x[i], vel_.y[i] - velCompensation_.y[i],
+                       vel_.z[i] - velCompensation_.z[i]);
+                v -= COLLISION_BOUNCE * dot(v, normal) * normal;
+                vel_.x[i] = v.x;
+                vel_.y[i] = v.y;
+                vel_.z[i] = v.z;
+                velCompensation_.x[i] = 0;
+                velCompensation_.y[i] = 0;
+                velCompensation_.z[i] = 0;
+                vec3 offset = vec3(center + (COLLISION_OFFSET + sphere.radius) * highp_dvec3(normal) -
+                                   origins_[Tile(r, c)]);
+                offsets_.x[i] = offset.x;
+                offsets_.y[i] = offset.y;
+                offsets_.z[i] = offset.z;
+                compensation_.x[i] = 0;
+                compensation_.y[i] = 0;
+                compensation_.z[i] = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include "include/numa.h"
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::vector;
+
+#define MAX_NUMA_NODES 64
+
+// "0-3,8,10-11"
+static vector<int> ParseCpuList(const std::string& list) {
+    vector<int> cpus;
+    std::stringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty() || range.find_first_not_of(" \n") == std::string::npos)
+            continue;
+        size_t dash = range.find('-');
+        int first = atoi(range.c_str());
+        int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+vector<vector<int> > NumaNodes() {
+    vector<vector<int> > nodes;
+    for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in)
+            continue;
+        std::string list;
+        std::getline(in, list);
+        nodes.resize(node + 1);
+        nodes[node] = ParseCpuList(list);
+    }
+    if (nodes.empty()) {
+        nodes.resize(1);
+        int numCpus = std::max(1u, std::thread::hardware_concurrency());
+        for (int cpu = 0; cpu < numCpus; ++cpu)
+            nodes[0].push_back(cpu);
+    }
+    return nodes;
+}
+
+int CpuNumaNode(int cpu) {
+    vector<vector<int> > nodes = NumaNodes();
+    for (size_t node = 0; node < nodes.size(); ++node)
+        for (int c : nodes[node])
+            if (c == cpu)
+                return node;
+    return 0;
+}
+
+int CurrentCpu() {
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+
+vector<int> AffinityCpus(int numThreads) {
+    const char* env = getenv("CLOTH_AFFINITY");
+    std::string mode = env ? env : "compact";
+    vector<int> cpus;
+    if (mode == "none")
+        return cpus;
+
+    vector<int> order;
+    if (mode == "compact" || mode == "spread") {
+        vector<vector<int> > nodes = NumaNodes();
+        if (mode == "compact") {
+            for (const vector<int>& node : nodes)
+                order.insert(order.end(), node.begin(), node.end());
+        } else {
+            for (size_t k = 0; order.size() < (size_t) numThreads; ++k) {
+                bool any = false;
+                for (const vector<int>& node : nodes) {
+                    if (k < node.size()) {
+                        order.push_back(node[k]);
+                        any = true;
+                    }
+                }
+                if (!any)
+                    break;
+            }
+        }
+    } else {
+        order = ParseCpuList(mode);
+    }
+    if (order.empty())
+        return cpus;
+    for (int t = 0; t < numThreads; ++t)
+        cpus.push_back(order[t % order.size()]);
+    return cpus;
+}
+
+bool PinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+void PinOpenMPThreads(const vector<int>& cpus) {
+    if (cpus.empty())
+        return;
+    #pragma omp parallel
+    PinThread(cpus[omp_get_thread_num() % cpus.size()]);
+}
+
+int PageNumaNode(const void* p) {
+#ifdef __linux__
+    void* page = (void*) ((uintptr_t) p & ~(uintptr_t) (sysconf(_SC_PAGESIZE) - 1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0 || status < 0)
+        return -1;
+    return status;
+#else
+    return -1;
+#endif
+}
+
+void MoveToThisNode(void* p, size_t bytes) {
+#ifdef __linux__
+    int cpu = CurrentCpu();
+    if (cpu < 0)
+        return;
+    int node = CpuNumaNode(cpu);
+    const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = ((uintptr_t) p + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t end = ((uintptr_t) p + bytes) & ~(pageSize - 1);
+    if (end <= begin)
+        return;
+    unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+    // preferred rather than bound, so the memory is still usable if the node fills up
+    syscall(SYS_mbind, begin, end - begin, MPOL_PREFERRED, mask, MAX_NUMA_NODES + 1,
+            MPOL_MF_MOVE);
+#endif
+}
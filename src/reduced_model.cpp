@@ -0,0 +1,262 @@
+#include "include/reduced_model.h"
+#include <omp.h>
+#include <algorithm>
+
+ReducedModel::ReducedModel() :
+    ReducedModel(200) {}
+
+ReducedModel::ReducedModel(int maxSnapshots) {
+    maxSnapshots_ = maxSnapshots;
+    recording_ = false;
+    numDofs_ = 0;
+    numModes_ = 0;
+    mass_ = 0;
+}
+
+void ReducedModel::Recording(bool r) {
+    if (!r)
+        snapshots_.clear();
+    recording_ = r;
+}
+
+// keeps the newest maxSnapshots_ positions of the full simulation
+void ReducedModel::Record(SpringSystem& ss) {
+    int dimX = ss.DimX();
+    int dimY = ss.DimY();
+    vector<double> x(3 * dimX * dimY);
+    for (int r = 0; r < dimY; ++r) {
+        for (int c = 0; c < dimX; ++c) {
+            highp_dvec3 p = ss.GetNode(r, c).pos;
+            int i = 3 * (r * dimX + c);
+            x[i + 0] = p.x;
+            x[i + 1] = p.y;
+            x[i + 2] = p.z;
+        }
+    }
+    if ((int) snapshots_.size() == maxSnapshots_)
+        snapshots_.erase(snapshots_.begin());
+    snapshots_.push_back(x);
+}
+
+// Cyclic Jacobi eigen decomposition of the symmetric n x n matrix A (destroyed). The
+// eigenvalues end up on the diagonal of A and the eigenvectors in the columns of V.
+static void JacobiEigen(vector<double>& A, vector<double>& V, int n) {
+    V.assign(n * n, 0);
+    for (int i = 0; i < n; ++i)
+        V[i * n + i] = 1;
+    for (int sweep = 0; sweep < 50; ++sweep) {
+        double off = 0;
+        for (int p = 0; p < n; ++p)
+            for (int q = p + 1; q < n; ++q)
+                off += A[p * n + q] * A[p * n + q];
+        if (off < 1e-22)
+            break;
+        for (int p = 0; p < n; ++p) {
+            for (int q = p + 1; q < n; ++q) {
+                double apq = A[p * n + q];
+                if (fabs(apq) < 1e-300)
+                    continue;
+                double theta = (A[q * n + q] - A[p * n + p]) / (2 * apq);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1);
+                double s = t * c;
+                for (int k = 0; k < n; ++k) {
+                    double akp = A[k * n + p];
+                    double akq = A[k * n + q];
+                    A[k * n + p] = c * akp - s * akq;
+                    A[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; ++k) {
+                    double apk = A[p * n + k];
+                    double aqk = A[q * n + k];
+                    A[p * n + k] = c * apk - s * aqk;
+                    A[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; ++k) {
+                    double vkp = V[k * n + p];
+                    double vkq = V[k * n + q];
+                    V[k * n + p] = c * vkp - s * vkq;
+                    V[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+}
+
+// full forces for the state (x, v) projected onto the basis
+void ReducedModel::Forces(SpringSystem& ss, const vector<double>& x, const vector<double>& v,
+                          vector<double>& reduced) {
+    int dimX = ss.DimX();
+    int dimY = ss.DimY();
+    for (int r = 0; r < dimY; ++r) {
+        for (int c = 0; c < dimX; ++c) {
+            int i = 3 * (r * dimX + c);
+            Node& n = ss.GetNode(r, c);
+            n.pos = highp_dvec3(x[i], x[i + 1], x[i + 2]);
+            n.vel = highp_dvec3(v[i], v[i + 1], v[i + 2]);
+        }
+    }
+    vector<highp_dvec3> storage(ss.NumStorageNodes());
+    ss.ComputeForces(&storage[0]);
+    // back to the row major order of the basis
+    vector<highp_dvec3> f(dimX * dimY);
+    for (int r = 0; r < dimY; ++r)
+        for (int c = 0; c < dimX; ++c)
+            f[r * dimX + c] = storage[ss.NodeIndex(r, c)];
+    const double* fd = (const double*) &f[0];
+    reduced.assign(numModes_, 0);
+    for (int i = 0; i < numDofs_; ++i)
+        for (int k = 0; k < numModes_; ++k)
+            reduced[k] += basis_[i * numModes_ + k] * fd[i];
+}
+
+// PCA by the method of snapshots: the eigenvectors of the small snapshot Gram matrix
+// give the principal directions without ever forming the numDofs^2 covariance.
+bool ReducedModel::Build(SpringSystem& ss, int numModes) {
+    int s = snapshots_.size();
+    if (s < 2)
+        return false;
+    numDofs_ = snapshots_[0].size();
+    mass_ = ss.GetMass();
+
+    mean_.assign(numDofs_, 0);
+    for (int j = 0; j < s; ++j)
+        for (int i = 0; i < numDofs_; ++i)
+            mean_[i] += snapshots_[j][i] / s;
+
+    vector<double> gram(s * s), V;
+    #pragma omp parallel for schedule(dynamic)
+    for (int a = 0; a < s; ++a) {
+        for (int b = a; b < s; ++b) {
+            double sum = 0;
+            for (int i = 0; i < numDofs_; ++i)
+                sum += (snapshots_[a][i] - mean_[i]) * (snapshots_[b][i] - mean_[i]);
+            gram[a * s + b] = sum;
+            gram[b * s + a] = sum;
+        }
+    }
+    JacobiEigen(gram, V, s);
+
+    vector<int> order(s);
+    for (int i = 0; i < s; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](int a, int b) { return gram[a * s + a] > gram[b * s + b]; });
+    double largest = gram[order[0] * s + order[0]];
+    numModes_ = 0;
+    while (numModes_ < std::min(numModes, s) &&
+           gram[order[numModes_] * s + order[numModes_]] > 1e-12 * largest)
+        ++numModes_;
+    if (numModes_ == 0)
+        return false;
+
+    basis_.assign(numDofs_ * numModes_, 0);
+    for (int k = 0; k < numModes_; ++k) {
+        int e = order[k];
+        double scale = 1 / sqrt(gram[e * s + e]);
+        #pragma omp parallel for
+        for (int i = 0; i < numDofs_; ++i) {
+            double sum = 0;
+            for (int j = 0; j < s; ++j)
+                sum += (snapshots_[j][i] - mean_[i]) * V[j * s + e];
+            basis_[i * numModes_ + k] = sum * scale;
+        }
+    }
+
+    // linearize the forces around the mean at rest with central differences along each
+    // mode. The cloth's own state is restored afterwards.
+    vector<Node> saved(numDofs_ / 3);
+    for (int r = 0; r < ss.DimY(); ++r)
+        for (int c = 0; c < ss.DimX(); ++c)
+            saved[r * ss.DimX() + c] = ss.GetNode(r, c);
+
+    const double eps = 1e-4;
+    vector<double> zero(numDofs_, 0), x(numDofs_), v(numDofs_), fp, fm;
+    Forces(ss, mean_, zero, f0_);
+    K_.assign(numModes_ * numModes_, 0);
+    D_.assign(numModes_ * numModes_, 0);
+    for (int k = 0; k < numModes_; ++k) {
+        for (int i = 0; i < numDofs_; ++i)
+            x[i] = mean_[i] + eps * basis_[i * numModes_ + k];
+        Forces(ss, x, zero, fp);
+        for (int i = 0; i < numDofs_; ++i)
+            x[i] = mean_[i] - eps * basis_[i * numModes_ + k];
+        Forces(ss, x, zero, fm);
+        for (int j = 0; j < numModes_; ++j)
+            K_[j * numModes_ + k] = (fp[j] - fm[j]) / (2 * eps);
+
+        for (int i = 0; i < numDofs_; ++i)
+            v[i] = eps * basis_[i * numModes_ + k];
+        Forces(ss, mean_, v, fp);
+        for (int i = 0; i < numDofs_; ++i)
+            v[i] = -eps * basis_[i * numModes_ + k];
+        Forces(ss, mean_, v, fm);
+        for (int j = 0; j < numModes_; ++j)
+            D_[j * numModes_ + k] = (fp[j] - fm[j]) / (2 * eps);
+    }
+
+    for (int r = 0; r < ss.DimY(); ++r)
+        for (int c = 0; c < ss.DimX(); ++c)
+            ss.GetNode(r, c) = saved[r * ss.DimX() + c];
+    Project(ss);
+    // the basis has all it needs from them
+    Recording(false);
+    return true;
+}
+
+// reduced coordinates of the cloth's current state, q = U^T (x - mean), q' = U^T v
+void ReducedModel::Project(SpringSystem& ss) {
+    q_.assign(numModes_, 0);
+    qd_.assign(numModes_, 0);
+    int dimX = ss.DimX();
+    for (int r = 0; r < ss.DimY(); ++r) {
+        for (int c = 0; c < dimX; ++c) {
+            Node& n = ss.GetNode(r, c);
+            int i = 3 * (r * dimX + c);
+            for (int d = 0; d < 3; ++d) {
+                const double* row = &basis_[(i + d) * numModes_];
+                double dx = n.pos[d] - mean_[i + d];
+                double v = n.vel[d];
+                for (int k = 0; k < numModes_; ++k) {
+                    q_[k] += row[k] * dx;
+                    qd_[k] += row[k] * v;
+                }
+            }
+        }
+    }
+}
+
+void ReducedModel::Step(double dt) {
+    vector<double> acc(numModes_);
+    for (int j = 0; j < numModes_; ++j) {
+        double f = f0_[j];
+        for (int k = 0; k < numModes_; ++k)
+            f += K_[j * numModes_ + k] * q_[k] + D_[j * numModes_ + k] * qd_[k];
+        acc[j] = f / mass_;
+    }
+    for (int k = 0; k < numModes_; ++k) {
+        qd_[k] += acc[k] * dt;
+        q_[k] += qd_[k] * dt;
+    }
+}
+
+// x = mean + U q and v = U q' for every node, split over rows of the basis
+void ReducedModel::Reconstruct(SpringSystem& ss) {
+    int dimX = ss.DimX();
+    int numNodes = numDofs_ / 3;
+    #pragma omp parallel for schedule(static)
+    for (int n = 0; n < numNodes; ++n) {
+        Node& node = ss.GetNode(n / dimX, n % dimX);
+        for (int d = 0; d < 3; ++d) {
+            const double* row = &basis_[(3 * n + d) * numModes_];
+            double x = mean_[3 * n + d];
+            double v = 0;
+            for (int k = 0; k < numModes_; ++k) {
+                x += row[k] * q_[k];
+                v += row[k] * qd_[k];
+            }
+            node.pos[d] = x;
+            node.vel[d] = v;
+        }
+    }
+}
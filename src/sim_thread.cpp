@@ -0,0 +1,239 @@
+#include "include/sim_thread.h"
+#include <algorithm>
+#include <chrono>
+
+// seconds on the steady clock, which is what the frames are stamped with
+static double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ClothFrame::Interpolate(float alpha, vector<vec3>& outPositions, vector<mat4>& outSpheres) const {
+    outPositions.resize(positions.size());
+    // a frame published after a layout change or a new sphere has nothing to start from
+    if (previous.size() == positions.size()) {
+        for (size_t i = 0; i < positions.size(); ++i)
+            outPositions[i] = mix(previous[i], positions[i], alpha);
+    } else {
+        outPositions = positions;
+    }
+    outSpheres.resize(spheres.size());
+    for (size_t i = 0; i < spheres.size(); ++i)
+        outSpheres[i] = i < previousSpheres.size() ?
+            previousSpheres[i] + (spheres[i] - previousSpheres[i]) * alpha : spheres[i];
+}
+
+void StepCloth(SpringSystem& ss, vector<Sphere>& spheres, ReducedModel& reduced,
+               MixedSpringSystem& mixed, SubstepScheduler& scheduler, float frameDt) {
+    for (Sphere& sphere : spheres)
+        if (!sphere.Dynamic())
+            sphere.Update(frameDt);
+
+    int substeps = scheduler.Plan(ss, reduced, mixed);
+    scheduler.StartFrame();
+    for (int i = 0; i < substeps; i++) {
+        // spheres with mass are stepped with the cloth so they exchange momentum every substep
+        for (Sphere& sphere : spheres)
+            if (sphere.Dynamic())
+                sphere.Update(0.0015 / substeps);
+        if (mixed.Loaded()) {
+            mixed.Step(0.0015 / substeps);
+            mixed.HandleCollisions(spheres);
+        } else if (reduced.Built()) {
+            reduced.Step(0.0015 / substeps);
+        } else {
+            ss.Update(0.0015 / substeps, spheres);
+        }
+    }
+    scheduler.SubstepsDone();
+    if (mixed.Loaded())
+        mixed.Store(ss);
+    else if (reduced.Built())
+        reduced.Reconstruct(ss);
+    else if (reduced.Recording())
+        reduced.Record(ss);
+    scheduler.EndFrame();
+}
+
+bool HandleSimInput(const SDL_Event& event, SpringSystem& ss, vector<Sphere>& spheres,
+                    SubstepScheduler& scheduler) {
+    Sphere& sphere = spheres[0];
+    if (event.type == SDL_KEYDOWN) {
+        bool print = false;
+        switch (event.key.keysym.sym) {
+            case SDLK_i:
+                // increase KS
+                ss.SetKS(ss.GetKS() + 10);
+                print = true;
+                break;
+            case SDLK_k:
+                // decrease KS
+                ss.SetKS(std::fmax(1, ss.GetKS() - 10));
+                print = true;
+                break;
+            case SDLK_l:
+                // increase KD
+                ss.SetKD(ss.GetKD() + 20);
+                print = true;
+                break;
+            case SDLK_j:
+                // decrease KD
+                ss.SetKD(std::fmax(1, ss.GetKD() - 10));
+                print = true;
+                break;
+            case SDLK_p:
+                ss.Pause();
+                break;
+            case SDLK_SPACE:
+                ss.Drag(!ss.Drag());
+                if (ss.Drag())
+                    cout << "Drag is on" << endl;
+                else
+                    cout << "Drag is off" << endl;
+                break;
+            case SDLK_LEFT:
+                sphere.velocity.x = -1;
+                break;
+            case SDLK_RIGHT:
+                sphere.velocity.x = 1;
+                break;
+            case SDLK_UP:
+                sphere.velocity.z = -1;
+                break;
+            case SDLK_DOWN:
+                sphere.velocity.z = 1;
+                break;
+            case SDLK_v:
+                ss.SpringSetup(true);
+                break;
+            case SDLK_x:
+                ss.stuck = !ss.stuck;
+                break;
+            case SDLK_z:
+                if (ss.wind == 0)
+                    ss.wind = 1;
+                else
+                    ss.wind = 0;
+                break;
+            case SDLK_h:
+                ss.SpringSetup(false);
+                break;
+            case SDLK_b:
+                // drop a sphere with mass onto the cloth
+                spheres.push_back(Sphere(glm::vec3(0.1 * ss.DimX() / 2, 8, 0.5), 0.5, 1));
+                break;
+            case SDLK_f:
+                scheduler.Enabled(!scheduler.Enabled());
+                if (scheduler.Enabled())
+                    cout << "Frame budget of " << scheduler.Budget() * 1000 << " ms is on" << endl;
+                else
+                    cout << "Frame budget is off" << endl;
+                break;
+            case SDLK_t:
+                // picking the mode by hand turns the budget off
+                scheduler.Enabled(false);
+                ss.StrainLimit(!ss.StrainLimit());
+                if (ss.StrainLimit())
+                    cout << "Strain limiting is on" << endl;
+                else
+                    cout << "Strain limiting is off" << endl;
+                break;
+            default:
+                return false;
+        }
+        if (print) {
+            cout << "KS: " << ss.GetKS() << endl;
+            cout << "KD: " << ss.GetKD() << endl;
+        }
+        return true;
+    } else if (event.type == SDL_KEYUP) {
+        switch (event.key.keysym.sym) {
+            case SDLK_LEFT:
+            case SDLK_RIGHT:
+                sphere.velocity.x = 0;
+                return true;
+            case SDLK_UP:
+            case SDLK_DOWN:
+                sphere.velocity.z = 0;
+                return true;
+        }
+    }
+    return false;
+}
+
+SimThread::SimThread(SpringSystem& ss, vector<Sphere>& spheres, ReducedModel& reduced,
+                     MixedSpringSystem& mixed, SubstepScheduler& scheduler) :
+    ss_(ss),
+    spheres_(spheres),
+    reduced_(reduced),
+    mixed_(mixed),
+    scheduler_(scheduler),
+    running_(false)
+{
+}
+
+SimThread::~SimThread() {
+    Stop();
+}
+
+void SimThread::Start() {
+    if (running_)
+        return;
+    // the renderer has a frame before the first step is done
+    Publish();
+    running_ = true;
+    thread_ = std::thread(&SimThread::Run, this);
+}
+
+void SimThread::Stop() {
+    running_ = false;
+    if (thread_.joinable())
+        thread_.join();
+}
+
+float SimThread::Alpha(const ClothFrame& frame) {
+    return std::min(1.0, std::max(0.0, (Now() - frame.time) * SIM_RATE));
+}
+
+void SimThread::Capture(vector<vec3>& positions, vector<mat4>& spheres) {
+    ss_.CopyPositions(positions);
+    spheres.resize(spheres_.size());
+    for (size_t i = 0; i < spheres_.size(); ++i)
+        spheres[i] = spheres_[i].GetModelMatrix();
+}
+
+void SimThread::Publish() {
+    ClothFrame& frame = frames_.Back();
+    Capture(frame.positions, frame.spheres);
+    frame.previous = frame.positions;
+    frame.previousSpheres = frame.spheres;
+    frame.time = Now();
+    frames_.Publish();
+}
+
+void SimThread::Run() {
+    FixedTimestep timestep(1.0 / SIM_RATE, SIM_MAX_STEPS);
+    double last = Now();
+    while (running_) {
+        double now = Now();
+        int steps = timestep.Advance(now - last);
+        last = now;
+        if (steps > 0) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            SDL_Event event;
+            while (events_.Pop(event))
+                HandleSimInput(event, ss_, spheres_, scheduler_);
+            ClothFrame& frame = frames_.Back();
+            for (int i = 0; i < steps; ++i) {
+                if (i == steps - 1)
+                    Capture(frame.previous, frame.previousSpheres);
+                StepCloth(ss_, spheres_, reduced_, mixed_, scheduler_, timestep.Step());
+            }
+            Capture(frame.positions, frame.spheres);
+            // the clock is already Accumulated() seconds into the next frame
+            frame.time = now - timestep.Accumulated();
+            frames_.Publish();
+        }
+        // sleep until the next frame is due
+        std::this_thread::sleep_for(std::chrono::duration<double>(timestep.Step() - timestep.Accumulated()));
+    }
+}
@@ -1,10 +1,16 @@
 #include "include/sphere.h"
 
+#define GRAVITY glm::vec3(0, -9.81, 0)
+#define FLOOR_HEIGHT -10
+
 Sphere::Sphere() : Sphere(glm::vec3(0,0,0), 1) {}
 
-Sphere::Sphere(glm::vec3 pos, float r) {
+Sphere::Sphere(glm::vec3 pos, float r) : Sphere(pos, r, 0) {}
+
+Sphere::Sphere(glm::vec3 pos, float r, float m) {
     position = pos;
     radius = r;
+    mass = m;
     velocity = glm::vec3(0);
 }
 
@@ -12,7 +18,23 @@ Sphere::~Sphere() {
 }
 
 void Sphere::Update(float dt) {
-    position += dt * velocity * 2;
+    if (!Dynamic()) {
+        position += dt * velocity * 2;
+        return;
+    }
+
+    velocity += dt * GRAVITY;
+    position += dt * velocity;
+    if (position.y - radius < FLOOR_HEIGHT) {
+        position.y = FLOOR_HEIGHT + radius;
+        if (velocity.y < 0)
+            velocity.y *= -0.5f;
+    }
+}
+
+void Sphere::ApplyImpulse(glm::vec3 j) {
+    if (Dynamic())
+        velocity += j / mass;
 }
 
 glm::mat4 Sphere::GetModelMatrix() {
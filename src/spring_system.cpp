@@ -1,27 +1,98 @@
 #include "include/spring_system.h"
-#include "include/shape_vertices.h"
+#include "include/spring_law.h"
+#include "include/spring_kernels.h"
+#include "include/numa.h"
+#include "include/level_kernels.h"
+#include "include/auto_tune.h"
 #include <omp.h>
+#include <algorithm>
+#include <new>
+
+// built by kernels_<level>.cpp
+LEVEL_KERNELS(extern, CPU_AVX2)
+LEVEL_KERNELS(extern, CPU_AVX512)
+
+// dispatch tables of the kernels of one level, indexed like the ones of ComputeForcesT
+#define FORCE_KERNELS(LEVEL, KERNEL) { \
+        &SpringSystem::KERNEL<LEVEL, false, false, false>, \
+        &SpringSystem::KERNEL<LEVEL, false, false, true>, \
+        &SpringSystem::KERNEL<LEVEL, false, true, false>, \
+        &SpringSystem::KERNEL<LEVEL, false, true, true>, \
+        &SpringSystem::KERNEL<LEVEL, true, false, false>, \
+        &SpringSystem::KERNEL<LEVEL, true, false, true>, \
+        &SpringSystem::KERNEL<LEVEL, true, true, false>, \
+        &SpringSystem::KERNEL<LEVEL, true, true, true> \
+    }
+#define TILED_STEPS(LEVEL) { \
+        &SpringSystem::TiledStepT<LEVEL, false, false, false, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, false, false, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, false, true, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, false, true, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, true, false, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, true, false, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, true, true, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, false, true, true, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, false, false, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, false, false, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, false, true, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, false, true, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, true, false, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, true, false, EXPLICIT_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, true, true, SYMPLECTIC_EULER>, \
+        &SpringSystem::TiledStepT<LEVEL, true, true, true, EXPLICIT_EULER> \
+    }
+#define PADDED_PIECES(LEVEL) { \
+        &SpringSystem::PaddedPiecesT<LEVEL, false, false>, \
+        &SpringSystem::PaddedPiecesT<LEVEL, false, true>, \
+        &SpringSystem::PaddedPiecesT<LEVEL, true, false>, \
+        &SpringSystem::PaddedPiecesT<LEVEL, true, true> \
+    }
+#define BAND_INTEGRATORS(LEVEL) { \
+        &SpringSystem::IntegrateBandT<LEVEL, SYMPLECTIC_EULER, false>, \
+        &SpringSystem::IntegrateBandT<LEVEL, SYMPLECTIC_EULER, true>, \
+        &SpringSystem::IntegrateBandT<LEVEL, EXPLICIT_EULER, false>, \
+        &SpringSystem::IntegrateBandT<LEVEL, EXPLICIT_EULER, true> \
+    }
 
 #define RADIUS .2f
-#define GRAVITY highp_dvec3(0, -9.81, 0)
 
 SpringSystem::SpringSystem() :
     SpringSystem(10, 10, 50, 10) {}
 
-SpringSystem::SpringSystem(int dimx, int dimy, double ks, double kd) {
+SpringSystem::SpringSystem(int dimx, int dimy, double ks, double kd) :
+    SpringSystem(dimx, dimy, ks, kd, 0.1, 0.1) {}
+
+SpringSystem::SpringSystem(int dimx, int dimy, double ks, double kd, double restLength,
+                           double mass) :
+    SpringSystem(dimx, dimy, ks, kd, restLength, mass, AllocateNodes(dimx * dimy, dimx)) {
+    callerNodes_ = nullptr;
+}
+
+SpringSystem::SpringSystem(int dimx, int dimy, double ks, double kd, double restLength,
+                           double mass, Node* nodes) {
     dimX_ = dimx;
     dimY_ = dimy;
     numNodes_ = dimX_ * dimY_;
     numTris_ = 2 * (dimX_ - 1) * (dimY_ - 1);
-    nodes_ = new Node[numNodes_];
+    nodes_ = nodes;
+    callerNodes_ = nodes;
+    forces_.resize(numNodes_);
+    layout_ = ROW_MAJOR;
+    padStride_ = 0;
+    rowOffset_.resize(dimY_);
+    colOffset_.resize(dimX_);
+    for (int r = 0; r < dimY_; ++r)
+        rowOffset_[r] = r * dimX_;
+    for (int c = 0; c < dimX_; ++c)
+        colOffset_[c] = c;
 
     textured_ = false;
     paused_ = false;
 
     KS_ = ks;
     KD_ = kd;
-    mass_ = 0.1;
-    restLength_ = 0.1;
+    mass_ = mass;
+    restLength_ = restLength;
 
     initDX_ = restLength_;
     initDY_ = restLength_;
@@ -29,6 +100,54 @@ SpringSystem::SpringSystem(int dimx, int dimy, double ks, double kd) {
     wind_ = vec3(0, 0, -.5);
     stuck = true;
     wind = 0;
+
+    integrator_ = SYMPLECTIC_EULER;
+    strainLimit_ = false;
+    minStretch_ = 0.9;
+    maxStretch_ = 1.1;
+    strainIterations_ = 2;
+
+    masked_ = false;
+    numaBands_ = false;
+    autoTune_ = false;
+    threads_ = 0;
+    level_ = KernelLevel();
+    tiled_ = false;
+    tileRows_ = 32;
+    tileCols_ = 64;
+    next_ = nullptr;
+    pool_ = nullptr;
+    normalsPool_ = nullptr;
+    stepGraph_ = nullptr;
+    stepGraphKey_ = -1;
+    normalsGraph_ = nullptr;
+    normalsGraphKey_ = -1;
+    stepDt_ = 0;
+    stepSpheres_ = nullptr;
+    stepNumSpheres_ = 0;
+    uploadSource_ = nullptr;
+    posArray_ = nullptr;
+    normals_ = nullptr;
+    texCoords_ = nullptr;
+    indices_ = nullptr;
+    gl_ = nullptr;
+    glDeleter_ = nullptr;
+    renderDataChanged_ = false;
+}
+
+SpringSystem::~SpringSystem() {
+    if (glDeleter_)
+        glDeleter_(gl_);
+    if (nodes_ != callerNodes_)
+        FreeNodes(nodes_);
+    if (next_ && next_ != callerNodes_)
+        FreeNodes(next_);
+    delete stepGraph_;
+    delete normalsGraph_;
+    delete[] posArray_;
+    delete[] normals_;
+    delete[] texCoords_;
+    delete[] indices_;
 }
 
 void SpringSystem::SpringSetup(bool vertical) {
@@ -44,341 +163,878 @@ void SpringSystem::SpringSetup(bool vertical) {
     }
 }
 
-void SpringSystem::UpdateGPUPositions() {
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_; ++c) {
-            Node& n = GetNode(r, c);
-            posArray_[r*dimX_ + c] = n.pos;
+void SpringSystem::CopyPositions(vector<vec3>& positions) {
+    positions.resize(numNodes_);
+    for (int r = 0; r < dimY_; ++r)
+        for (int c = 0; c < dimX_; ++c)
+            positions[NodeIndex(r, c)] = vec3(GetNode(r, c).pos);
+}
+
+void SpringSystem::PrepareUpload(const vec3* source) {
+    if (pool_ && !masked_) {
+        GraphNormals(source);
+        return;
+    }
+    if (source) {
+        if (source != posArray_)
+            std::copy(source, source + numNodes_, posArray_);
+    } else {
+        for (int r = 0; r < dimY_; ++r) {
+            for (int c = 0; c < dimX_; ++c) {
+                Node& n = GetNode(r, c);
+                posArray_[NodeIndex(r, c)] = n.pos;
+            }
         }
     }
     RecalculateNormals();
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_VERTS]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, &posArray_[0], GL_STREAM_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_NORMS]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, &normals_[0], GL_STREAM_DRAW);
+}
+
+// Bands of rows copy their positions, then work out the normals of the quads below them
+// once the band below has its positions, then add up the normals of their nodes once
+// the band above has its quads. Every node adds its quads in the order the loop below
+// scatters them, so the normals come out the same.
+void SpringSystem::GraphNormals(const vec3* source) {
+    typedef void (SpringSystem::*BandKernel)(int, int);
+    static const BandKernel quadKernels[CPU_LEVELS] = {
+        &SpringSystem::QuadNormalsT<CPU_SSE2>,
+        &SpringSystem::QuadNormalsT<CPU_AVX2>,
+        &SpringSystem::QuadNormalsT<CPU_AVX512>
+    };
+    static const BandKernel gatherKernels[CPU_LEVELS] = {
+        &SpringSystem::GatherNormalsT<CPU_SSE2>,
+        &SpringSystem::GatherNormalsT<CPU_AVX2>,
+        &SpringSystem::GatherNormalsT<CPU_AVX512>
+    };
+    TaskPool& pool = normalsPool_ ? *normalsPool_ : *pool_;
+    const int bands = NumBands(pool, dimY_);
+    const CpuLevel level = level_;
+    const int key = CPU_LEVELS * bands + level;
+    quadNormals_.resize(2 * (dimX_ - 1) * (dimY_ - 1));
+    if (!normalsGraph_)
+        normalsGraph_ = new TaskGraph;
+    if (key != normalsGraphKey_) {
+        BandKernel quadKernel = quadKernels[level];
+        BandKernel gatherKernel = gatherKernels[level];
+        normalsGraph_->Clear();
+        vector<int> upload(bands), quads(bands), gather(bands);
+        for (int b = 0; b < bands; ++b) {
+            const int rowBegin = dimY_ * b / bands;
+            const int rowEnd = dimY_ * (b + 1) / bands;
+            upload[b] = normalsGraph_->Add([=]() { UploadRows(rowBegin, rowEnd); });
+            quads[b] = normalsGraph_->Add([=]() { (this->*quadKernel)(rowBegin, rowEnd); });
+            gather[b] = normalsGraph_->Add([=]() { (this->*gatherKernel)(rowBegin, rowEnd); });
+        }
+        for (int b = 0; b < bands; ++b) {
+            normalsGraph_->Precede(upload[b], quads[b]);
+            if (b + 1 < bands)
+                normalsGraph_->Precede(upload[b + 1], quads[b]);
+            normalsGraph_->Precede(quads[b], gather[b]);
+            if (b > 0)
+                normalsGraph_->Precede(quads[b - 1], gather[b]);
+        }
+        normalsGraphKey_ = key;
+    }
+    uploadSource_ = source;
+    normalsGraph_->Run(pool);
+}
+
+void SpringSystem::UploadRows(int rowBegin, int rowEnd) {
+    if (uploadSource_ == posArray_)
+        return;
+    for (int r = rowBegin; r < rowEnd; ++r) {
+        for (int c = 0; c < dimX_; ++c) {
+            int i = NodeIndex(r, c);
+            posArray_[i] = uploadSource_ ? uploadSource_[i] : vec3(nodes_[i].pos);
+        }
+    }
 }
 
 void SpringSystem::RecalculateNormals() {
+    typedef void (SpringSystem::*BandKernel)(int, int);
+    static const BandKernel quadKernels[CPU_LEVELS] = {
+        &SpringSystem::QuadNormalsT<CPU_SSE2>,
+        &SpringSystem::QuadNormalsT<CPU_AVX2>,
+        &SpringSystem::QuadNormalsT<CPU_AVX512>
+    };
+    static const BandKernel gatherKernels[CPU_LEVELS] = {
+        &SpringSystem::GatherNormalsT<CPU_SSE2>,
+        &SpringSystem::GatherNormalsT<CPU_AVX2>,
+        &SpringSystem::GatherNormalsT<CPU_AVX512>
+    };
+    if (pool_ && !masked_) {
+        GraphNormals(posArray_);
+        return;
+    }
+    if (!masked_) {
+        // the phases of GraphNormals, every thread on its band of rows. A node only
+        // writes its own normal, so nothing races.
+        quadNormals_.resize(2 * (dimX_ - 1) * (dimY_ - 1));
+        BandKernel quadKernel = quadKernels[level_];
+        BandKernel gatherKernel = gatherKernels[level_];
+        #pragma omp parallel
+        {
+            int rowBegin, rowEnd;
+            RowBand(dimY_, omp_get_thread_num(), omp_get_num_threads(), rowBegin, rowEnd);
+            (this->*quadKernel)(rowBegin, rowEnd);
+            #pragma omp barrier
+            (this->*gatherKernel)(rowBegin, rowEnd);
+        }
+        return;
+    }
     // reset normals
     for (int r = 0; r < dimY_; r++)
         for (int c = 0; c < dimX_; c++)
-            normals_[r*dimX_ + c] = vec3(0, 0, 0);
+            normals_[NodeIndex(r, c)] = vec3(0, 0, 0);
 
-    int i = 0;
-    #pragma omp parallel for
-    for (unsigned int r = 0; r < dimY_ - 1; ++r) {
-        for (unsigned int c = 0; c < dimX_ - 1; ++c) {
-            vec3 ul = posArray_[indices_[i + 0]];
-            vec3 ll = posArray_[indices_[i + 1]];
-            vec3 ur = posArray_[indices_[i + 2]];
-            vec3 lr = posArray_[indices_[i + 5]];
-            vec3 e12 = ll - ul;
-            vec3 e13 = ur - ul;
-            vec3 e34 = lr - ur;
-            vec3 norm1 = cross(e12, e13);
-            vec3 norm2 = cross(-e13, e34);
-            normals_[(r + 0) * dimX_ + (c + 0)] += norm1;
-            normals_[(r + 1) * dimX_ + (c + 0)] += norm1;
-            normals_[(r + 0) * dimX_ + (c + 1)] += norm1;
-            normals_[(r + 0) * dimX_ + (c + 1)] += norm2;
-            normals_[(r + 1) * dimX_ + (c + 0)] += norm2;
-            normals_[(r + 1) * dimX_ + (c + 1)] += norm2;
-            i += 6;
+    for (int color = 0; color < 4; ++color) {
+        const int numQuads = quadTris_[color].size();
+        #pragma omp parallel for schedule(static)
+        for (int q = 0; q < numQuads; ++q) {
+            int ul = quads_[color][4*q + 0];
+            int ll = quads_[color][4*q + 1];
+            int ur = quads_[color][4*q + 2];
+            int lr = quads_[color][4*q + 3];
+            if (quadTris_[color][q] & 1) {
+                vec3 norm1 = cross(posArray_[ll] - posArray_[ul], posArray_[ur] - posArray_[ul]);
+                normals_[ul] += norm1;
+                normals_[ll] += norm1;
+                normals_[ur] += norm1;
+            }
+            if (quadTris_[color][q] & 2) {
+                vec3 norm2 = cross(posArray_[ul] - posArray_[ur], posArray_[lr] - posArray_[ur]);
+                normals_[ur] += norm2;
+                normals_[ll] += norm2;
+                normals_[lr] += norm2;
+            }
         }
     }
     for (int r = 0; r < dimY_; r++)
         for (int c = 0; c < dimX_; c++)
-            normals_[r*dimX_ + c] = normalize(normals_[r*dimX_ + c]);
+            normals_[NodeIndex(r, c)] = normalize(normals_[NodeIndex(r, c)]);
 }
 
-void SpringSystem::GLSetup() {
-    // allocate and fill buffers
-    posArray_ = new vec3[numNodes_];
-    normals_ = new vec3[numNodes_];
-    texCoords_ = new vec2[numNodes_];
-    indices_ = new unsigned int[3 * numTris_];
-
-    int i = 0;
+// texture coordinates in the order the nodes are stored, padding included
+void SpringSystem::FillTexCoords() {
+    for (int i = 0; i < numNodes_; ++i)
+        texCoords_[i] = vec2(0, 0);
     for (int r = 0; r < dimY_; ++r) {
         for (int c = 0; c < dimX_; ++c) {
             float x = c / (float) dimX_;
             float y = 1.0f - r / (float) dimY_;
-            texCoords_[i++] = vec2(x, y);
+            texCoords_[NodeIndex(r, c)] = vec2(x, y);
         }
     }
+}
 
-    i = 0;
+void SpringSystem::RenderSetup() {
+    // allocate and fill buffers
+    posArray_ = new vec3[numNodes_];
+    normals_ = new vec3[numNodes_];
+    texCoords_ = new vec2[numNodes_];
+    indices_ = new unsigned int[6 * (dimX_ - 1) * (dimY_ - 1)];
+
+    FillTexCoords();
+    BuildRenderIndices();
+}
+
+// triangles and spring lines of everything that is not masked out
+void SpringSystem::BuildRenderIndices() {
+    int i = 0;
     for (unsigned int r = 0; r < dimY_ - 1; ++r) {
         for (unsigned int c = 0; c < dimX_ - 1; ++c) {
-            unsigned int ul = (r + 0) * dimX_ + (c + 0);
-            unsigned int ll = (r + 1) * dimX_ + (c + 0);
-            unsigned int ur = (r + 0) * dimX_ + (c + 1);
-            unsigned int lr = (r + 1) * dimX_ + (c + 1);
-            indices_[i++] = ul;
-            indices_[i++] = ll;
-            indices_[i++] = ur;
-            indices_[i++] = ur;
-            indices_[i++] = ll;
-            indices_[i++] = lr;
+            unsigned int ul = NodeIndex(r + 0, c + 0);
+            unsigned int ll = NodeIndex(r + 1, c + 0);
+            unsigned int ur = NodeIndex(r + 0, c + 1);
+            unsigned int lr = NodeIndex(r + 1, c + 1);
+            int g = r*dimX_ + c;
+            if (!masked_ || (nodeMask_[g] && nodeMask_[g + dimX_] && nodeMask_[g + 1])) {
+                indices_[i++] = ul;
+                indices_[i++] = ll;
+                indices_[i++] = ur;
+            }
+            if (!masked_ || (nodeMask_[g + 1] && nodeMask_[g + dimX_] && nodeMask_[g + dimX_ + 1])) {
+                indices_[i++] = ur;
+                indices_[i++] = ll;
+                indices_[i++] = lr;
+            }
         }
     }
+    numTris_ = i / 3;
 
-    // setup textured cloth opengl stuff
-    cloth_shader_.LoadFromFile(GL_VERTEX_SHADER, "shaders/cloth_shader.vert");
-    cloth_shader_.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/cloth_shader.frag");
-    cloth_shader_.CreateAndLinkProgram();
-    cloth_shader_.Enable();
-    cloth_shader_.AddAttribute("inPos");
-    cloth_shader_.AddAttribute("inNormal");
-    cloth_shader_.AddAttribute("texCoords");
-    cloth_shader_.AddUniform("VP");
-    cloth_shader_.AddUniform("normalMatrix");
-    cloth_shader_.AddUniform("tex");
-
-    cloth_texture_ = LoadTexture("textures/blue_cloth.jpg");
-
-    glGenVertexArrays(1, &cloth_vao_);
-    glBindVertexArray(cloth_vao_);
-    glGenBuffers(CLOTH_TOTAL_VBOS, cloth_vbos_);
-
-    // vertices
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_VERTS]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, NULL, GL_STREAM_DRAW);
-    glEnableVertexAttribArray(cloth_shader_["inPos"]);
-    glVertexAttribPointer(cloth_shader_["inPos"], 3, GL_FLOAT, GL_FALSE, 0, 0);
-    // normals 
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_NORMS]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, NULL, GL_STREAM_DRAW);
-    glEnableVertexAttribArray(cloth_shader_["inNormal"]);
-    glVertexAttribPointer(cloth_shader_["inNormal"], 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // tex coords
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_TEX_COORDS]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * numNodes_, &texCoords_[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(cloth_shader_["texCoords"]);
-    glVertexAttribPointer(cloth_shader_["texCoords"], 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // indices
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cloth_vbos_[CLOTH_INDICES]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numTris_ * 3,
-                 &indices_[0], GL_STATIC_DRAW);
-
-    // node - spring shader
-    spring_shader_.LoadFromFile(GL_VERTEX_SHADER, "shaders/spring_shader.vert");
-    spring_shader_.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/spring_shader.frag");
-    spring_shader_.CreateAndLinkProgram();
-    spring_shader_.Enable();
-    spring_shader_.AddAttribute("verts");
-    spring_shader_.AddUniform("model");
-    spring_shader_.AddUniform("VP");
-    spring_shader_.AddUniform("color");
-
-    glGenVertexArrays(1, &cube_vao_);
-    glBindVertexArray(cube_vao_);
-    glGenBuffers(1, &cube_vbo_);
-
-    // vertices
-    glBindBuffer(GL_ARRAY_BUFFER, cube_vbo_);
-    glBufferData(GL_ARRAY_BUFFER, CUBE_VERTS_SIZE, cube_data, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(spring_shader_["verts"]);
-    glVertexAttribPointer(spring_shader_["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glGenVertexArrays(1, &spring_vao_);
-    glBindVertexArray(spring_vao_);
-
-    // vertices
-    glBindBuffer(GL_ARRAY_BUFFER, cloth_vbos_[CLOTH_VERTS]);
-    glEnableVertexAttribArray(spring_shader_["verts"]);
-    glVertexAttribPointer(spring_shader_["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-
-    // indices
-    // horizontal lines
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_ - 1; ++c) {
-            spring_indices_.push_back(r*dimX_ + c);
-            spring_indices_.push_back(r*dimX_ + c + 1);
+    spring_indices_.clear();
+    if (masked_) {
+        for (int color = 0; color < 4; ++color)
+            spring_indices_.insert(spring_indices_.end(), springs_[color].begin(),
+                                   springs_[color].end());
+    } else {
+        // horizontal lines
+        for (int r = 0; r < dimY_; ++r) {
+            for (int c = 0; c < dimX_ - 1; ++c) {
+                spring_indices_.push_back(NodeIndex(r, c));
+                spring_indices_.push_back(NodeIndex(r, c + 1));
+            }
+        }
+        for (int r = 0; r < dimY_ - 1; ++r) {
+            for (int c = 0; c < dimX_; ++c) {
+                spring_indices_.push_back(NodeIndex(r, c));
+                spring_indices_.push_back(NodeIndex(r + 1, c));
+            }
         }
     }
-    for (int r = 0; r < dimY_ - 1; ++r) {
+    renderDataChanged_ = true;
+}
+
+void SpringSystem::SetMask(const vector<unsigned char>& nodeMask,
+                           const vector<unsigned char>& verticalMask,
+                           const vector<unsigned char>& horizontalMask) {
+    masked_ = true;
+    nodeMask_ = nodeMask;
+    verticalMask_ = verticalMask;
+    horizontalMask_ = horizontalMask;
+    activeNodes_.clear();
+    for (int r = 0; r < dimY_; ++r)
+        for (int c = 0; c < dimX_; ++c)
+            if (nodeMask_[r*dimX_ + c])
+                activeNodes_.push_back(NodeIndex(r, c));
+    std::sort(activeNodes_.begin(), activeNodes_.end());
+
+    for (int color = 0; color < 4; ++color) {
+        springs_[color].clear();
+        pinnedSprings_[color] = 0;
+        quads_[color].clear();
+        quadTris_[color].clear();
+    }
+    for (int r = 0; r < dimY_; ++r) {
         for (int c = 0; c < dimX_; ++c) {
-            spring_indices_.push_back(r*dimX_ + c);
-            spring_indices_.push_back((r+1)*dimX_ + c);
+            int g = r*dimX_ + c;
+            if (r < dimY_ - 1 && nodeMask_[g] && nodeMask_[g + dimX_] &&
+                (verticalMask_.empty() || verticalMask_[g])) {
+                springs_[r & 1].push_back(NodeIndex(r, c));
+                springs_[r & 1].push_back(NodeIndex(r + 1, c));
+                if (r == 0)
+                    pinnedSprings_[r & 1]++;
+            }
+            if (c < dimX_ - 1 && nodeMask_[g] && nodeMask_[g + 1] &&
+                (horizontalMask_.empty() || horizontalMask_[r*(dimX_ - 1) + c])) {
+                springs_[2 + (c & 1)].push_back(NodeIndex(r, c));
+                springs_[2 + (c & 1)].push_back(NodeIndex(r, c + 1));
+                if (r == 0)
+                    pinnedSprings_[2 + (c & 1)]++;
+            }
+            if (r < dimY_ - 1 && c < dimX_ - 1) {
+                unsigned char tris = 0;
+                if (nodeMask_[g] && nodeMask_[g + dimX_] && nodeMask_[g + 1])
+                    tris |= 1;
+                if (nodeMask_[g + 1] && nodeMask_[g + dimX_] && nodeMask_[g + dimX_ + 1])
+                    tris |= 2;
+                if (tris) {
+                    int color = 2*(r & 1) + (c & 1);
+                    quads_[color].push_back(NodeIndex(r, c));
+                    quads_[color].push_back(NodeIndex(r + 1, c));
+                    quads_[color].push_back(NodeIndex(r, c + 1));
+                    quads_[color].push_back(NodeIndex(r + 1, c + 1));
+                    quadTris_[color].push_back(tris);
+                }
+            }
         }
     }
-    glGenBuffers(1, &spring_vbo_);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, spring_vbo_);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * spring_indices_.size(),
-                 &spring_indices_[0], GL_STATIC_DRAW);
+    if (indices_)
+        BuildRenderIndices();
+}
+
+void SpringSystem::ClearMask() {
+    masked_ = false;
+    nodeMask_.clear();
+    verticalMask_.clear();
+    horizontalMask_.clear();
+    activeNodes_.clear();
+    for (int color = 0; color < 4; ++color) {
+        springs_[color].clear();
+        pinnedSprings_[color] = 0;
+        quads_[color].clear();
+        quadTris_[color].clear();
+    }
+    if (indices_)
+        BuildRenderIndices();
 }
 
-void SpringSystem::Setup() {
+// spreads the bits of v out to every other bit, the two halves of a Morton code
+static int SpreadBits(int v) {
+    int spread = 0;
+    for (int b = 0; (v >> b) != 0; ++b)
+        spread |= ((v >> b) & 1) << (2 * b);
+    return spread;
+}
+
+#define LAYOUT_BLOCK 8
+// PADDED rows are a multiple of this many nodes, and the first node of each row is this
+// far into it so the rows start on the same boundary in the SoA copies
+#define GHOST_PAD 8
+// where the ghost nodes are parked, far from anything the cloth can reach
+#define GHOST_DISTANCE 1e6
+
+// Moves the nodes into the new order. Everything that indexes nodes (the kernels, the
+// mask lists and the vertex and index buffers) goes through NodeIndex, so the render
+// buffers are rebuilt in the new order too and the GPU draws the nodes where they are.
+void SpringSystem::SetLayout(NodeLayout layout) {
+    vector<int> rowOffset(dimY_);
+    vector<int> colOffset(dimX_);
+    int storage;
+    if (layout == MORTON) {
+        for (int r = 0; r < dimY_; ++r)
+            rowOffset[r] = SpreadBits(r) << 1;
+        for (int c = 0; c < dimX_; ++c)
+            colOffset[c] = SpreadBits(c);
+        storage = rowOffset[dimY_ - 1] + colOffset[dimX_ - 1] + 1;
+    } else if (layout == BLOCKED_MORTON) {
+        const int blockSize = LAYOUT_BLOCK * LAYOUT_BLOCK;
+        int blocksX = (dimX_ + LAYOUT_BLOCK - 1) / LAYOUT_BLOCK;
+        int blocksY = (dimY_ + LAYOUT_BLOCK - 1) / LAYOUT_BLOCK;
+        for (int r = 0; r < dimY_; ++r)
+            rowOffset[r] = (SpreadBits(r / LAYOUT_BLOCK) << 1) * blockSize + (r % LAYOUT_BLOCK) * LAYOUT_BLOCK;
+        for (int c = 0; c < dimX_; ++c)
+            colOffset[c] = SpreadBits(c / LAYOUT_BLOCK) * blockSize + c % LAYOUT_BLOCK;
+        storage = ((SpreadBits(blocksY - 1) << 1) + SpreadBits(blocksX - 1) + 1) * blockSize;
+    } else if (layout == PADDED) {
+        // a ghost row above and below, a ghost column on the left and at least one on
+        // the right
+        padStride_ = GHOST_PAD + (dimX_ + GHOST_PAD) / GHOST_PAD * GHOST_PAD;
+        for (int r = 0; r < dimY_; ++r)
+            rowOffset[r] = (r + 1) * padStride_ + GHOST_PAD;
+        for (int c = 0; c < dimX_; ++c)
+            colOffset[c] = c;
+        storage = (dimY_ + 2) * padStride_;
+    } else {
+        for (int r = 0; r < dimY_; ++r)
+            rowOffset[r] = r * dimX_;
+        for (int c = 0; c < dimX_; ++c)
+            colOffset[c] = c;
+        storage = dimX_ * dimY_;
+    }
+
+    const int rowLength = layout == PADDED ? padStride_ : dimX_;
+    Node* nodes = AllocateNodes(storage, rowLength);
+    for (int r = 0; r < dimY_; ++r)
+        for (int c = 0; c < dimX_; ++c)
+            nodes[rowOffset[r] + colOffset[c]] = GetNode(r, c);
+    FreeNodes(nodes_);
+    nodes_ = nodes;
+    if (next_) {
+        FreeNodes(next_);
+        next_ = AllocateNodes(storage, rowLength);
+    }
+    layout_ = layout;
+    rowOffset_.swap(rowOffset);
+    colOffset_.swap(colOffset);
+    numNodes_ = storage;
+    forces_.assign(numNodes_, highp_dvec3(0, 0, 0));
+    if (layout_ == PADDED)
+        SetupGhosts();
+    stepGraphKey_ = -1;
+    if (numaBands_)
+        PlaceBands();
+
+    if (indices_) {
+        delete[] posArray_;
+        delete[] normals_;
+        delete[] texCoords_;
+        posArray_ = new vec3[numNodes_];
+        normals_ = new vec3[numNodes_];
+        texCoords_ = new vec2[numNodes_];
+        FillTexCoords();
+        renderDataChanged_ = true;
+    }
+    if (masked_) {
+        vector<unsigned char> nodeMask = nodeMask_;
+        vector<unsigned char> verticalMask = verticalMask_;
+        vector<unsigned char> horizontalMask = horizontalMask_;
+        SetMask(nodeMask, verticalMask, horizontalMask);
+    } else if (indices_) {
+        BuildRenderIndices();
+    }
+}
+
+// Parks every storage slot of the PADDED layout that is not a node at its own spot, on
+// a grid far from the cloth, so no spring or triangle touching one is degenerate, and
+// weighs the springs and quads with 1 if they are part of the cloth and 0 if not.
+void SpringSystem::SetupGhosts() {
+    vector<unsigned char> real(numNodes_, 0);
+    for (int r = 0; r < dimY_; ++r)
+        for (int c = 0; c < dimX_; ++c)
+            real[NodeIndex(r, c)] = 1;
+    verticalWeight_.assign(numNodes_, 0);
+    horizontalWeight_.assign(numNodes_, 0);
+    quadWeight_.assign(numNodes_, 0);
+    for (int i = 0; i < numNodes_; ++i) {
+        if (!real[i]) {
+            nodes_[i].pos = highp_dvec3(GHOST_DISTANCE + i % padStride_,
+                                        GHOST_DISTANCE + i / padStride_, GHOST_DISTANCE);
+            nodes_[i].vel = highp_dvec3(0, 0, 0);
+        }
+        if (i >= padStride_ && real[i] && real[i - padStride_])
+            verticalWeight_[i] = 1;
+        if (i >= 1 && real[i] && real[i - 1])
+            horizontalWeight_[i] = 1;
+        if (i + padStride_ + 1 < numNodes_ && real[i] && real[i + 1] && real[i + padStride_] &&
+            real[i + padStride_ + 1])
+            quadWeight_[i] = 1;
+    }
+    if (next_)
+        std::copy(nodes_, nodes_ + numNodes_, next_);
+    padPos_.Resize(numNodes_);
+    padVel_.Resize(numNodes_);
+    padTri1_.Resize(numNodes_);
+    padTri2_.Resize(numNodes_);
+    padVertical_.Resize(numNodes_);
+    padHorizontal_.Resize(numNodes_);
+}
+
+void SpringSystem::SimSetup() {
     SpringSetup(true);
-    GLSetup();
+    if (autoTune_)
+        TuneStep(*this);
 }
 
 void SpringSystem::Update(double dt) {
+    Step(dt, nullptr, 0);
+}
+
+void SpringSystem::Update(double dt, vector<Sphere>& spheres) {
+    // a paused cloth still gets pushed out of the spheres moving into it
+    if (paused_) {
+        HandleCollisions(spheres);
+        return;
+    }
+    // dynamic spheres need the impulse reduction and strain limiting has to run
+    // before the collisions, so those go through HandleCollisions afterwards
+    bool fuse = !spheres.empty() && !strainLimit_;
+    for (Sphere& sphere : spheres)
+        fuse = fuse && !sphere.Dynamic();
+    if (fuse) {
+        Step(dt, &spheres[0], spheres.size());
+    } else {
+        Step(dt, nullptr, 0);
+        HandleCollisions(spheres);
+    }
+}
+
+void SpringSystem::Step(double dt, const Sphere* spheres, int numSpheres) {
     if (paused_)
         return;
 
-    highp_dvec3 forces[dimY_][dimX_];
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_; ++c) {
-            forces[r][c] = GRAVITY * mass_ + wind_ * wind;
+    // OpenMP keeps the thread count per thread, this only changes the calling thread's
+    // and puts it back at the end
+    const int defaultThreads = omp_get_max_threads();
+    if (threads_ > 0)
+        omp_set_num_threads(threads_);
+
+    if (tiled_ && !masked_) {
+        typedef void (SpringSystem::*TiledKernel)(double, const Sphere*, int);
+        static const TiledKernel kernels[CPU_LEVELS][16] = {
+            TILED_STEPS(CPU_SSE2), TILED_STEPS(CPU_AVX2), TILED_STEPS(CPU_AVX512)
+        };
+        int kernel = 8 * drag_ + 4 * (wind != 0) + 2 * (numSpheres > 0) +
+                     (integrator_ == EXPLICIT_EULER);
+        (this->*kernels[level_][kernel])(dt, spheres, numSpheres);
+    } else if (pool_ && layout_ == PADDED && !masked_) {
+        GraphStep(dt, spheres, numSpheres);
+    } else {
+        ComputeForces(&forces_[0]);
+        Integrate(dt, spheres, numSpheres);
+    }
+
+    if (strainLimit_)
+        LimitStrain(dt);
+    if (threads_ > 0)
+        omp_set_num_threads(defaultThreads);
+}
+
+Node* SpringSystem::AllocateNodes(int n, int rowLength) {
+    Node* nodes = static_cast<Node*>(::operator new[](n * sizeof(Node)));
+    const int rows = (n + rowLength - 1) / rowLength;
+    #pragma omp parallel
+    {
+        int rowBegin, rowEnd;
+        RowBand(rows, omp_get_thread_num(), omp_get_num_threads(), rowBegin, rowEnd);
+        const int end = std::min(n, rowEnd * rowLength);
+        for (int i = rowBegin * rowLength; i < end; ++i)
+            new (&nodes[i]) Node();
+    }
+    return nodes;
+}
+
+void SpringSystem::FreeNodes(Node* nodes) {
+    ::operator delete[](nodes);
+}
+
+void SpringSystem::NumaBands(bool n) {
+    numaBands_ = n;
+    if (numaBands_) {
+        PinOpenMPThreads(AffinityCpus(omp_get_max_threads()));
+        PlaceBands();
+    }
+}
+
+// Every thread moves the pages of its band of everything the step streams through to its
+// own NUMA node: the nodes where they are already placed by AllocateNodes before the
+// threads were pinned, and the forces and SoA copies which the vectors touched from one
+// thread.
+void SpringSystem::PlaceBands() {
+    const int rowLength = StorageRowLength();
+    const int rows = (numNodes_ + rowLength - 1) / rowLength;
+    SoA::Array* soa[6 * 3];
+    SoA* arrays[6] = { &padPos_, &padVel_, &padTri1_, &padTri2_, &padVertical_, &padHorizontal_ };
+    for (int a = 0; a < 6; ++a) {
+        soa[3 * a] = &arrays[a]->x;
+        soa[3 * a + 1] = &arrays[a]->y;
+        soa[3 * a + 2] = &arrays[a]->z;
+    }
+    #pragma omp parallel
+    {
+        int rowBegin, rowEnd;
+        RowBand(rows, omp_get_thread_num(), omp_get_num_threads(), rowBegin, rowEnd);
+        const int begin = rowBegin * rowLength;
+        const int count = std::min(numNodes_, rowEnd * rowLength) - begin;
+        if (count > 0) {
+            MoveToThisNode(nodes_ + begin, count * sizeof(Node));
+            if (next_)
+                MoveToThisNode(next_ + begin, count * sizeof(Node));
+            MoveToThisNode(&forces_[begin], count * sizeof(highp_dvec3));
+            for (SoA::Array* v : soa)
+                if ((int) v->size() >= begin + count)
+                    MoveToThisNode(&(*v)[begin], count * sizeof(double));
         }
     }
-    // drag force
-    #pragma omp parallel for
-    for (unsigned int r = 0; r < dimY_ - 1; ++r) {
-        for (unsigned int c = 0; c < dimX_ - 1; ++c) {
-            Node& ul = GetNode(r, c);
-            Node& ll = GetNode(r + 1, c);
-            Node& ur = GetNode(r, c + 1);
-            Node& lr = GetNode(r + 1, c + 1);
-
-            double pc = 10;
-            highp_dvec3 n, v, force;
-            double a;
-            // first triangle
-            v = (ul.vel + ur.vel + ll.vel) / 3.0 - wind_*wind;
-            n = cross(ll.pos - ul.pos, ur.pos - ul.pos);
-            force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
-            if (drag_) {
-                force *= 1;
-            } else {
-                force *= 0;
-            }
-            forces[r][c] += force / 3.0;
-            forces[r+1][c] += force / 3.0;
-            forces[r][c+1] += force / 3.0;
-
-            // second triangle
-            v = (lr.vel + ur.vel + ll.vel) / 3.0 - wind_*wind;
-            n = cross(ur.pos - lr.pos, ll.pos - lr.pos);
-            force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
-            if (drag_) {
-                force *= 1;
-            } else {
-                force *= 0;
+}
+
+// enough bands for every thread to have some to steal, of at least two rows so a band
+// only reaches into the ones next to it
+int SpringSystem::NumBands(TaskPool& pool, int rows) {
+    return std::max(1, std::min(4 * pool.NumThreads(), rows / 2));
+}
+
+// Step on the PADDED layout as a task graph. Each band of storage rows copies its nodes
+// to the SoA arrays, works out its quads and springs once it and the bands next to it
+// are copied, adds up the forces on its nodes once it and its neighbours have their
+// pieces and integrates them (with the kinematic collisions) right away. One band can
+// be integrating while another is still copying.
+void SpringSystem::GraphStep(double dt, const Sphere* spheres, int numSpheres) {
+    typedef void (SpringSystem::*BandKernel)(int, int);
+    typedef void (SpringSystem::*SumKernel)(int, int, highp_dvec3*);
+    static const BandKernel gathers[CPU_LEVELS] = {
+        &SpringSystem::PaddedGatherT<CPU_SSE2>,
+        &SpringSystem::PaddedGatherT<CPU_AVX2>,
+        &SpringSystem::PaddedGatherT<CPU_AVX512>
+    };
+    static const BandKernel pieces[CPU_LEVELS][4] = {
+        PADDED_PIECES(CPU_SSE2), PADDED_PIECES(CPU_AVX2), PADDED_PIECES(CPU_AVX512)
+    };
+    static const SumKernel sums[CPU_LEVELS][8] = {
+        FORCE_KERNELS(CPU_SSE2, PaddedSumT),
+        FORCE_KERNELS(CPU_AVX2, PaddedSumT),
+        FORCE_KERNELS(CPU_AVX512, PaddedSumT)
+    };
+    static const BandKernel integrators[CPU_LEVELS][4] = {
+        BAND_INTEGRATORS(CPU_SSE2), BAND_INTEGRATORS(CPU_AVX2), BAND_INTEGRATORS(CPU_AVX512)
+    };
+    const int rows = dimY_ + 2;
+    const int bands = NumBands(*pool_, rows);
+    int force = 4 * drag_ + 2 * (wind != 0) + stuck;
+    int integrator = 2 * (integrator_ == EXPLICIT_EULER) + (numSpheres > 0);
+    const CpuLevel level = level_;
+    int key = 32 * (CPU_LEVELS * bands + level) + 4 * force + integrator;
+    if (!stepGraph_)
+        stepGraph_ = new TaskGraph;
+    if (key != stepGraphKey_) {
+        BandKernel gatherKernel = gathers[level];
+        BandKernel piecesKernel = pieces[level][force / 2];
+        SumKernel sumKernel = sums[level][force];
+        BandKernel integrateKernel = integrators[level][integrator];
+        stepGraph_->Clear();
+        vector<int> gather(bands), piece(bands), sum(bands);
+        for (int b = 0; b < bands; ++b) {
+            const int rowBegin = rows * b / bands;
+            const int rowEnd = rows * (b + 1) / bands;
+            const int begin = rowBegin * padStride_;
+            const int end = rowEnd * padStride_;
+            // storage row r + 1 holds row r of the cloth
+            const int clothBegin = std::max(0, rowBegin - 1);
+            const int clothEnd = std::min(dimY_, rowEnd - 1);
+            gather[b] = stepGraph_->Add([=]() { (this->*gatherKernel)(begin, end); });
+            piece[b] = stepGraph_->Add([=]() { (this->*piecesKernel)(begin, end); });
+            sum[b] = stepGraph_->Add([=]() { (this->*sumKernel)(clothBegin, clothEnd, &forces_[0]); });
+            int integrate = stepGraph_->Add([=]() { (this->*integrateKernel)(begin, end); });
+            stepGraph_->Precede(sum[b], integrate);
+        }
+        for (int b = 0; b < bands; ++b) {
+            for (int other = std::max(0, b - 1); other <= std::min(bands - 1, b + 1); ++other) {
+                stepGraph_->Precede(gather[other], piece[b]);
+                stepGraph_->Precede(piece[other], sum[b]);
             }
-            forces[r+1][c] += force / 3.0;
-            forces[r][c+1] += force / 3.0;
-            forces[r+1][c+1] += force / 3.0;
         }
+        stepGraphKey_ = key;
     }
-    for (int r = 0; r < dimY_; r++)
-        for (int c = 0; c < dimX_; c++)
-            normals_[r*dimX_ + c] = normalize(normals_[r*dimX_ + c]);
-    #pragma omp parallel for
-    for (int r = 1; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_; ++c) {
-            Node& n1 = GetNode(r, c);
-            Node& n2 = GetNode(r - 1, c);
+    stepDt_ = dt;
+    stepSpheres_ = spheres;
+    stepNumSpheres_ = numSpheres;
+    stepGraph_->Run(*pool_);
+}
 
-            double l = length(n1.pos - n2.pos);
-            highp_dvec3 e = normalize(n1.pos - n2.pos);
-            double v1 = dot(e, n1.vel);
-            double v2 = dot(e, n2.vel);
-            double f = -KS_*(l - restLength_) - KD_*(v1 - v2);
+void SpringSystem::Tiled(bool t) {
+    tiled_ = t;
+    if (tiled_ && !next_) {
+        // the step only writes nodes, whatever else is in the storage has to be there too
+        next_ = AllocateNodes(numNodes_, StorageRowLength());
+        std::copy(nodes_, nodes_ + numNodes_, next_);
+    }
+}
 
-            forces[r][c] += f * e;
-            forces[r-1][c] -= f * e;
+void SpringSystem::Integrate(double dt, const Sphere* spheres, int numSpheres) {
+    typedef void (SpringSystem::*IntegrateKernel)(double, const Sphere*, int);
+    typedef void (SpringSystem::*BandKernel)(int, int);
+    static const IntegrateKernel maskedIntegrators[4] = {
+        &SpringSystem::IntegrateT<SYMPLECTIC_EULER, false, true, 0>,
+        &SpringSystem::IntegrateT<SYMPLECTIC_EULER, true, true, 0>,
+        &SpringSystem::IntegrateT<EXPLICIT_EULER, false, true, 0>,
+        &SpringSystem::IntegrateT<EXPLICIT_EULER, true, true, 0>
+    };
+    static const BandKernel bandIntegrators[CPU_LEVELS][4] = {
+        BAND_INTEGRATORS(CPU_SSE2), BAND_INTEGRATORS(CPU_AVX2), BAND_INTEGRATORS(CPU_AVX512)
+    };
+    if (!masked_) {
+        // each thread steps a band of storage rows, with PADDED the one it worked out the
+        // forces of
+        BandKernel kernel = bandIntegrators[level_][2 * (integrator_ == EXPLICIT_EULER) +
+                                                  (numSpheres > 0)];
+        stepDt_ = dt;
+        stepSpheres_ = spheres;
+        stepNumSpheres_ = numSpheres;
+        const int rowLength = StorageRowLength();
+        #pragma omp parallel
+        {
+            int rowBegin, rowEnd;
+            RowBand((numNodes_ + rowLength - 1) / rowLength, omp_get_thread_num(),
+                    omp_get_num_threads(), rowBegin, rowEnd);
+            (this->*kernel)(rowBegin * rowLength, std::min(numNodes_, rowEnd * rowLength));
         }
+        return;
     }
-    #pragma omp parallel for
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 1; c < dimX_; ++c) {
-            Node& n1 = GetNode(r, c);
-            Node& n2 = GetNode(r, c - 1);
+    int kernel = 2 * (integrator_ == EXPLICIT_EULER) + (numSpheres > 0);
+    (this->*maskedIntegrators[kernel])(dt, spheres, numSpheres);
+}
+
+// total force on every node for the current state, zero on pinned nodes
+void SpringSystem::ComputeForces(highp_dvec3* forces) {
+    typedef void (SpringSystem::*ForceKernel)(highp_dvec3*);
+    static const ForceKernel maskedKernels[8] = {
+        &SpringSystem::ComputeMaskedForcesT<false, false, false>,
+        &SpringSystem::ComputeMaskedForcesT<false, false, true>,
+        &SpringSystem::ComputeMaskedForcesT<false, true, false>,
+        &SpringSystem::ComputeMaskedForcesT<false, true, true>,
+        &SpringSystem::ComputeMaskedForcesT<true, false, false>,
+        &SpringSystem::ComputeMaskedForcesT<true, false, true>,
+        &SpringSystem::ComputeMaskedForcesT<true, true, false>,
+        &SpringSystem::ComputeMaskedForcesT<true, true, true>
+    };
+    static const ForceKernel kernels[CPU_LEVELS][8] = {
+        FORCE_KERNELS(CPU_SSE2, ComputeForcesT),
+        FORCE_KERNELS(CPU_AVX2, ComputeForcesT),
+        FORCE_KERNELS(CPU_AVX512, ComputeForcesT)
+    };
+    static const ForceKernel paddedKernels[CPU_LEVELS][8] = {
+        FORCE_KERNELS(CPU_SSE2, PaddedForcesT),
+        FORCE_KERNELS(CPU_AVX2, PaddedForcesT),
+        FORCE_KERNELS(CPU_AVX512, PaddedForcesT)
+    };
+    int kernel = 4 * drag_ + 2 * (wind != 0) + stuck;
+    if (masked_)
+        (this->*maskedKernels[kernel])(forces);
+    else if (layout_ == PADDED)
+        (this->*paddedKernels[level_][kernel])(forces);
+    else
+        (this->*kernels[level_][kernel])(forces);
+}
+
+// Same forces as ComputeForces over the compacted lists. Masked out nodes keep whatever
+// force they had, they are never integrated.
+template <bool DRAG, bool WIND, bool PINNED>
+void SpringSystem::ComputeMaskedForcesT(highp_dvec3* forces) {
+    const highp_dvec3 wind = WIND ? wind_ * this->wind : highp_dvec3(0, 0, 0);
+    const int numActive = activeNodes_.size();
+    #pragma omp parallel for schedule(static)
+    for (int k = 0; k < numActive; ++k) {
+        forces[activeNodes_[k]] = GRAVITY * mass_;
+        if (WIND)
+            forces[activeNodes_[k]] += wind;
+    }
+
+    if (DRAG) {
+        for (int color = 0; color < 4; ++color) {
+            const int numQuads = quadTris_[color].size();
+            #pragma omp parallel for schedule(static)
+            for (int q = 0; q < numQuads; ++q) {
+                int iul = quads_[color][4*q];
+                int ill = quads_[color][4*q + 1];
+                int iur = quads_[color][4*q + 2];
+                int ilr = quads_[color][4*q + 3];
+                Node& ul = nodes_[iul];
+                Node& ll = nodes_[ill];
+                Node& ur = nodes_[iur];
+                Node& lr = nodes_[ilr];
+
+                double pc = 10;
+                highp_dvec3 n, v, force;
+                if (quadTris_[color][q] & 1) {
+                    v = (ul.vel + ur.vel + ll.vel) / 3.0;
+                    if (WIND)
+                        v -= wind;
+                    n = cross(ll.pos - ul.pos, ur.pos - ul.pos);
+                    force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                    forces[iul] += force / 3.0;
+                    forces[ill] += force / 3.0;
+                    forces[iur] += force / 3.0;
+                }
+                if (quadTris_[color][q] & 2) {
+                    v = (lr.vel + ur.vel + ll.vel) / 3.0;
+                    if (WIND)
+                        v -= wind;
+                    n = cross(ur.pos - lr.pos, ll.pos - lr.pos);
+                    force = -.5*pc*(length(v)*dot(v, n))*n/(2*length(n));
+                    forces[ill] += force / 3.0;
+                    forces[iur] += force / 3.0;
+                    forces[ilr] += force / 3.0;
+                }
+            }
+        }
+    }
+
+    for (int color = 0; color < 4; ++color) {
+        const int numSprings = springs_[color].size() / 2;
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < numSprings; ++k) {
+            int a = springs_[color][2*k];
+            int b = springs_[color][2*k + 1];
+            Node& n1 = nodes_[b];
+            Node& n2 = nodes_[a];
 
             double l = length(n1.pos - n2.pos);
             highp_dvec3 e = normalize(n1.pos - n2.pos);
             double v1 = dot(e, n1.vel);
             double v2 = dot(e, n2.vel);
-            double f = -KS_*(l - restLength_) - KD_*(v1 - v2);
+            double f = SpringForce(KS_, KD_, l, restLength_, v1, v2);
 
-            forces[r][c] += f * e;
-            forces[r][c-1] -= f * e;
+            forces[b] += f * e;
+            forces[a] -= f * e;
         }
     }
 
-    if (stuck) {
-        // forces[0][0] = vec3(0, 0, 0);
-        // forces[0][dimX_ - 1] = vec3(0, 0, 0);
+    if (PINNED) {
         for (int c = 0; c < dimX_; ++c) {
-            forces[0][c] = vec3(0, 0, 0);
-        }
-    }
-    #pragma omp parallel for
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_; ++c) {
-            Node& n = GetNode(r, c);
-            n.vel += forces[r][c]/mass_ * dt;
-            n.pos += n.vel * dt;
+            forces[NodeIndex(0, c)] = vec3(0, 0, 0);
         }
     }
 }
 
-void SpringSystem::HandleCollisions(Sphere& sphere) {
-    for (int r = 0; r < dimY_; ++r) {
-        for (int c = 0; c < dimX_; ++c) {
-            Node& n = GetNode(r, c);
-            vec3 p = n.pos;
-            vec3 v = n.vel;
-            double d = glm::length(p - sphere.position);
-            if (d < sphere.radius + .09) {
-                vec3 normal = glm::normalize(p - sphere.position);
-                vec3 bounce = dot(v, normal) * normal;
-                n.vel -= 1.5 * bounce;
-                // n.pos += normal * (.2 + sphere.radius - d);
-                // n.vel = -n.vel;
-                n.pos = sphere.position + (.1 + sphere.radius) * normal;
+// moves the ends of a spring so its length is back within [minL, maxL], weighted by
+// inverse mass (0 for pinned nodes), and keeps the velocities consistent with the move
+static inline void ProjectSpring(Node& a, Node& b, double wa, double wb,
+                                 double minL, double maxL, double dt) {
+    double w = wa + wb;
+    if (w == 0)
+        return;
+    highp_dvec3 d = b.pos - a.pos;
+    double l = length(d);
+    double target = clamp(l, minL, maxL);
+    if (l == target || l == 0)
+        return;
+    highp_dvec3 corr = ((l - target) / (l * w)) * d;
+    a.pos += wa * corr;
+    a.vel += wa * corr / dt;
+    b.pos -= wb * corr;
+    b.vel -= wb * corr / dt;
+}
+
+// Springs of one color never share a node, so each color is projected in parallel:
+// vertical springs alternate by row, horizontal springs alternate by column.
+void SpringSystem::LimitStrain(double dt) {
+    double minL = minStretch_ * restLength_;
+    double maxL = maxStretch_ * restLength_;
+    double pinned = stuck ? 0 : 1;
+    if (masked_) {
+        for (int it = 0; it < strainIterations_; ++it) {
+            for (int color = 0; color < 4; ++color) {
+                const int numSprings = springs_[color].size() / 2;
+                #pragma omp parallel for schedule(static)
+                for (int k = 0; k < numSprings; ++k) {
+                    // the springs leaving row 0 come first in each list
+                    double wa = k < pinnedSprings_[color] ? pinned : 1;
+                    double wb = color >= 2 ? wa : 1;
+                    ProjectSpring(nodes_[springs_[color][2*k]], nodes_[springs_[color][2*k + 1]],
+                                  wa, wb, minL, maxL, dt);
+                }
+            }
+        }
+        return;
+    }
+    for (int it = 0; it < strainIterations_; ++it) {
+        for (int color = 0; color < 2; ++color) {
+            #pragma omp parallel for
+            for (int r = 1 + color; r < dimY_; r += 2) {
+                double wa = r == 1 ? pinned : 1;
+                for (int c = 0; c < dimX_; ++c)
+                    ProjectSpring(GetNode(r - 1, c), GetNode(r, c), wa, 1, minL, maxL, dt);
+            }
+        }
+        for (int color = 0; color < 2; ++color) {
+            #pragma omp parallel for
+            for (int r = 0; r < dimY_; ++r) {
+                double w = r == 0 ? pinned : 1;
+                for (int c = 1 + color; c < dimX_; c += 2)
+                    ProjectSpring(GetNode(r, c - 1), GetNode(r, c), w, w, minL, maxL, dt);
             }
         }
     }
 }
 
-void SpringSystem::Render(const mat4& V, const mat4& P) {
-    mat4 VP = P * V;
-    UpdateGPUPositions();
-    if (textured_) {
-        cloth_shader_.Enable();
+void SpringSystem::HandleCollisions(Sphere& sphere) {
+    HandleCollisions(&sphere, 1);
+}
 
-        glBindVertexArray(cloth_vao_);
+void SpringSystem::HandleCollisions(vector<Sphere>& spheres) {
+    if (!spheres.empty())
+        HandleCollisions(&spheres[0], spheres.size());
+}
 
-        glUniformMatrix4fv(cloth_shader_["VP"], 1, GL_FALSE, value_ptr(VP));
-        mat4 nM = transpose(inverse(V));
-        glUniformMatrix4fv(cloth_shader_["normalMatrix"], 1, GL_FALSE, value_ptr(nM));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, cloth_texture_);
-        glUniform1i(cloth_shader_["tex"], 0);
-        glDrawElements(GL_TRIANGLES, 3 * numTris_, GL_UNSIGNED_INT, 0);
-    } else {
-        spring_shader_.Enable();
-        glUniformMatrix4fv(cloth_shader_["VP"], 1, GL_FALSE, value_ptr(VP));
-        glBindVertexArray(cube_vao_);
-        vec4 color = vec4(0, 0, 1, 1);
-        glUniform4fv(spring_shader_["color"], 1, value_ptr(color));
-        for (int r = 0; r < dimY_; ++r) {
-            for (int c = 0; c < dimX_; ++c) {
-                vec3 pos = GetNode(r, c).pos;
-                mat4 model(1);
-                model = translate(model, pos);
-                model = scale(model, vec3(.5 *restLength_));
-                glUniformMatrix4fv(spring_shader_["model"], 1, GL_FALSE, value_ptr(model));
-                glDrawArrays(GL_TRIANGLES, 0, 36);
-            }
-        }
+// Kinematic spheres push the cloth around like before. Dynamic spheres exchange an
+// impulse with each node they hit and share the push out of the sphere by mass. The
+// impulses on a sphere add up, but its pushes all undo the same overlap, so it only
+// moves by the deepest one. Every thread keeps what it gives each sphere in its own
+// slot and the slots are combined in thread order afterwards, so the result is
+// deterministic and needs no locks.
+void SpringSystem::HandleCollisions(Sphere* spheres, int numSpheres) {
+    int numThreads = omp_get_max_threads();
+    sphereImpulses_.assign(2 * numThreads * numSpheres, highp_dvec3(0, 0, 0));
 
-        int numLines = 2 * (dimX_ * (dimY_ - 1) + dimY_ * (dimX_ - 1));
+    typedef void (SpringSystem::*CollideKernel)(Sphere*, int);
+    static const CollideKernel kernels[CPU_LEVELS] = {
+        &SpringSystem::CollideSpheresT<CPU_SSE2>,
+        &SpringSystem::CollideSpheresT<CPU_AVX2>,
+        &SpringSystem::CollideSpheresT<CPU_AVX512>
+    };
+    (this->*kernels[level_])(spheres, numSpheres);
 
-        color = vec4(0, 0, 0, 1);
-        glUniform4fv(spring_shader_["color"], 1, value_ptr(color));
-        glBindVertexArray(spring_vao_);
-        mat4 model = mat4(1);
-        glUniformMatrix4fv(spring_shader_["model"], 1, GL_FALSE, value_ptr(model));
-        // glDrawArrays(GL_LINES, 0, numLines);
-        glLineWidth(2);
-        glDrawElements(GL_LINES, spring_indices_.size(), GL_UNSIGNED_INT, 0);
+    for (int s = 0; s < numSpheres; ++s) {
+        highp_dvec3 impulse(0, 0, 0);
+        highp_dvec3 push(0, 0, 0);
+        for (int t = 0; t < numThreads; ++t) {
+            impulse += sphereImpulses_[2 * t * numSpheres + s];
+            const highp_dvec3& deepest = sphereImpulses_[(2 * t + 1) * numSpheres + s];
+            if (dot(deepest, deepest) > dot(push, push))
+                push = deepest;
+        }
+        if (spheres[s].Dynamic()) {
+            spheres[s].ApplyImpulse(vec3(impulse));
+            spheres[s].position += vec3(push);
+        }
     }
 }
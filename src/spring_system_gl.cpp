@@ -0,0 +1,200 @@
+// The drawing half of SpringSystem, the only part of it that needs OpenGL. Everything
+// else is in spring_system.cpp and builds into libcloth without it.
+
+#include "include/spring_system.h"
+#include "include/utils.h"
+#include "include/glsl_shader.h"
+#include "include/shape_vertices.h"
+
+struct ClothGL {
+    GLSLShader cloth_shader;
+    GLSLShader spring_shader;
+    GLint cloth_texture;
+    GLuint cloth_vao;
+    GLuint cloth_vbos[CLOTH_TOTAL_VBOS];
+    GLuint cube_vao;
+    GLuint cube_vbo;
+    GLuint spring_vao;
+    GLuint spring_vbo;
+};
+
+// the shaders delete their programs, the buffers and vertex arrays go with the context
+static void DeleteClothGL(ClothGL* gl) {
+    delete gl;
+}
+
+void SpringSystem::Setup() {
+    SimSetup();
+    GLSetup();
+}
+
+void SpringSystem::GLSetup() {
+    RenderSetup();
+    if (glDeleter_)
+        glDeleter_(gl_);
+    gl_ = new ClothGL;
+    glDeleter_ = DeleteClothGL;
+    ClothGL& gl = *gl_;
+
+    // setup textured cloth opengl stuff
+    gl.cloth_shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/cloth_shader.vert");
+    gl.cloth_shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/cloth_shader.frag");
+    gl.cloth_shader.CreateAndLinkProgram();
+    gl.cloth_shader.Enable();
+    gl.cloth_shader.AddAttribute("inPos");
+    gl.cloth_shader.AddAttribute("inNormal");
+    gl.cloth_shader.AddAttribute("texCoords");
+    gl.cloth_shader.AddUniform("VP");
+    gl.cloth_shader.AddUniform("normalMatrix");
+    gl.cloth_shader.AddUniform("tex");
+
+    gl.cloth_texture = LoadTexture("textures/blue_cloth.jpg");
+
+    glGenVertexArrays(1, &gl.cloth_vao);
+    glBindVertexArray(gl.cloth_vao);
+    glGenBuffers(CLOTH_TOTAL_VBOS, gl.cloth_vbos);
+
+    // vertices
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_VERTS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(gl.cloth_shader["inPos"]);
+    glVertexAttribPointer(gl.cloth_shader["inPos"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+    // normals 
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_NORMS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, NULL, GL_STREAM_DRAW);
+    glEnableVertexAttribArray(gl.cloth_shader["inNormal"]);
+    glVertexAttribPointer(gl.cloth_shader["inNormal"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // tex coords
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_TEX_COORDS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * numNodes_, &texCoords_[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(gl.cloth_shader["texCoords"]);
+    glVertexAttribPointer(gl.cloth_shader["texCoords"], 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+    // node - spring shader
+    gl.spring_shader.LoadFromFile(GL_VERTEX_SHADER, "shaders/spring_shader.vert");
+    gl.spring_shader.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/spring_shader.frag");
+    gl.spring_shader.CreateAndLinkProgram();
+    gl.spring_shader.Enable();
+    gl.spring_shader.AddAttribute("verts");
+    gl.spring_shader.AddUniform("model");
+    gl.spring_shader.AddUniform("VP");
+    gl.spring_shader.AddUniform("color");
+
+    glGenVertexArrays(1, &gl.cube_vao);
+    glBindVertexArray(gl.cube_vao);
+    glGenBuffers(1, &gl.cube_vbo);
+
+    // vertices
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cube_vbo);
+    glBufferData(GL_ARRAY_BUFFER, CUBE_VERTS_SIZE, cube_data, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(gl.spring_shader["verts"]);
+    glVertexAttribPointer(gl.spring_shader["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+    glGenVertexArrays(1, &gl.spring_vao);
+    glBindVertexArray(gl.spring_vao);
+
+    // vertices
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_VERTS]);
+    glEnableVertexAttribArray(gl.spring_shader["verts"]);
+    glVertexAttribPointer(gl.spring_shader["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+
+    glGenBuffers(1, &gl.spring_vbo);
+
+    // indices
+    UploadRenderData();
+}
+
+// the triangles and spring lines of BuildRenderIndices and the tex coords
+void SpringSystem::UploadRenderData() {
+    ClothGL& gl = *gl_;
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_TEX_COORDS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2) * numNodes_, &texCoords_[0], GL_STATIC_DRAW);
+    glBindVertexArray(gl.cloth_vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_INDICES]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * numTris_ * 3,
+                 &indices_[0], GL_STATIC_DRAW);
+    glBindVertexArray(gl.spring_vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gl.spring_vbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * spring_indices_.size(),
+                 spring_indices_.empty() ? NULL : &spring_indices_[0], GL_STATIC_DRAW);
+    renderDataChanged_ = false;
+}
+
+void SpringSystem::UpdateGPUPositions() {
+    PrepareUpload(nullptr);
+    UploadPositions();
+}
+
+void SpringSystem::UploadPositions() {
+    ClothGL& gl = *gl_;
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_VERTS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, &posArray_[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, gl.cloth_vbos[CLOTH_NORMS]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numNodes_, &normals_[0], GL_STREAM_DRAW);
+}
+
+void SpringSystem::Render(const mat4& V, const mat4& P) {
+    UpdateGPUPositions();
+    Draw(V, P);
+}
+
+void SpringSystem::Render(const mat4& V, const mat4& P, const vector<vec3>& positions) {
+    // positions copied before a layout change don't fit the buffers any more, the cloth
+    // keeps its last shape until the next copy
+    if ((int) positions.size() == numNodes_) {
+        PrepareUpload(&positions[0]);
+        UploadPositions();
+    }
+    Draw(V, P);
+}
+
+void SpringSystem::Draw(const mat4& V, const mat4& P) {
+    ClothGL& gl = *gl_;
+    if (renderDataChanged_)
+        UploadRenderData();
+    mat4 VP = P * V;
+    if (textured_) {
+        gl.cloth_shader.Enable();
+
+        glBindVertexArray(gl.cloth_vao);
+
+        glUniformMatrix4fv(gl.cloth_shader["VP"], 1, GL_FALSE, value_ptr(VP));
+        mat4 nM = transpose(inverse(V));
+        glUniformMatrix4fv(gl.cloth_shader["normalMatrix"], 1, GL_FALSE, value_ptr(nM));
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gl.cloth_texture);
+        glUniform1i(gl.cloth_shader["tex"], 0);
+        glDrawElements(GL_TRIANGLES, 3 * numTris_, GL_UNSIGNED_INT, 0);
+    } else {
+        gl.spring_shader.Enable();
+        glUniformMatrix4fv(gl.cloth_shader["VP"], 1, GL_FALSE, value_ptr(VP));
+        glBindVertexArray(gl.cube_vao);
+        vec4 color = vec4(0, 0, 1, 1);
+        glUniform4fv(gl.spring_shader["color"], 1, value_ptr(color));
+        for (int r = 0; r < dimY_; ++r) {
+            for (int c = 0; c < dimX_; ++c) {
+                if (!NodeActive(r, c))
+                    continue;
+                vec3 pos = posArray_[NodeIndex(r, c)];
+                mat4 model(1);
+                model = translate(model, pos);
+                model = scale(model, vec3(.5 *restLength_));
+                glUniformMatrix4fv(gl.spring_shader["model"], 1, GL_FALSE, value_ptr(model));
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+            }
+        }
+
+        int numLines = 2 * (dimX_ * (dimY_ - 1) + dimY_ * (dimX_ - 1));
+
+        color = vec4(0, 0, 0, 1);
+        glUniform4fv(gl.spring_shader["color"], 1, value_ptr(color));
+        glBindVertexArray(gl.spring_vao);
+        mat4 model = mat4(1);
+        glUniformMatrix4fv(gl.spring_shader["model"], 1, GL_FALSE, value_ptr(model));
+        // glDrawArrays(GL_LINES, 0, numLines);
+        glLineWidth(2);
+        glDrawElements(GL_LINES, spring_indices_.size(), GL_UNSIGNED_INT, 0);
+    }
+}
@@ -0,0 +1,254 @@
+#include "include/strand_system.h"
+#include "include/spring_law.h"
+#include <omp.h>
+#include <cstring>
+
+#define STRAND_ALIGNMENT 64
+
+StrandSystem::StrandSystem() :
+    StrandSystem(256, 30, 50, 0.5) {}
+
+StrandSystem::StrandSystem(int numStrands, int nodesPerStrand, double ks, double kd) {
+    numStrands_ = numStrands;
+    nodesPerStrand_ = nodesPerStrand;
+    numBlocks_ = (numStrands + STRAND_LANES - 1) / STRAND_LANES;
+
+    size_t bytes = sizeof(double) * numBlocks_ * nodesPerStrand_ * STRAND_COMPONENTS * STRAND_LANES;
+    data_ = (double*) aligned_alloc(STRAND_ALIGNMENT, bytes);
+    memset(data_, 0, bytes);
+    posArray_ = nullptr;
+
+    KS_ = ks;
+    KD_ = kd;
+    bendKS_ = 0.1 * ks;
+    mass_ = 0.01;
+    restLength_ = 0.05;
+    paused_ = false;
+}
+
+StrandSystem::~StrandSystem() {
+    free(data_);
+    delete [] posArray_;
+}
+
+highp_dvec3 StrandSystem::GetNode(int strand, int i) {
+    int b = strand / STRAND_LANES;
+    int l = strand % STRAND_LANES;
+    return highp_dvec3(Lane(b, i, STRAND_PX)[l], Lane(b, i, STRAND_PY)[l], Lane(b, i, STRAND_PZ)[l]);
+}
+
+// lays the strand out straight down from its root
+void StrandSystem::SetRoot(int strand, highp_dvec3 pos) {
+    int b = strand / STRAND_LANES;
+    int l = strand % STRAND_LANES;
+    for (int i = 0; i < nodesPerStrand_; ++i) {
+        Lane(b, i, STRAND_PX)[l] = pos.x;
+        Lane(b, i, STRAND_PY)[l] = pos.y - i * restLength_;
+        Lane(b, i, STRAND_PZ)[l] = pos.z;
+        Lane(b, i, STRAND_VX)[l] = 0;
+        Lane(b, i, STRAND_VY)[l] = 0;
+        Lane(b, i, STRAND_VZ)[l] = 0;
+    }
+}
+
+// roots on a square patch above the default sphere. The padding lanes of the last block
+// copy the last strand so they stay well behaved, they just never get drawn.
+void StrandSystem::StrandSetup() {
+    int side = (int) ceil(sqrt((double) numStrands_));
+    double spacing = 2.0 / side;
+    for (int s = 0; s < numBlocks_ * STRAND_LANES; ++s) {
+        int i = std::min(s, numStrands_ - 1);
+        SetRoot(s, highp_dvec3(1.5 + (i % side) * spacing, 5, 1.5 + (i / side) * spacing));
+    }
+}
+
+void StrandSystem::Setup() {
+    StrandSetup();
+    GLSetup();
+}
+
+void StrandSystem::GLSetup() {
+    posArray_ = new vec3[numStrands_ * nodesPerStrand_];
+    for (int s = 0; s < numStrands_; ++s) {
+        for (int i = 1; i < nodesPerStrand_; ++i) {
+            indices_.push_back(s * nodesPerStrand_ + i - 1);
+            indices_.push_back(s * nodesPerStrand_ + i);
+        }
+    }
+
+    shader_.LoadFromFile(GL_VERTEX_SHADER, "shaders/spring_shader.vert");
+    shader_.LoadFromFile(GL_FRAGMENT_SHADER, "shaders/spring_shader.frag");
+    shader_.CreateAndLinkProgram();
+    shader_.Enable();
+    shader_.AddAttribute("verts");
+    shader_.AddUniform("model");
+    shader_.AddUniform("VP");
+    shader_.AddUniform("color");
+
+    glGenVertexArrays(1, &vao_);
+    glBindVertexArray(vao_);
+    glGenBuffers(2, vbos_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numStrands_ * nodesPerStrand_, NULL,
+                 GL_STREAM_DRAW);
+    glEnableVertexAttribArray(shader_["verts"]);
+    glVertexAttribPointer(shader_["verts"], 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos_[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices_.size(),
+                 &indices_[0], GL_STATIC_DRAW);
+}
+
+// Every loop below has the lane loop innermost, so one vector instruction moves the same
+// node of STRAND_LANES strands. The strand root (node 0) is pinned.
+void StrandSystem::Update(double dt) {
+    if (paused_)
+        return;
+
+    const int N = nodesPerStrand_;
+    const int L = STRAND_LANES;
+    forces_.resize(omp_get_max_threads() * 3 * N * L);
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < numBlocks_; ++b) {
+        double* fx = &forces_[omp_get_thread_num() * 3 * N * L];
+        double* fy = fx + N * L;
+        double* fz = fy + N * L;
+
+        for (int i = 0; i < N; ++i) {
+            #pragma omp simd
+            for (int l = 0; l < L; ++l) {
+                fx[i*L + l] = GRAVITY.x * mass_;
+                fy[i*L + l] = GRAVITY.y * mass_;
+                fz[i*L + l] = GRAVITY.z * mass_;
+            }
+        }
+
+        // stretch springs between neighbours and bend springs that skip a node
+        for (int k = 1; k <= 2; ++k) {
+            double ks = k == 1 ? KS_ : bendKS_;
+            double rest = k * restLength_;
+            for (int i = k; i < N; ++i) {
+                const double* px1 = Lane(b, i, STRAND_PX);
+                const double* py1 = Lane(b, i, STRAND_PY);
+                const double* pz1 = Lane(b, i, STRAND_PZ);
+                const double* vx1 = Lane(b, i, STRAND_VX);
+                const double* vy1 = Lane(b, i, STRAND_VY);
+                const double* vz1 = Lane(b, i, STRAND_VZ);
+                const double* px2 = Lane(b, i - k, STRAND_PX);
+                const double* py2 = Lane(b, i - k, STRAND_PY);
+                const double* pz2 = Lane(b, i - k, STRAND_PZ);
+                const double* vx2 = Lane(b, i - k, STRAND_VX);
+                const double* vy2 = Lane(b, i - k, STRAND_VY);
+                const double* vz2 = Lane(b, i - k, STRAND_VZ);
+                #pragma omp simd
+                for (int l = 0; l < L; ++l) {
+                    double dx = px1[l] - px2[l];
+                    double dy = py1[l] - py2[l];
+                    double dz = pz1[l] - pz2[l];
+                    double len = sqrt(dx*dx + dy*dy + dz*dz);
+                    double ex = dx / len;
+                    double ey = dy / len;
+                    double ez = dz / len;
+                    double v1 = ex*vx1[l] + ey*vy1[l] + ez*vz1[l];
+                    double v2 = ex*vx2[l] + ey*vy2[l] + ez*vz2[l];
+                    double f = SpringForce(ks, KD_, len, rest, v1, v2);
+                    fx[i*L + l] += f * ex;
+                    fy[i*L + l] += f * ey;
+                    fz[i*L + l] += f * ez;
+                    fx[(i-k)*L + l] -= f * ex;
+                    fy[(i-k)*L + l] -= f * ey;
+                    fz[(i-k)*L + l] -= f * ez;
+                }
+            }
+        }
+
+        for (int i = 1; i < N; ++i) {
+            double* px = Lane(b, i, STRAND_PX);
+            double* py = Lane(b, i, STRAND_PY);
+            double* pz = Lane(b, i, STRAND_PZ);
+            double* vx = Lane(b, i, STRAND_VX);
+            double* vy = Lane(b, i, STRAND_VY);
+            double* vz = Lane(b, i, STRAND_VZ);
+            #pragma omp simd
+            for (int l = 0; l < L; ++l) {
+                vx[l] += fx[i*L + l] / mass_ * dt;
+                vy[l] += fy[i*L + l] / mass_ * dt;
+                vz[l] += fz[i*L + l] / mass_ * dt;
+                px[l] += vx[l] * dt;
+                py[l] += vy[l] * dt;
+                pz[l] += vz[l] * dt;
+            }
+        }
+    }
+}
+
+void StrandSystem::HandleCollisions(vector<Sphere>& spheres) {
+    for (Sphere& sphere : spheres)
+        HandleCollisions(sphere);
+}
+
+// Same response as the cloth gets from a kinematic sphere. Strands are light enough that
+// they do not push back on spheres with mass.
+void StrandSystem::HandleCollisions(Sphere& sphere) {
+    const int L = STRAND_LANES;
+    const double cx = sphere.position.x;
+    const double cy = sphere.position.y;
+    const double cz = sphere.position.z;
+    const double range = sphere.radius + COLLISION_RANGE;
+    const double offset = sphere.radius + COLLISION_OFFSET;
+
+    #pragma omp parallel for schedule(static)
+    for (int b = 0; b < numBlocks_; ++b) {
+        for (int i = 1; i < nodesPerStrand_; ++i) {
+            double* px = Lane(b, i, STRAND_PX);
+            double* py = Lane(b, i, STRAND_PY);
+            double* pz = Lane(b, i, STRAND_PZ);
+            double* vx = Lane(b, i, STRAND_VX);
+            double* vy = Lane(b, i, STRAND_VY);
+            double* vz = Lane(b, i, STRAND_VZ);
+            #pragma omp simd
+            for (int l = 0; l < L; ++l) {
+                double dx = px[l] - cx;
+                double dy = py[l] - cy;
+                double dz = pz[l] - cz;
+                double d = sqrt(dx*dx + dy*dy + dz*dz);
+                // blend instead of branching so the lanes stay in lock step
+                double hit = d < range ? 1 : 0;
+                double inv = 1 / fmax(d, 1e-12);
+                double nx = dx * inv;
+                double ny = dy * inv;
+                double nz = dz * inv;
+                double vn = hit * COLLISION_BOUNCE * (vx[l]*nx + vy[l]*ny + vz[l]*nz);
+                vx[l] -= vn * nx;
+                vy[l] -= vn * ny;
+                vz[l] -= vn * nz;
+                px[l] += hit * (cx + offset * nx - px[l]);
+                py[l] += hit * (cy + offset * ny - py[l]);
+                pz[l] += hit * (cz + offset * nz - pz[l]);
+            }
+        }
+    }
+}
+
+void StrandSystem::UpdateGPUPositions() {
+    #pragma omp parallel for
+    for (int s = 0; s < numStrands_; ++s)
+        for (int i = 0; i < nodesPerStrand_; ++i)
+            posArray_[s * nodesPerStrand_ + i] = vec3(GetNode(s, i));
+    glBindBuffer(GL_ARRAY_BUFFER, vbos_[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec3) * numStrands_ * nodesPerStrand_, &posArray_[0],
+                 GL_STREAM_DRAW);
+}
+
+void StrandSystem::Render(const mat4& V, const mat4& P) {
+    mat4 VP = P * V;
+    UpdateGPUPositions();
+    shader_.Enable();
+    glBindVertexArray(vao_);
+    glUniformMatrix4fv(shader_["VP"], 1, GL_FALSE, value_ptr(VP));
+    mat4 model(1);
+    glUniformMatrix4fv(shader_["model"], 1, GL_FALSE, value_ptr(model));
+    vec4 color = vec4(0.4, 0.25, 0.1, 1);
+    glUniform4fv(shader_["color"], 1, value_ptr(color));
+    glDrawElements(GL_LINES, indices_.size(), GL_UNSIGNED_INT, 0);
+}
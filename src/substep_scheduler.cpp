@@ -0,0 +1,173 @@
+#include "include/substep_scheduler.h"
+#include <algorithm>
+
+// weight of the newest frame in the running averages
+#define COST_SMOOTHING 0.1
+// seconds of frames within budget before a better level is considered
+#define CALM_SECONDS 1.0
+// a better level's cost may have been measured under more load than there is now, every
+// second it doesn't fit it is taken down a bit so it gets tried again eventually
+#define STALE_DECAY 0.9
+#define REDUCED_MODES 24
+
+static const char* levelNames[QUALITY_LEVELS] = { "full", "mixed precision", "strain limited", "reduced" };
+static const int minSubsteps[QUALITY_LEVELS] = { 15, 15, 3, 15 };
+static const int maxSubsteps[QUALITY_LEVELS] = { 60, 15, 15, 15 };
+
+SubstepScheduler::SubstepScheduler(double budget) :
+    enabled_(true),
+    budget_(budget),
+    level_(QUALITY_FULL),
+    substeps_(minSubsteps[QUALITY_FULL]),
+    overhead_(0),
+    remeasure_(false),
+    frames_(0),
+    overBudget_(0),
+    frameTime_(0),
+    maxFrameTime_(0)
+{
+    std::fill(substepCost_, substepCost_ + QUALITY_LEVELS, 0.0);
+    calmStart_ = reportStart_ = Clock::now();
+}
+
+// the level the cloth is in, which the keys can change behind the scheduler's back
+QualityLevel SubstepScheduler::Current(SpringSystem& ss, ReducedModel& reduced, MixedSpringSystem& mixed) {
+    if (reduced.Built())
+        return QUALITY_REDUCED;
+    if (mixed.Loaded())
+        return QUALITY_MIXED;
+    if (ss.StrainLimit())
+        return QUALITY_STRAIN_LIMITED;
+    return QUALITY_FULL;
+}
+
+bool SubstepScheduler::Available(QualityLevel level, SpringSystem& ss, ReducedModel& reduced) {
+    switch (level) {
+        case QUALITY_MIXED:
+            // no masks in mixed precision
+            return !ss.Masked();
+        case QUALITY_REDUCED:
+            // enough frames recorded for all of its modes
+            return reduced.NumSnapshots() > REDUCED_MODES;
+        default:
+            return true;
+    }
+}
+
+double SubstepScheduler::Expected(QualityLevel level, int n) {
+    if (substepCost_[level] == 0)
+        return 0;
+    return overhead_ + n * substepCost_[level];
+}
+
+bool SubstepScheduler::Switch(QualityLevel level, SpringSystem& ss, ReducedModel& reduced,
+                              MixedSpringSystem& mixed) {
+    // the last frame already wrote the mixed or reduced state back to the nodes
+    if (level == QUALITY_REDUCED && !reduced.Build(ss, REDUCED_MODES))
+        return false;
+    if (level != QUALITY_REDUCED)
+        reduced.Clear();
+    if (level == QUALITY_MIXED && !mixed.Loaded())
+        mixed.Load(ss);
+    else if (level != QUALITY_MIXED)
+        mixed.Clear();
+    ss.StrainLimit(level == QUALITY_STRAIN_LIMITED);
+
+    cout << "Frame budget: " << levelNames[level_] << " -> " << levelNames[level] << ", "
+         << Expected(level_, substeps_) * 1000 << " ms for " << substeps_ << " substeps of "
+         << budget_ * 1000 << " ms" << endl;
+    level_ = level;
+    calmStart_ = Clock::now();
+    remeasure_ = true;
+    return true;
+}
+
+int SubstepScheduler::Plan(SpringSystem& ss, ReducedModel& reduced, MixedSpringSystem& mixed) {
+    level_ = Current(ss, reduced, mixed);
+    if (!enabled_) {
+        substeps_ = ss.StrainLimit() ? 3 : 15;
+        return substeps_;
+    }
+
+    double planned = budget_ * BUDGET_HEADROOM;
+    double expected = Expected(level_, minSubsteps[level_]);
+    if (expected > planned || !Available(level_, ss, reduced)) {
+        // the cheapest level that is available and not known to be over budget
+        for (int l = level_ + 1; l < QUALITY_LEVELS; ++l) {
+            QualityLevel next = (QualityLevel) l;
+            if (!Available(next, ss, reduced))
+                continue;
+            if (Switch(next, ss, reduced, mixed) && Expected(next, minSubsteps[next]) <= planned)
+                break;
+        }
+    } else if (Seconds(Clock::now() - calmStart_) >= CALM_SECONDS) {
+        // the next better level that is available, if it fits or never ran
+        for (int l = level_ - 1; l >= 0; --l) {
+            QualityLevel next = (QualityLevel) l;
+            if (!Available(next, ss, reduced))
+                continue;
+            if (Expected(next, minSubsteps[next]) < budget_ * UPGRADE_HEADROOM)
+                Switch(next, ss, reduced, mixed);
+            else
+                substepCost_[next] *= STALE_DECAY;
+            break;
+        }
+        calmStart_ = Clock::now();
+    }
+
+    // the reduced model is only ever switched to from strain limiting, which records the
+    // frames it is built from
+    reduced.Recording(level_ == QUALITY_STRAIN_LIMITED);
+
+    substeps_ = minSubsteps[level_];
+    if (substepCost_[level_] > 0) {
+        int affordable = (int) ((planned - overhead_) / substepCost_[level_]);
+        substeps_ = std::min(maxSubsteps[level_], std::max(minSubsteps[level_], affordable));
+    }
+    return substeps_;
+}
+
+void SubstepScheduler::StartFrame() {
+    frameStart_ = Clock::now();
+}
+
+void SubstepScheduler::SubstepsDone() {
+    substepsEnd_ = Clock::now();
+}
+
+void SubstepScheduler::EndFrame() {
+    Clock::time_point end = Clock::now();
+    double substepTime = Seconds(substepsEnd_ - frameStart_);
+    double frameTime = Seconds(end - frameStart_);
+
+    double cost = substepTime / substeps_;
+    double& average = substepCost_[level_];
+    // the first frame after a switch replaces whatever was known about the level
+    average = average == 0 || remeasure_ ? cost : average + COST_SMOOTHING * (cost - average);
+    remeasure_ = false;
+    overhead_ += COST_SMOOTHING * (frameTime - substepTime - overhead_);
+    if (frameTime > budget_)
+        calmStart_ = end;
+
+    ++frames_;
+    frameTime_ += frameTime;
+    maxFrameTime_ = std::max(maxFrameTime_, frameTime);
+    if (frameTime > budget_)
+        ++overBudget_;
+    if (Seconds(end - reportStart_) >= 1)
+        Report();
+}
+
+void SubstepScheduler::Report() {
+    if (enabled_) {
+        cout << "Sim: " << levelNames[level_] << ", " << substeps_ << " substeps, "
+             << frameTime_ / frames_ * 1000 << " ms per frame (max " << maxFrameTime_ * 1000
+             << ", " << overBudget_ << " of " << frames_ << " over the " << budget_ * 1000
+             << " ms budget)" << endl;
+    }
+    reportStart_ = Clock::now();
+    frames_ = 0;
+    overBudget_ = 0;
+    frameTime_ = 0;
+    maxFrameTime_ = 0;
+}
@@ -0,0 +1,159 @@
+#include "include/sweep.h"
+#include "include/numa.h"
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+vector<SweepRun> SweepGrid(const vector<std::pair<int, int> >& sizes, const vector<double>& ks,
+                           const vector<double>& kd, const vector<double>& dt, int steps) {
+    vector<SweepRun> runs;
+    for (const std::pair<int, int>& size : sizes) {
+        for (double k : ks) {
+            for (double d : kd) {
+                for (double t : dt) {
+                    SweepRun run = SweepRun();
+                    run.dimX = size.first;
+                    run.dimY = size.second;
+                    run.ks = k;
+                    run.kd = d;
+                    run.dt = t;
+                    run.steps = steps;
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+    return runs;
+}
+
+// largest strain of the springs between neighbouring nodes, infinite if a node isn't
+// finite any more
+static double MaxStrain(SpringSystem& ss) {
+    const int dimX = ss.DimX();
+    const int dimY = ss.DimY();
+    const double rest = ss.GetRestLength();
+    double strain = 0;
+    for (int r = 0; r < dimY; ++r) {
+        for (int c = 0; c < dimX; ++c) {
+            const highp_dvec3& p = ss.GetNode(r, c).pos;
+            if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                return INFINITY;
+            if (c + 1 < dimX)
+                strain = fmax(strain, length(ss.GetNode(r, c + 1).pos - p) / rest - 1);
+            if (r + 1 < dimY)
+                strain = fmax(strain, length(ss.GetNode(r + 1, c).pos - p) / rest - 1);
+        }
+    }
+    return strain;
+}
+
+static double MaxSpeed(SpringSystem& ss) {
+    double speed = 0;
+    for (int r = 0; r < ss.DimY(); ++r)
+        for (int c = 0; c < ss.DimX(); ++c)
+            speed = fmax(speed, length(ss.GetNode(r, c).vel));
+    return speed;
+}
+
+static void Run(SweepRun& run, const SweepOptions& options) {
+    SpringSystem ss(run.dimX, run.dimY, run.ks, run.kd);
+    ss.SimSetup();
+    ss.SetLayout(options.layout);
+    // the other runs have the other cores
+    ss.Threads(1);
+    ss.Drag(options.drag);
+    ss.wind = options.wind;
+    ss.stuck = options.pinned;
+
+    run.stable = true;
+    run.stepsDone = 0;
+    run.maxStrain = 0;
+    run.settleTime = -1;
+    double stepping = 0;
+    while (run.stepsDone < run.steps) {
+        const int steps = std::min(options.sample, run.steps - run.stepsDone);
+        double start = omp_get_wtime();
+        for (int i = 0; i < steps; ++i)
+            ss.Update(run.dt);
+        stepping += omp_get_wtime() - start;
+        run.stepsDone += steps;
+
+        double strain = MaxStrain(ss);
+        run.maxStrain = fmax(run.maxStrain, strain);
+        if (!(strain <= SWEEP_BLOWUP_STRAIN)) {
+            run.stable = false;
+            run.settleTime = -1;
+            break;
+        }
+        if (MaxSpeed(ss) >= options.settleSpeed)
+            run.settleTime = -1;
+        else if (run.settleTime < 0)
+            run.settleTime = run.stepsDone * run.dt;
+    }
+    run.stepsPerSecond = stepping > 0 ? run.stepsDone / stepping : 0;
+}
+
+void RunSweep(vector<SweepRun>& runs, const SweepOptions& options) {
+    // the biggest runs go first, so no core is left with a long one at the end
+    vector<int> order(runs.size());
+    for (size_t i = 0; i < runs.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&runs](int a, int b) {
+        return (double) runs[a].dimX * runs[a].dimY * runs[a].steps >
+               (double) runs[b].dimX * runs[b].dimY * runs[b].steps;
+    });
+
+    int jobs = options.jobs > 0 ? options.jobs : omp_get_num_procs();
+    jobs = std::max(1, std::min(jobs, (int) runs.size()));
+    const vector<int> cpus = AffinityCpus(jobs);
+    // the first call picks the kernels and says which, it isn't safe from several threads
+    KernelLevel();
+
+    std::atomic<int> next(0);
+    std::mutex printing;
+    int done = 0;
+    vector<std::thread> threads;
+    for (int t = 0; t < jobs; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            // Threads(1) only covers the step, building the cloth and SetLayout would
+            // still start a full OpenMP team from every sweep thread, pinned to its CPU
+            omp_set_num_threads(1);
+            if (!cpus.empty())
+                PinThread(cpus[t]);
+            for (int i = next++; i < (int) runs.size(); i = next++) {
+                SweepRun& run = runs[order[i]];
+                Run(run, options);
+                std::lock_guard<std::mutex> lock(printing);
+                ++done;
+                printf("%4d/%d  %dx%d ks %g kd %g dt %g: %s, strain %.3g, %.1f steps/s\n", done,
+                       (int) runs.size(), run.dimX, run.dimY, run.ks, run.kd, run.dt,
+                       run.stable ? "stable" : "blew up", run.maxStrain, run.stepsPerSecond);
+            }
+        }));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+bool WriteSweepCsv(const vector<SweepRun>& runs, const string& file) {
+    FILE* out = fopen(file.c_str(), "w");
+    if (!out) {
+        cout << "Can't write " << file << endl;
+        return false;
+    }
+    fprintf(out, "cols,rows,ks,kd,dt,steps,stable,steps_done,max_strain,settle_time,"
+                 "steps_per_s\n");
+    for (const SweepRun& run : runs) {
+        fprintf(out, "%d,%d,%.17g,%.17g,%.17g,%d,%d,%d,%.9g,", run.dimX, run.dimY, run.ks, run.kd,
+                run.dt, run.steps, run.stable ? 1 : 0, run.stepsDone, run.maxStrain);
+        // left empty if the cloth never settled
+        if (run.settleTime >= 0)
+            fprintf(out, "%.9g", run.settleTime);
+        fprintf(out, ",%.1f\n", run.stepsPerSecond);
+    }
+    fclose(out);
+    return true;
+}
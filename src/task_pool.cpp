@@ -0,0 +1,154 @@
+#include "include/task_pool.h"
+
+// the queue of the thread that is running, -1 outside of a pool's workers
+static thread_local int threadQueue = -1;
+static thread_local TaskPool* threadPool = nullptr;
+
+TaskPool::TaskPool(int numThreads) :
+    queued_(0),
+    stop_(false)
+{
+    int numWorkers = numThreads > 1 ? numThreads - 1 : 0;
+    for (int i = 0; i <= numWorkers; ++i)
+        queues_.push_back(std::unique_ptr<Queue>(new Queue));
+    for (int i = 0; i < numWorkers; ++i)
+        workers_.push_back(std::thread(&TaskPool::WorkerLoop, this, i));
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void TaskPool::Push(const Job& job) {
+    int queue = threadPool == this ? threadQueue : workers_.size();
+    {
+        std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+        queues_[queue]->jobs.push_back(job);
+    }
+    ++queued_;
+    // a thread deciding to sleep checks queued_ with this mutex held, so it either sees
+    // the job or is already waiting for the notification
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    wake_.notify_one();
+}
+
+// the newest job of a queue
+bool TaskPool::Pop(int queue, Job& job) {
+    std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+    if (queues_[queue]->jobs.empty())
+        return false;
+    job = queues_[queue]->jobs.back();
+    queues_[queue]->jobs.pop_back();
+    return true;
+}
+
+// the oldest job of any other queue
+bool TaskPool::Steal(int thief, Job& job) {
+    int numQueues = queues_.size();
+    for (int k = 1; k < numQueues; ++k) {
+        Queue& victim = *queues_[(thief + k) % numQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskPool::RunOne() {
+    int self = threadPool == this ? threadQueue : workers_.size();
+    Job job;
+    if (!Pop(self, job) && !Steal(self, job))
+        return false;
+    --queued_;
+    job.graph->Execute(job.task);
+    return true;
+}
+
+void TaskPool::Wait(const std::atomic<int>& remaining) {
+    while (remaining > 0) {
+        if (RunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [&]() { return remaining == 0 || queued_ > 0; });
+    }
+}
+
+void TaskPool::Finished() {
+    { std::lock_guard<std::mutex> lock(sleepMutex_); }
+    wake_.notify_all();
+}
+
+void TaskPool::WorkerLoop(int index) {
+    threadQueue = index;
+    threadPool = this;
+    while (true) {
+        if (RunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wake_.wait(lock, [&]() { return stop_ || queued_ > 0; });
+        if (stop_ && queued_ == 0)
+            return;
+    }
+}
+
+TaskGraph::TaskGraph() :
+    waitingSize_(0),
+    remaining_(0),
+    pool_(nullptr)
+{
+}
+
+int TaskGraph::Add(std::function<void()> task) {
+    Task t;
+    t.run = task;
+    t.predecessors = 0;
+    tasks_.push_back(t);
+    return tasks_.size() - 1;
+}
+
+void TaskGraph::Precede(int before, int after) {
+    tasks_[before].successors.push_back(after);
+    ++tasks_[after].predecessors;
+}
+
+void TaskGraph::Clear() {
+    tasks_.clear();
+}
+
+void TaskGraph::Run(TaskPool& pool) {
+    const int n = tasks_.size();
+    if (n == 0)
+        return;
+    if (waitingSize_ < n) {
+        waiting_.reset(new std::atomic<int>[n]);
+        waitingSize_ = n;
+    }
+    for (int i = 0; i < n; ++i)
+        waiting_[i] = tasks_[i].predecessors;
+    pool_ = &pool;
+    remaining_ = n;
+    for (int i = 0; i < n; ++i)
+        if (tasks_[i].predecessors == 0)
+            pool.Push(TaskPool::Job { this, i });
+    pool.Wait(remaining_);
+}
+
+void TaskGraph::Execute(int task) {
+    TaskPool* pool = pool_;
+    tasks_[task].run();
+    for (int next : tasks_[task].successors)
+        if (waiting_[next].fetch_sub(1) == 1)
+            pool->Push(TaskPool::Job { this, next });
+    // the graph may be gone as soon as the last task is counted
+    if (remaining_.fetch_sub(1) == 1)
+        pool->Finished();
+}